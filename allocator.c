@@ -0,0 +1,358 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+
+#ifdef __x86_64__
+#define NCALLEE 5
+#elif __aarch64__
+#define NCALLEE 10
+#else
+#error
+#endif
+
+typedef struct {
+    uint64_t *use;
+    uint64_t *def;
+    uint64_t *in;
+    uint64_t *out;
+    size_t succ[2];
+} point_t;
+
+typedef struct {
+    idlist_t *idl;
+    size_t start;
+    size_t end;
+    size_t weight;
+} range_t;
+
+void allocator(astree_t *);
+static void allocate_def(astree_t *);
+static void allocate_param(astree_t *, size_t);
+static void allocate_stmt(astree_t *, size_t);
+static void allocate_expr(astree_t *, size_t, size_t);
+static void allocate_live(void);
+static void allocate_scan(range_t *, size_t);
+static size_t allocate_layout(idlist_t *, size_t, size_t);
+static size_t point_new(void);
+static void point_free(void);
+static void bitset_set(uint64_t *, size_t);
+static bool bitset_test(uint64_t *, size_t);
+static int range_cmp(const void *, const void *);
+
+static _Thread_local point_t *point;
+static _Thread_local size_t npoint;
+static _Thread_local size_t cpoint;
+static _Thread_local size_t nword;
+static _Thread_local size_t *weight;
+static _Thread_local bool leaf;
+
+void allocator(astree_t *ast) {
+    for (; ast != NULL; ast = ast->def_next) {
+        if (!ast->def_proto) {
+            allocate_def(ast);
+        }
+    }
+    return;
+}
+
+void allocate_def(astree_t *ast) {
+    size_t nvar = ast->def_local != NULL ? ast->def_local->idx + 1 : 0;
+    nword = (nvar + 63) / 64;
+    weight = calloc(nvar + 1, sizeof(size_t));
+    assert(weight != NULL);
+    leaf = true;
+    allocate_param(ast->def_param, point_new());
+    allocate_stmt(ast->def_body, 0);
+    allocate_live();
+    range_t *range = malloc(sizeof(range_t) * (nvar + 1));
+    assert(range != NULL);
+    size_t nrange = 0;
+    for (idlist_t *idl = ast->def_local; idl != NULL; idl = idl->next) {
+        idl->reg = 0;
+        range_t *r = &range[nrange];
+        r->idl = idl;
+        r->start = SIZE_MAX;
+        r->end = 0;
+        r->weight = weight[idl->idx];
+        for (size_t i = 0; i < npoint; i++) {
+            if (bitset_test(point[i].in, idl->idx) || bitset_test(point[i].out, idl->idx) || bitset_test(point[i].def, idl->idx)) {
+                r->start = r->start < i ? r->start : i;
+                r->end = i;
+            }
+        }
+        if (r->start != SIZE_MAX) {
+            nrange++;
+        }
+    }
+    allocate_scan(range, nrange);
+    ast->def_leaf = leaf;
+    ast->def_nreg = 0;
+    for (idlist_t *idl = ast->def_local; idl != NULL; idl = idl->next) {
+        ast->def_nreg = idl->reg > ast->def_nreg ? idl->reg : ast->def_nreg;
+    }
+    ast->def_size = allocate_layout(ast->def_local, nvar, ast->def_nreg * 8);
+    free(range);
+    free(weight);
+    point_free();
+    return;
+}
+
+void allocate_param(astree_t *ast, size_t entry) {
+    for (; ast != NULL; ast = ast->arg_next) {
+        bitset_set(point[entry].def, ast->arg_val->var_idl->idx);
+    }
+    return;
+}
+
+void allocate_stmt(astree_t *ast, size_t depth) {
+    if (ast == NULL) {
+        return;
+    }
+    switch (ast->kind) {
+    case AS_BLK:
+        allocate_stmt(ast->blk_body, depth);
+        allocate_stmt(ast->blk_next, depth);
+        break;
+    case AS_IF: {
+        size_t cond = point_new();
+        allocate_expr(ast->if_cond, cond, depth);
+        allocate_stmt(ast->if_then, depth);
+        size_t jump = point_new();
+        point[cond].succ[1] = npoint;
+        allocate_stmt(ast->if_else, depth);
+        point[jump].succ[0] = npoint;
+        break;
+    }
+    case AS_WHILE: {
+        size_t cond = point_new();
+        allocate_expr(ast->while_cond, cond, depth + 1);
+        allocate_stmt(ast->while_body, depth + 1);
+        size_t jump = point_new();
+        point[jump].succ[0] = cond;
+        point[cond].succ[1] = npoint;
+        break;
+    }
+    case AS_FOR: {
+        allocate_stmt(ast->for_init, depth);
+        size_t cond = point_new();
+        allocate_stmt(ast->for_body, depth + 1);
+        allocate_stmt(ast->for_step, depth + 1);
+        size_t jump = point_new();
+        point[jump].succ[0] = cond;
+        if (ast->for_cond != NULL) {
+            allocate_expr(ast->for_cond, cond, depth + 1);
+            point[cond].succ[1] = npoint;
+        }
+        break;
+    }
+    case AS_RET: {
+        size_t ret = point_new();
+        allocate_expr(ast->ret_val, ret, depth);
+        point[ret].succ[0] = SIZE_MAX;
+        break;
+    }
+    default:
+        allocate_expr(ast, point_new(), depth);
+        break;
+    }
+    return;
+}
+
+void allocate_expr(astree_t *ast, size_t idx, size_t depth) {
+    if (ast == NULL) {
+        return;
+    }
+    size_t freq = 1;
+    for (size_t i = 0; i < depth && i < 6; i++) {
+        freq *= 10;
+    }
+    switch (ast->kind) {
+    case AS_ASG:
+        allocate_expr(ast->bin_right, idx, depth);
+        bitset_set(point[idx].def, ast->bin_left->var_idl->idx);
+        weight[ast->bin_left->var_idl->idx] += freq;
+        break;
+    case AS_CAST:
+        allocate_expr(ast->cast_val, idx, depth);
+        break;
+    case AS_FNC:
+        leaf = false;
+        allocate_expr(ast->fnc_arg, idx, depth);
+        break;
+    case AS_ARG:
+        allocate_expr(ast->arg_val, idx, depth);
+        allocate_expr(ast->arg_next, idx, depth);
+        break;
+    case AS_VAR:
+        bitset_set(point[idx].use, ast->var_idl->idx);
+        weight[ast->var_idl->idx] += freq;
+        break;
+    case AS_NUM:
+        break;
+    default:
+        allocate_expr(ast->bin_left, idx, depth);
+        allocate_expr(ast->bin_right, idx, depth);
+        break;
+    }
+    return;
+}
+
+void allocate_live(void) {
+    bool change;
+    do {
+        change = false;
+        for (size_t i = npoint; i > 0; i--) {
+            point_t *p = &point[i - 1];
+            for (size_t w = 0; w < nword; w++) {
+                uint64_t out = 0;
+                for (size_t s = 0; s < 2; s++) {
+                    if (p->succ[s] < npoint) {
+                        out |= point[p->succ[s]].in[w];
+                    }
+                }
+                uint64_t in = p->use[w] | (out & ~p->def[w]);
+                change |= in != p->in[w] || out != p->out[w];
+                p->in[w] = in;
+                p->out[w] = out;
+            }
+        }
+    } while (change);
+    return;
+}
+
+void allocate_scan(range_t *range, size_t nrange) {
+    qsort(range, nrange, sizeof(range_t), range_cmp);
+    range_t *active[NCALLEE];
+    size_t nactive = 0;
+    for (size_t i = 0; i < nrange; i++) {
+        range_t *cur = &range[i];
+        bool busy[NCALLEE] = {false};
+        for (size_t j = 0; j < nactive;) {
+            if (active[j]->end < cur->start) {
+                active[j] = active[--nactive];
+            } else {
+                busy[active[j++]->idl->reg - 1] = true;
+            }
+        }
+        if (nactive < NCALLEE) {
+            size_t reg = 0;
+            while (busy[reg]) {
+                reg++;
+            }
+            cur->idl->reg = reg + 1;
+            active[nactive++] = cur;
+            continue;
+        }
+        size_t min = 0;
+        for (size_t j = 1; j < nactive; j++) {
+            if (active[j]->weight < active[min]->weight || (active[j]->weight == active[min]->weight && active[j]->end > active[min]->end)) {
+                min = j;
+            }
+        }
+        if (active[min]->weight < cur->weight) {
+            cur->idl->reg = active[min]->idl->reg;
+            active[min]->idl->reg = 0;
+            active[min] = cur;
+        }
+    }
+    return;
+}
+
+size_t allocate_layout(idlist_t *local, size_t nvar, size_t base) {
+    uint64_t *inter = calloc(nvar * nword + 1, sizeof(uint64_t));
+    uint64_t *live = calloc(nword + 1, sizeof(uint64_t));
+    size_t *color = calloc(nvar + 1, sizeof(size_t));
+    bool *taken = calloc(nvar + 1, sizeof(bool));
+    assert(inter != NULL && live != NULL && color != NULL && taken != NULL);
+    for (size_t i = 0; i < npoint; i++) {
+        for (size_t w = 0; w < nword; w++) {
+            live[w] = point[i].in[w] | point[i].out[w] | point[i].def[w];
+        }
+        for (size_t v = 0; v < nvar; v++) {
+            if (bitset_test(live, v)) {
+                for (size_t w = 0; w < nword; w++) {
+                    inter[v * nword + w] |= live[w];
+                }
+            }
+        }
+    }
+    size_t nslot[TY_LONG + 1] = {0};
+    for (idlist_t *cur = local; cur != NULL; cur = cur->next) {
+        if (cur->reg != 0) {
+            continue;
+        }
+        for (size_t c = 0; c < nslot[cur->type]; c++) {
+            taken[c] = false;
+        }
+        for (idlist_t *other = local; other != cur; other = other->next) {
+            if (other->reg == 0 && other->type == cur->type && bitset_test(&inter[cur->idx * nword], other->idx)) {
+                taken[color[other->idx]] = true;
+            }
+        }
+        size_t c = 0;
+        while (c < nslot[cur->type] && taken[c]) {
+            c++;
+        }
+        color[cur->idx] = c;
+        nslot[cur->type] = c + 1 > nslot[cur->type] ? c + 1 : nslot[cur->type];
+    }
+    size_t ofs = base;
+    for (size_t type = TY_LONG + 1; type > 0; type--) {
+        for (idlist_t *cur = local; cur != NULL; cur = cur->next) {
+            if (cur->reg == 0 && cur->type == type - 1) {
+                cur->ofs = ofs + (color[cur->idx] + 1) * tykind_size(cur->type);
+            }
+        }
+        ofs += nslot[type - 1] * tykind_size(type - 1);
+    }
+    free(inter);
+    free(live);
+    free(color);
+    free(taken);
+    return (ofs + 15) & ~(size_t)15;
+}
+
+size_t point_new(void) {
+    if (npoint == cpoint) {
+        cpoint = cpoint == 0 ? 64 : cpoint * 2;
+        point = realloc(point, sizeof(point_t) * cpoint);
+        assert(point != NULL);
+    }
+    point_t *p = &point[npoint];
+    p->use = calloc(nword * 4 + 1, sizeof(uint64_t));
+    assert(p->use != NULL);
+    p->def = p->use + nword;
+    p->in = p->def + nword;
+    p->out = p->in + nword;
+    p->succ[0] = npoint + 1;
+    p->succ[1] = SIZE_MAX;
+    return npoint++;
+}
+
+void point_free(void) {
+    for (size_t i = 0; i < npoint; i++) {
+        free(point[i].use);
+    }
+    free(point);
+    point = NULL;
+    npoint = cpoint = 0;
+    return;
+}
+
+void bitset_set(uint64_t *set, size_t idx) {
+    set[idx / 64] |= (uint64_t)1 << (idx % 64);
+    return;
+}
+
+bool bitset_test(uint64_t *set, size_t idx) {
+    return (set[idx / 64] >> (idx % 64)) & 1;
+}
+
+int range_cmp(const void *left, const void *right) {
+    const range_t *l = left, *r = right;
+    return (l->start > r->start) - (l->start < r->start);
+}
@@ -0,0 +1,937 @@
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <ctype.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "main.h"
+
+#define NBUCKET 4096
+#define NCODE 16
+#define NSTUB 16
+
+#ifdef __x86_64__
+#define RELOC_AT 1
+#define RELOC_TYPE R_X86_64_PLT32
+#define RELOC_ADDEND -4
+#define TEXT_ALIGN 16
+#define TEXT_MACHINE EM_X86_64
+#elif __aarch64__
+#define RELOC_AT 0
+#define RELOC_TYPE R_AARCH64_CALL26
+#define RELOC_ADDEND 0
+#define TEXT_ALIGN 4
+#define TEXT_MACHINE EM_AARCH64
+#else
+#error
+#endif
+
+typedef struct {
+    char *name;
+    size_t item;
+    bool global;
+    size_t elf;
+    size_t next;
+} assym_t;
+
+typedef struct {
+    size_t ofs;
+    size_t size;
+    size_t grow;
+    size_t target;
+} asitem_t;
+
+typedef struct {
+    size_t ofs;
+    size_t sym;
+} asreloc_t;
+
+void assembler(FILE *, FILE *);
+int assembler_run(FILE *);
+void assembler_perfmap(bool);
+static void assemble_scan(FILE *);
+static void assemble_relax(void);
+static void assemble_encode(FILE *);
+static void assemble_write(FILE *);
+static void assemble_free(void);
+static void assemble_map(unsigned char *);
+static bool assemble_line(insn_t *, char *, FILE *);
+static size_t sym_find(char *);
+static size_t sym_ofs(size_t);
+static size_t sym_size(size_t);
+static void put(unsigned char *, size_t *, uint64_t, size_t);
+static bool encode_branch(insn_t *, size_t *, size_t *);
+static size_t encode(insn_t *, unsigned char *, asitem_t *, size_t *);
+static void encode_stub(unsigned char *, uintptr_t);
+static void encode_call(unsigned char *, uintptr_t);
+
+static _Thread_local assym_t *sym;
+static _Thread_local size_t nsym;
+static _Thread_local size_t csym;
+static _Thread_local size_t bucket[NBUCKET];
+static _Thread_local asitem_t *item;
+static _Thread_local size_t nitem;
+static _Thread_local size_t citem;
+static _Thread_local asreloc_t *reloc;
+static _Thread_local size_t nreloc;
+static _Thread_local size_t creloc;
+static _Thread_local unsigned char *text;
+static _Thread_local size_t ntext;
+static _Thread_local size_t ctext;
+static bool perfmap;
+
+void assembler(FILE *ofp, FILE *ifp) {
+    for (size_t i = 0; i < NBUCKET; i++) {
+        bucket[i] = SIZE_MAX;
+    }
+    assemble_scan(ifp);
+    assemble_relax();
+    rewind(ifp);
+    assemble_encode(ifp);
+    assemble_write(ofp);
+    assemble_free();
+    return;
+}
+
+/* Encodes into an anonymous mapping that is writable while the calls are
+   resolved and only then executable, and returns what main returns. Calls to
+   functions outside the program go through a stub holding the absolute
+   address dlsym found, since it may be out of direct-call range. */
+int assembler_run(FILE *ifp) {
+    for (size_t i = 0; i < NBUCKET; i++) {
+        bucket[i] = SIZE_MAX;
+    }
+    assemble_scan(ifp);
+    assemble_relax();
+    rewind(ifp);
+    assemble_encode(ifp);
+    size_t nstub = 0;
+    for (size_t i = 0; i < nsym; i++) {
+        sym[i].elf = sym[i].item == SIZE_MAX ? nstub++ : SIZE_MAX;
+    }
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (ntext + NSTUB * nstub + page - 1) / page * page;
+    unsigned char *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(mem != MAP_FAILED);
+    memcpy(mem, text, ntext);
+    void *self = dlopen(NULL, RTLD_NOW);
+    assert(self != NULL);
+    for (size_t i = 0; i < nsym; i++) {
+        if (sym[i].elf != SIZE_MAX) {
+            void *addr = dlsym(self, sym[i].name);
+            if (addr == NULL) {
+                fprintf(stderr, "assembler: undefined symbol '%s'\n", sym[i].name);
+                assert(false);
+            }
+            encode_stub(mem + ntext + NSTUB * sym[i].elf, (uintptr_t)addr);
+        }
+    }
+    for (size_t i = 0; i < nreloc; i++) {
+        size_t s = reloc[i].sym;
+        unsigned char *target = sym[s].elf == SIZE_MAX ? mem + sym_ofs(s) : mem + ntext + NSTUB * sym[s].elf;
+        encode_call(mem + reloc[i].ofs, (uintptr_t)target);
+    }
+    assert(mprotect(mem, size, PROT_READ | PROT_EXEC) == 0);
+    __builtin___clear_cache((char *)mem, (char *)mem + size);
+    if (perfmap) {
+        assemble_map(mem);
+    }
+    size_t main = sym_find("main");
+    assert(sym[main].item != SIZE_MAX);
+    uintptr_t addr = (uintptr_t)(mem + sym_ofs(main));
+    int (*entry)(void);
+    memcpy(&entry, &addr, sizeof(entry));
+    fflush(stdout);
+    int status = entry();
+    fflush(stdout);
+    assert(munmap(mem, size) == 0);
+    dlclose(self);
+    assemble_free();
+    return status;
+}
+
+void assembler_perfmap(bool on) {
+    perfmap = on;
+    return;
+}
+
+/* First pass: size every instruction, taking branches short, and note which
+   item each label precedes. */
+void assemble_scan(FILE *ifp) {
+    char line[INSN_LINE];
+    insn_t insn;
+    while (assemble_line(&insn, line, ifp)) {
+        if (insn.kind == IN_LABEL) {
+            size_t s = sym_find(insn.text);
+            assert(sym[s].item == SIZE_MAX);
+            sym[s].item = nitem;
+            continue;
+        }
+        if (insn.kind == IN_TEXT) {
+            char name[INSN_LINE];
+            if (sscanf(insn.text, " .global %s", name) == 1 || sscanf(insn.text, " .globl %s", name) == 1) {
+                size_t s = sym_find(name);
+                sym[s].global = true;
+            }
+            continue;
+        }
+        if (nitem == citem) {
+            citem = citem == 0 ? 1024 : citem * 2;
+            item = realloc(item, sizeof(asitem_t) * citem);
+            assert(item != NULL);
+        }
+        asitem_t *it = &item[nitem++];
+        *it = (asitem_t){.target = SIZE_MAX};
+        if (encode_branch(&insn, &it->size, &it->grow)) {
+            it->target = sym_find(insn.arg[insn.narg - 1]);
+        } else {
+            unsigned char code[NCODE];
+            size_t call;
+            it->size = encode(&insn, code, it, &call);
+        }
+    }
+    return;
+}
+
+/* Lengthens every branch whose target is out of short range until nothing
+   changes, the same fixed point the system assembler finds. */
+void assemble_relax(void) {
+    for (bool change = true; change;) {
+        change = false;
+        size_t ofs = 0;
+        for (size_t i = 0; i < nitem; i++) {
+            item[i].ofs = ofs;
+            ofs += item[i].size;
+        }
+        for (size_t i = 0; i < nitem; i++) {
+            if (item[i].grow == 0) {
+                continue;
+            }
+            assert(sym[item[i].target].item != SIZE_MAX);
+            long long dist = (long long)sym_ofs(item[i].target) - (long long)(item[i].ofs + item[i].size);
+            if (dist < -128 || dist > 127) {
+                item[i].size += item[i].grow;
+                item[i].grow = 0;
+                change = true;
+            }
+        }
+    }
+    return;
+}
+
+void assemble_encode(FILE *ifp) {
+    char line[INSN_LINE];
+    insn_t insn;
+    size_t idx = 0;
+    while (assemble_line(&insn, line, ifp)) {
+        if (insn.kind != IN_OP) {
+            continue;
+        }
+        asitem_t *it = &item[idx++];
+        if (ntext + NCODE > ctext) {
+            ctext = ctext == 0 ? 4096 : ctext * 2;
+            text = realloc(text, ctext);
+            assert(text != NULL);
+        }
+        size_t call;
+        size_t len = encode(&insn, text + ntext, it, &call);
+        assert(len == it->size && ntext == it->ofs);
+        if (call != SIZE_MAX) {
+            if (nreloc == creloc) {
+                creloc = creloc == 0 ? 64 : creloc * 2;
+                reloc = realloc(reloc, sizeof(asreloc_t) * creloc);
+                assert(reloc != NULL);
+            }
+            reloc[nreloc++] = (asreloc_t){ntext + RELOC_AT, call};
+        }
+        ntext += len;
+    }
+    assert(idx == nitem);
+    return;
+}
+
+void assemble_write(FILE *ofp) {
+    static char shstr[] = "\0.text\0.rela.text\0.symtab\0.strtab\0.shstrtab\0.note.GNU-stack";
+    enum { SH_NULL, SH_TEXT, SH_RELA, SH_SYMTAB, SH_STRTAB, SH_SHSTRTAB, SH_NOTE, NSH };
+    Elf64_Sym *symtab = calloc(nsym + 2, sizeof(Elf64_Sym));
+    char *strtab = malloc(1);
+    assert(symtab != NULL && strtab != NULL);
+    size_t nelf = 2, nstr = 1;
+    strtab[0] = '\0';
+    symtab[1] = (Elf64_Sym){.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION), .st_shndx = SH_TEXT};
+    size_t local = 0;
+    for (size_t pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            local = nelf;
+        }
+        for (size_t i = 0; i < nsym; i++) {
+            if (strncmp(sym[i].name, ".L", 2) == 0 || (sym[i].item != SIZE_MAX && !sym[i].global) != (pass == 0)) {
+                continue;
+            }
+            size_t len = strlen(sym[i].name) + 1;
+            strtab = realloc(strtab, nstr + len);
+            assert(strtab != NULL);
+            memcpy(strtab + nstr, sym[i].name, len);
+            Elf64_Sym *es = &symtab[nelf];
+            *es = (Elf64_Sym){.st_name = nstr, .st_info = ELF64_ST_INFO(pass == 0 ? STB_LOCAL : STB_GLOBAL, STT_NOTYPE)};
+            if (sym[i].item != SIZE_MAX) {
+                es->st_info = ELF64_ST_INFO(ELF64_ST_BIND(es->st_info), STT_FUNC);
+                es->st_shndx = SH_TEXT;
+                es->st_value = sym_ofs(i);
+                es->st_size = sym_size(i);
+            }
+            sym[i].elf = nelf++;
+            nstr += len;
+        }
+    }
+    Elf64_Rela *rela = calloc(nreloc + 1, sizeof(Elf64_Rela));
+    assert(rela != NULL);
+    for (size_t i = 0; i < nreloc; i++) {
+        rela[i] = (Elf64_Rela){.r_offset = reloc[i].ofs, .r_info = ELF64_R_INFO(sym[reloc[i].sym].elf, RELOC_TYPE), .r_addend = RELOC_ADDEND};
+    }
+    Elf64_Shdr sh[NSH] = {{0}};
+    size_t ofs = sizeof(Elf64_Ehdr);
+    sh[SH_TEXT] = (Elf64_Shdr){.sh_name = 1, .sh_type = SHT_PROGBITS, .sh_flags = SHF_ALLOC | SHF_EXECINSTR, .sh_offset = ofs, .sh_size = ntext, .sh_addralign = TEXT_ALIGN};
+    ofs += ntext;
+    ofs = (ofs + 7) & ~(size_t)7;
+    sh[SH_RELA] = (Elf64_Shdr){.sh_name = 7, .sh_type = SHT_RELA, .sh_flags = SHF_INFO_LINK, .sh_offset = ofs, .sh_size = sizeof(Elf64_Rela) * nreloc, .sh_link = SH_SYMTAB, .sh_info = SH_TEXT, .sh_addralign = 8, .sh_entsize = sizeof(Elf64_Rela)};
+    ofs += sh[SH_RELA].sh_size;
+    sh[SH_SYMTAB] = (Elf64_Shdr){.sh_name = 18, .sh_type = SHT_SYMTAB, .sh_offset = ofs, .sh_size = sizeof(Elf64_Sym) * nelf, .sh_link = SH_STRTAB, .sh_info = local, .sh_addralign = 8, .sh_entsize = sizeof(Elf64_Sym)};
+    ofs += sh[SH_SYMTAB].sh_size;
+    sh[SH_STRTAB] = (Elf64_Shdr){.sh_name = 26, .sh_type = SHT_STRTAB, .sh_offset = ofs, .sh_size = nstr, .sh_addralign = 1};
+    ofs += nstr;
+    sh[SH_SHSTRTAB] = (Elf64_Shdr){.sh_name = 34, .sh_type = SHT_STRTAB, .sh_offset = ofs, .sh_size = sizeof(shstr), .sh_addralign = 1};
+    ofs += sizeof(shstr);
+    sh[SH_NOTE] = (Elf64_Shdr){.sh_name = 44, .sh_type = SHT_PROGBITS, .sh_offset = ofs, .sh_addralign = 1};
+    ofs = (ofs + 7) & ~(size_t)7;
+    Elf64_Ehdr eh = {
+        .e_ident = {ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3, ELFCLASS64, ELFDATA2LSB, EV_CURRENT, ELFOSABI_SYSV},
+        .e_type = ET_REL,
+        .e_machine = TEXT_MACHINE,
+        .e_version = EV_CURRENT,
+        .e_shoff = ofs,
+        .e_ehsize = sizeof(Elf64_Ehdr),
+        .e_shentsize = sizeof(Elf64_Shdr),
+        .e_shnum = NSH,
+        .e_shstrndx = SH_SHSTRTAB,
+    };
+    static char zero[8];
+    assert(fwrite(&eh, sizeof(eh), 1, ofp) == 1);
+    assert(fwrite(text, 1, ntext, ofp) == ntext);
+    assert(fwrite(zero, 1, sh[SH_RELA].sh_offset - sizeof(eh) - ntext, ofp) == sh[SH_RELA].sh_offset - sizeof(eh) - ntext);
+    assert(fwrite(rela, sizeof(Elf64_Rela), nreloc, ofp) == nreloc);
+    assert(fwrite(symtab, sizeof(Elf64_Sym), nelf, ofp) == nelf);
+    assert(fwrite(strtab, 1, nstr, ofp) == nstr);
+    assert(fwrite(shstr, 1, sizeof(shstr), ofp) == sizeof(shstr));
+    assert(fwrite(zero, 1, ofs - sh[SH_NOTE].sh_offset, ofp) == ofs - sh[SH_NOTE].sh_offset);
+    assert(fwrite(sh, sizeof(Elf64_Shdr), NSH, ofp) == NSH);
+    free(symtab);
+    free(strtab);
+    free(rela);
+    return;
+}
+
+void assemble_free(void) {
+    for (size_t i = 0; i < nsym; i++) {
+        free(sym[i].name);
+    }
+    free(sym);
+    free(item);
+    free(reloc);
+    free(text);
+    sym = NULL;
+    item = NULL;
+    reloc = NULL;
+    text = NULL;
+    nsym = csym = nitem = citem = nreloc = creloc = ntext = ctext = 0;
+    return;
+}
+
+/* Describes the mapped code in the file perf looks for to symbolize
+   anonymous executable memory. The name is predictable, so an existing
+   file or link there is left alone rather than written through. */
+void assemble_map(unsigned char *mem) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%ld.map", (long)getpid());
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "assembler: cannot create '%s'\n", path);
+        return;
+    }
+    FILE *fp = fdopen(fd, "w");
+    assert(fp != NULL);
+    for (size_t i = 0; i < nsym; i++) {
+        if (sym[i].item != SIZE_MAX && strncmp(sym[i].name, ".L", 2) != 0) {
+            fprintf(fp, "%lx %zx %s\n", (unsigned long)(uintptr_t)(mem + sym_ofs(i)), sym_size(i), sym[i].name);
+        } else if (sym[i].item == SIZE_MAX) {
+            fprintf(fp, "%lx %x %s@plt\n", (unsigned long)(uintptr_t)(mem + ntext + NSTUB * sym[i].elf), NSTUB, sym[i].name);
+        }
+    }
+    assert(fclose(fp) == 0);
+    return;
+}
+
+bool assemble_line(insn_t *insn, char *line, FILE *ifp) {
+    if (fgets(line, INSN_LINE, ifp) == NULL) {
+        return false;
+    }
+    size_t len = strlen(line);
+    if (len > 0 && line[len - 1] == '\n') {
+        line[len - 1] = '\0';
+    }
+    insn_read(insn, line);
+    return true;
+}
+
+size_t sym_find(char *name) {
+    uint32_t hash = 2166136261u;
+    for (char *p = name; *p != '\0'; p++) {
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    size_t *head = &bucket[hash % NBUCKET];
+    for (size_t i = *head; i != SIZE_MAX; i = sym[i].next) {
+        if (strcmp(sym[i].name, name) == 0) {
+            return i;
+        }
+    }
+    if (nsym == csym) {
+        csym = csym == 0 ? 256 : csym * 2;
+        sym = realloc(sym, sizeof(assym_t) * csym);
+        assert(sym != NULL);
+    }
+    sym[nsym] = (assym_t){.item = SIZE_MAX, .next = *head};
+    sym[nsym].name = malloc(strlen(name) + 1);
+    assert(sym[nsym].name != NULL);
+    strcpy(sym[nsym].name, name);
+    *head = nsym;
+    return nsym++;
+}
+
+size_t sym_ofs(size_t idx) {
+    return sym[idx].item < nitem ? item[sym[idx].item].ofs : ntext;
+}
+
+/* Distance from a defined label to the next non-local one, or to the end. */
+size_t sym_size(size_t idx) {
+    size_t end = ntext;
+    for (size_t i = 0; i < nsym; i++) {
+        if (sym[i].item != SIZE_MAX && strncmp(sym[i].name, ".L", 2) != 0 && sym_ofs(i) > sym_ofs(idx) && sym_ofs(i) < end) {
+            end = sym_ofs(i);
+        }
+    }
+    return end - sym_ofs(idx);
+}
+
+void put(unsigned char *buf, size_t *len, uint64_t val, size_t nbyte) {
+    for (size_t i = 0; i < nbyte; i++) {
+        buf[(*len)++] = val >> 8 * i & 0xff;
+    }
+    return;
+}
+
+#ifdef __x86_64__
+
+typedef struct {
+    char kind;
+    int reg;
+    size_t width;
+    long long val;
+    int base;
+    int index;
+    int scale;
+} x86arg_t;
+
+static void x86_arg(char *, x86arg_t *);
+static int x86_reg(char *, size_t *);
+static int x86_cc(char *);
+static size_t x86_rm(unsigned char *, bool, bool, unsigned, int, bool, x86arg_t *);
+
+/* Short forms first; the relaxation pass adds grow bytes for rel32. */
+bool encode_branch(insn_t *insn, size_t *size, size_t *grow) {
+    if (insn->narg != 1 || insn->op[0] != 'j') {
+        return false;
+    }
+    *size = 2;
+    *grow = strcmp(insn->op, "jmp") == 0 ? 3 : 4;
+    return true;
+}
+
+size_t encode(insn_t *insn, unsigned char *buf, asitem_t *it, size_t *call) {
+    static char *alu[] = {"add", "or", "adc", "sbb", "and", "sub", "xor", "cmp", NULL};
+    char *op = insn->op;
+    size_t n = insn->narg, len = 0;
+    x86arg_t a[INSN_NARG];
+    for (size_t i = 0; i < n; i++) {
+        x86_arg(insn->arg[i], &a[i]);
+    }
+    char sfx = op[strlen(op) - 1];
+    bool w = sfx == 'q', p66 = sfx == 'w', byte = sfx == 'b';
+    *call = SIZE_MAX;
+    if (strcmp(op, "ret") == 0 || strcmp(op, "leave") == 0 || strcmp(op, "cltd") == 0) {
+        buf[len++] = op[0] == 'r' ? 0xc3 : op[0] == 'l' ? 0xc9 : 0x99;
+        return len;
+    }
+    if (strcmp(op, "cqto") == 0) {
+        buf[len++] = 0x48;
+        buf[len++] = 0x99;
+        return len;
+    }
+    if (strcmp(op, "call") == 0) {
+        assert(n == 1 && a[0].kind == 'l');
+        *call = sym_find(insn->arg[0]);
+        buf[len++] = 0xe8;
+        put(buf, &len, 0, 4);
+        return len;
+    }
+    if (op[0] == 'j') {
+        assert(n == 1 && it->target != SIZE_MAX);
+        long long disp = (long long)sym_ofs(it->target) - (long long)(it->ofs + it->size);
+        int cc = strcmp(op, "jmp") == 0 ? -1 : x86_cc(op + 1);
+        if (it->size == 2) {
+            assert(disp >= -128 && disp <= 127);
+            buf[len++] = cc < 0 ? 0xeb : 0x70 + cc;
+            put(buf, &len, disp, 1);
+        } else if (cc < 0) {
+            buf[len++] = 0xe9;
+            put(buf, &len, disp, 4);
+        } else {
+            buf[len++] = 0x0f;
+            buf[len++] = 0x80 + cc;
+            put(buf, &len, disp, 4);
+        }
+        return len;
+    }
+    if ((strcmp(op, "pushq") == 0 || strcmp(op, "popq") == 0) && a[0].kind == 'r') {
+        if (a[0].reg >= 8) {
+            buf[len++] = 0x41;
+        }
+        buf[len++] = (op[1] == 'u' ? 0x50 : 0x58) + (a[0].reg & 7);
+        return len;
+    }
+    if (strcmp(op, "movabsq") == 0) {
+        assert(a[0].kind == 'i' && a[1].kind == 'r');
+        buf[len++] = 0x48 | (a[1].reg >= 8);
+        buf[len++] = 0xb8 + (a[1].reg & 7);
+        put(buf, &len, a[0].val, 8);
+        return len;
+    }
+    if (strncmp(op, "set", 3) == 0) {
+        return x86_rm(buf, false, false, 0x0f90 + x86_cc(op + 3), 0, false, &a[0]);
+    }
+    if (strcmp(op, "movslq") == 0) {
+        return x86_rm(buf, true, false, 0x63, a[1].reg, false, &a[0]);
+    }
+    if (strncmp(op, "movs", 4) == 0 || strncmp(op, "movz", 4) == 0) {
+        unsigned code = (op[3] == 's' ? 0x0fbe : 0x0fb6) + (op[4] == 'w');
+        return x86_rm(buf, op[5] == 'q', false, code, a[1].reg, false, &a[0]);
+    }
+    if (strncmp(op, "lea", 3) == 0) {
+        return x86_rm(buf, w, false, 0x8d, a[1].reg, false, &a[0]);
+    }
+    if (strncmp(op, "mov", 3) == 0 && strlen(op) == 4) {
+        if (a[0].kind == 'i' && a[1].kind == 'r' && !w) {
+            if (p66) {
+                buf[len++] = 0x66;
+            }
+            if (a[1].reg >= 8 || (byte && a[1].reg >= 4)) {
+                buf[len++] = 0x40 | (a[1].reg >= 8);
+            }
+            buf[len++] = (byte ? 0xb0 : 0xb8) + (a[1].reg & 7);
+            put(buf, &len, a[0].val, byte ? 1 : p66 ? 2 : 4);
+            return len;
+        }
+        if (a[0].kind == 'i') {
+            len = x86_rm(buf, w, p66, byte ? 0xc6 : 0xc7, 0, false, &a[1]);
+            put(buf, &len, a[0].val, byte ? 1 : p66 ? 2 : 4);
+            return len;
+        }
+        if (a[0].kind == 'r') {
+            return x86_rm(buf, w, p66, byte ? 0x88 : 0x89, a[0].reg, byte, &a[1]);
+        }
+        return x86_rm(buf, w, p66, byte ? 0x8a : 0x8b, a[1].reg, byte, &a[0]);
+    }
+    for (int ext = 0; alu[ext] != NULL; ext++) {
+        if (strncmp(op, alu[ext], strlen(alu[ext])) != 0 || strlen(op) != strlen(alu[ext]) + 1) {
+            continue;
+        }
+        if (a[0].kind != 'i') {
+            if (a[0].kind == 'r') {
+                return x86_rm(buf, w, p66, (ext << 3) + !byte, a[0].reg, byte, &a[1]);
+            }
+            return x86_rm(buf, w, p66, (ext << 3) + 2 + !byte, a[1].reg, byte, &a[0]);
+        }
+        bool imm8 = a[0].val >= -128 && a[0].val <= 127;
+        if (!byte && imm8) {
+            len = x86_rm(buf, w, p66, 0x83, ext, false, &a[1]);
+            put(buf, &len, a[0].val, 1);
+        } else if (a[1].kind == 'r' && a[1].reg == 0) {
+            if (p66) {
+                buf[len++] = 0x66;
+            }
+            if (w) {
+                buf[len++] = 0x48;
+            }
+            buf[len++] = (ext << 3) + 4 + !byte;
+            put(buf, &len, a[0].val, byte ? 1 : p66 ? 2 : 4);
+        } else {
+            len = x86_rm(buf, w, p66, byte ? 0x80 : 0x81, ext, false, &a[1]);
+            put(buf, &len, a[0].val, byte ? 1 : p66 ? 2 : 4);
+        }
+        return len;
+    }
+    if (strncmp(op, "test", 4) == 0 && strlen(op) == 5 && a[0].kind == 'r') {
+        return x86_rm(buf, w, p66, byte ? 0x84 : 0x85, a[0].reg, byte, &a[1]);
+    }
+    if (strncmp(op, "imul", 4) == 0 && strlen(op) == 5) {
+        if (a[0].kind != 'i') {
+            return x86_rm(buf, w, p66, 0x0faf, a[1].reg, false, &a[0]);
+        }
+        bool imm8 = a[0].val >= -128 && a[0].val <= 127;
+        len = x86_rm(buf, w, p66, imm8 ? 0x6b : 0x69, a[1].reg, false, &a[1]);
+        put(buf, &len, a[0].val, imm8 ? 1 : p66 ? 2 : 4);
+        return len;
+    }
+    if ((strncmp(op, "idiv", 4) == 0 && strlen(op) == 5) || (strncmp(op, "div", 3) == 0 && strlen(op) == 4)) {
+        return x86_rm(buf, w, p66, byte ? 0xf6 : 0xf7, op[0] == 'i' ? 7 : 6, false, &a[0]);
+    }
+    if ((strncmp(op, "inc", 3) == 0 || strncmp(op, "dec", 3) == 0) && strlen(op) == 4) {
+        return x86_rm(buf, w, p66, byte ? 0xfe : 0xff, op[0] == 'd', false, &a[0]);
+    }
+    fprintf(stderr, "assembler: cannot encode '%s'\n", insn->text);
+    assert(false);
+    return 0;
+}
+
+/* jmp *0(%rip) followed by the absolute address. */
+void encode_stub(unsigned char *buf, uintptr_t addr) {
+    size_t len = 0;
+    buf[len++] = 0xff;
+    buf[len++] = 0x25;
+    put(buf, &len, 0, 4);
+    put(buf, &len, addr, 8);
+    return;
+}
+
+void encode_call(unsigned char *buf, uintptr_t addr) {
+    long long disp = (long long)addr - (long long)((uintptr_t)buf + 4);
+    assert(disp >= INT32_MIN && disp <= INT32_MAX);
+    size_t len = 0;
+    put(buf, &len, disp, 4);
+    return;
+}
+
+void x86_arg(char *arg, x86arg_t *a) {
+    *a = (x86arg_t){.base = -1, .index = -1, .scale = 1};
+    if (arg[0] == '%') {
+        a->kind = 'r';
+        a->reg = x86_reg(arg, &a->width);
+        return;
+    }
+    if (arg[0] == '$') {
+        a->kind = 'i';
+        a->val = strtoll(arg + 1, NULL, 0);
+        return;
+    }
+    char *paren = strchr(arg, '(');
+    if (paren == NULL) {
+        a->kind = 'l';
+        return;
+    }
+    a->kind = 'm';
+    a->val = strtoll(arg, NULL, 0);
+    char base[INSN_ARG] = "", index[INSN_ARG] = "";
+    size_t width;
+    if (paren[1] == ',') {
+        sscanf(paren + 2, "%[^,)],%d", index, &a->scale);
+    } else {
+        sscanf(paren + 1, "%[^,)],%[^,)],%d", base, index, &a->scale);
+        a->base = x86_reg(base, &width);
+    }
+    if (index[0] != '\0') {
+        a->index = x86_reg(index, &width);
+    }
+    return;
+}
+
+int x86_reg(char *arg, size_t *width) {
+    static char *name[][4] = {
+        {"%al", "%ax", "%eax", "%rax"},
+        {"%cl", "%cx", "%ecx", "%rcx"},
+        {"%dl", "%dx", "%edx", "%rdx"},
+        {"%bl", "%bx", "%ebx", "%rbx"},
+        {"%spl", "%sp", "%esp", "%rsp"},
+        {"%bpl", "%bp", "%ebp", "%rbp"},
+        {"%sil", "%si", "%esi", "%rsi"},
+        {"%dil", "%di", "%edi", "%rdi"},
+    };
+    if (arg[1] == 'r' && isdigit((unsigned char)arg[2])) {
+        char *end;
+        int reg = strtol(arg + 2, &end, 10);
+        *width = *end == 'b' ? 1 : *end == 'w' ? 2 : *end == 'd' ? 4 : 8;
+        return reg;
+    }
+    for (int reg = 0; reg < 8; reg++) {
+        for (size_t w = 0; w < 4; w++) {
+            if (strcmp(arg, name[reg][w]) == 0) {
+                *width = (size_t)1 << w;
+                return reg;
+            }
+        }
+    }
+    assert(false);
+    return 0;
+}
+
+int x86_cc(char *cc) {
+    static char *name[] = {"o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g", NULL};
+    for (int i = 0; name[i] != NULL; i++) {
+        if (strcmp(cc, name[i]) == 0) {
+            return i;
+        }
+    }
+    assert(false);
+    return 0;
+}
+
+/* Prefixes, opcode (one or two bytes), ModRM, SIB and displacement; reg is
+   either a register number or the opcode extension digit, and low8 says it
+   names a byte register, for which spl/bpl/sil/dil need an empty REX. */
+size_t x86_rm(unsigned char *buf, bool w, bool p66, unsigned code, int reg, bool low8, x86arg_t *rm) {
+    size_t len = 0;
+    if (p66) {
+        buf[len++] = 0x66;
+    }
+    int low = rm->kind == 'r' ? rm->reg : rm->base;
+    unsigned rex = 0x40 | w << 3 | (reg >= 8) << 2 | (rm->index >= 8) << 1 | (low >= 8);
+    bool force = (rm->kind == 'r' && rm->width == 1 && rm->reg >= 4) || (low8 && reg >= 4);
+    if (rex != 0x40 || force) {
+        buf[len++] = rex;
+    }
+    if (code > 0xff) {
+        buf[len++] = code >> 8;
+    }
+    buf[len++] = code & 0xff;
+    if (rm->kind == 'r') {
+        buf[len++] = 0xc0 | (reg & 7) << 3 | (rm->reg & 7);
+        return len;
+    }
+    assert(rm->kind == 'm');
+    if (rm->base < 0) {
+        buf[len++] = (reg & 7) << 3 | 4;
+        buf[len++] = (rm->scale == 8 ? 3 : rm->scale == 4 ? 2 : rm->scale == 2 ? 1 : 0) << 6 | (rm->index < 0 ? 4 : rm->index & 7) << 3 | 5;
+        put(buf, &len, rm->val, 4);
+        return len;
+    }
+    size_t ndisp = rm->val == 0 && (rm->base & 7) != 5 ? 0 : rm->val >= -128 && rm->val <= 127 ? 1 : 4;
+    bool sib = rm->index >= 0 || (rm->base & 7) == 4;
+    buf[len++] = (ndisp == 0 ? 0 : ndisp == 1 ? 0x40 : 0x80) | (reg & 7) << 3 | (sib ? 4 : rm->base & 7);
+    if (sib) {
+        buf[len++] = (rm->scale == 8 ? 3 : rm->scale == 4 ? 2 : rm->scale == 2 ? 1 : 0) << 6 | (rm->index < 0 ? 4 : rm->index & 7) << 3 | (rm->base & 7);
+    }
+    put(buf, &len, rm->val, ndisp);
+    return len;
+}
+#elif __aarch64__
+
+static int a64_reg(char *, bool *);
+static int a64_cc(char *);
+static long long a64_imm(char *);
+static uint32_t a64_mem(char *, insn_t *, int, uint32_t, uint32_t, size_t);
+
+/* Branch ranges are far beyond any function this compiler emits, so there is
+   nothing to relax; the target is still resolved once every label is known. */
+bool encode_branch(insn_t *insn, size_t *size, size_t *grow) {
+    char *op = insn->op;
+    *size = 4;
+    *grow = 0;
+    return strcmp(op, "b") == 0 || strncmp(op, "b.", 2) == 0 || strcmp(op, "cbz") == 0 || strcmp(op, "cbnz") == 0;
+}
+
+size_t encode(insn_t *insn, unsigned char *buf, asitem_t *it, size_t *call) {
+    char *op = insn->op;
+    size_t n = insn->narg, len = 0;
+    int r[INSN_NARG] = {0};
+    bool x = false;
+    for (size_t i = 0; i < n; i++) {
+        bool wide = false;
+        r[i] = a64_reg(insn->arg[i], &wide);
+        x |= i == 0 && wide;
+    }
+    uint32_t sf = x ? 0x80000000u : 0, code = 0;
+    *call = SIZE_MAX;
+    if (strcmp(op, "ret") == 0) {
+        code = 0xd65f03c0;
+    } else if (strcmp(op, "bl") == 0) {
+        *call = sym_find(insn->arg[0]);
+        code = 0x94000000;
+    } else if (strcmp(op, "b") == 0 || strncmp(op, "b.", 2) == 0 || strcmp(op, "cbz") == 0 || strcmp(op, "cbnz") == 0) {
+        assert(it->target != SIZE_MAX && sym[it->target].item != SIZE_MAX);
+        long long disp = ((long long)sym_ofs(it->target) - (long long)it->ofs) / 4;
+        if (op[1] == '\0') {
+            code = 0x14000000 | (disp & 0x3ffffff);
+        } else if (op[1] == '.') {
+            code = 0x54000000 | (disp & 0x7ffff) << 5 | a64_cc(op + 2);
+        } else {
+            code = (op[2] == 'n' ? 0x35000000 : 0x34000000) | sf | (disp & 0x7ffff) << 5 | r[0];
+        }
+    } else if (strcmp(op, "mov") == 0) {
+        if (r[0] == 31 || r[1] == 31) {
+            bool sp = strcmp(insn->arg[0], "sp") == 0 || strcmp(insn->arg[1], "sp") == 0;
+            code = sp ? 0x91000000 | r[1] << 5 | r[0] : (sf | 0x2a0003e0 | r[1] << 16 | r[0]);
+        } else {
+            code = sf | 0x2a0003e0 | r[1] << 16 | r[0];
+        }
+    } else if (strcmp(op, "movz") == 0 || strcmp(op, "movn") == 0 || strcmp(op, "movk") == 0) {
+        uint32_t base = op[3] == 'z' ? 0x52800000 : op[3] == 'n' ? 0x12800000 : 0x72800000;
+        long long shift = n > 2 ? a64_imm(insn->arg[2] + 3) : 0;
+        code = base | sf | (uint32_t)(shift / 16) << 21 | (a64_imm(insn->arg[1]) & 0xffff) << 5 | r[0];
+    } else if (strcmp(op, "add") == 0 || strcmp(op, "sub") == 0 || strcmp(op, "cmp") == 0) {
+        bool cmp = op[0] == 'c';
+        int d = cmp ? 31 : r[0], s = cmp ? r[0] : r[1];
+        char *m = insn->arg[cmp ? 1 : 2];
+        uint32_t opc = cmp ? 0x60000000 : op[0] == 's' ? 0x40000000 : 0;
+        if (m[0] == '#') {
+            long long imm = a64_imm(m);
+            uint32_t sh = imm > 0xfff ? 0x400000 : 0;
+            code = 0x11000000 | opc | sf | sh | (uint32_t)(sh ? imm >> 12 : imm) << 10 | s << 5 | d;
+        } else {
+            long long shift = n > (cmp ? 2u : 3u) ? a64_imm(insn->arg[n - 1] + 4) : 0;
+            code = 0x0b000000 | opc | sf | r[cmp ? 1 : 2] << 16 | (uint32_t)shift << 10 | s << 5 | d;
+        }
+    } else if (strcmp(op, "mul") == 0) {
+        code = 0x1b007c00 | sf | r[2] << 16 | r[1] << 5 | r[0];
+    } else if (strcmp(op, "madd") == 0 || strcmp(op, "msub") == 0) {
+        code = (op[1] == 'a' ? 0x1b000000 : 0x1b008000) | sf | r[2] << 16 | r[3] << 10 | r[1] << 5 | r[0];
+    } else if (strcmp(op, "sdiv") == 0 || strcmp(op, "udiv") == 0) {
+        code = (op[0] == 's' ? 0x1ac00c00 : 0x1ac00800) | sf | r[2] << 16 | r[1] << 5 | r[0];
+    } else if (strcmp(op, "cset") == 0) {
+        code = 0x1a9f07e0 | sf | (a64_cc(insn->arg[1]) ^ 1) << 12 | r[0];
+    } else if (strcmp(op, "lsl") == 0) {
+        uint32_t size = x ? 64 : 32, k = a64_imm(insn->arg[2]);
+        code = (x ? 0xd3400000 : 0x53000000) | ((size - k) & (size - 1)) << 16 | (size - 1 - k) << 10 | r[1] << 5 | r[0];
+    } else if (strcmp(op, "sxtb") == 0 || strcmp(op, "sxth") == 0 || strcmp(op, "sxtw") == 0) {
+        code = (op[3] == 'b' ? 0x13001c00 : op[3] == 'h' ? 0x13003c00 : 0x93407c00) | r[1] << 5 | r[0];
+    } else if (strcmp(op, "stp") == 0 || strcmp(op, "ldp") == 0) {
+        uint32_t l = op[0] == 'l' ? 0x400000 : 0;
+        code = a64_mem(insn->arg[2], insn, 3, 0xa9000000 | l, 0, 8) | r[1] << 10 | r[0];
+    } else {
+        static struct {
+            char *op;
+            bool x;
+            uint32_t scaled;
+            uint32_t unscaled;
+            size_t size;
+        } mem[] = {
+            {"str", true, 0xf9000000, 0xf8000000, 8},
+            {"ldr", true, 0xf9400000, 0xf8400000, 8},
+            {"str", false, 0xb9000000, 0xb8000000, 4},
+            {"ldr", false, 0xb9400000, 0xb8400000, 4},
+            {"strb", false, 0x39000000, 0x38000000, 1},
+            {"ldrsb", false, 0x39c00000, 0x38c00000, 1},
+            {"strh", false, 0x79000000, 0x78000000, 2},
+            {"ldrsh", false, 0x79c00000, 0x78c00000, 2},
+        };
+        for (size_t i = 0; i < sizeof(mem) / sizeof(*mem) && code == 0; i++) {
+            if (strcmp(op, mem[i].op) == 0 && mem[i].x == x) {
+                code = a64_mem(insn->arg[1], insn, 2, mem[i].scaled, mem[i].unscaled, mem[i].size) | r[0];
+            }
+        }
+        if (code == 0) {
+            fprintf(stderr, "assembler: cannot encode '%s'\n", insn->text);
+            assert(false);
+        }
+    }
+    put(buf, &len, code, 4);
+    return len;
+}
+
+/* ldr x16, #8; br x16 followed by the absolute address. */
+void encode_stub(unsigned char *buf, uintptr_t addr) {
+    size_t len = 0;
+    put(buf, &len, 0x58000050, 4);
+    put(buf, &len, 0xd61f0200, 4);
+    put(buf, &len, addr, 8);
+    return;
+}
+
+void encode_call(unsigned char *buf, uintptr_t addr) {
+    long long disp = ((long long)addr - (long long)(uintptr_t)buf) / 4;
+    assert(disp >= -(1 << 25) && disp < 1 << 25);
+    uint32_t code = 0x94000000 | (disp & 0x3ffffff);
+    size_t len = 0;
+    put(buf, &len, code, 4);
+    return;
+}
+
+int a64_reg(char *arg, bool *wide) {
+    if (strcmp(arg, "sp") == 0 || strcmp(arg, "xzr") == 0) {
+        *wide = true;
+        return 31;
+    }
+    if (strcmp(arg, "wzr") == 0) {
+        return 31;
+    }
+    if ((arg[0] == 'x' || arg[0] == 'w') && isdigit((unsigned char)arg[1])) {
+        *wide = arg[0] == 'x';
+        return atoi(arg + 1);
+    }
+    return 0;
+}
+
+int a64_cc(char *cc) {
+    static char *name[] = {"eq", "ne", "hs", "lo", "mi", "pl", "vs", "vc", "hi", "ls", "ge", "lt", "gt", "le", NULL};
+    for (int i = 0; name[i] != NULL; i++) {
+        if (strcmp(cc, name[i]) == 0) {
+            return i;
+        }
+    }
+    assert(false);
+    return 0;
+}
+
+long long a64_imm(char *arg) {
+    while (*arg == ' ' || *arg == '#') {
+        arg++;
+    }
+    return strtoll(arg, NULL, 0);
+}
+
+/* Base register and offset of [Xn], [Xn, #imm], [Xn, #imm]! or a post-index
+   [Xn], #imm; pairs (size 8 with no unscaled form) use the imm7 encoding. */
+uint32_t a64_mem(char *arg, insn_t *insn, int post, uint32_t scaled, uint32_t unscaled, size_t size) {
+    bool wide;
+    char base[INSN_ARG];
+    long long ofs = 0;
+    sscanf(arg, "[%[^],]", base);
+    char *comma = strchr(arg, ',');
+    if (comma != NULL) {
+        ofs = a64_imm(comma + 1);
+    }
+    uint32_t rn = a64_reg(base, &wide) << 5;
+    bool pre = arg[strlen(arg) - 1] == '!';
+    bool postidx = (int)insn->narg > post;
+    if (postidx) {
+        ofs = a64_imm(insn->arg[post]);
+    }
+    if (unscaled == 0) {
+        uint32_t mode = pre ? 0x01800000 : postidx ? 0x00800000 : 0x01000000;
+        return (scaled & ~0x01800000u) | mode | (uint32_t)((ofs / 8) & 0x7f) << 15 | rn;
+    }
+    if (pre || postidx) {
+        return unscaled | (uint32_t)(ofs & 0x1ff) << 12 | (pre ? 0xc00 : 0x400) | rn;
+    }
+    if (ofs >= 0 && ofs % (long long)size == 0 && ofs / (long long)size < 4096) {
+        return scaled | (uint32_t)(ofs / size) << 10 | rn;
+    }
+    return unscaled | (uint32_t)(ofs & 0x1ff) << 12 | rn;
+}
+#else
+#error
+#endif
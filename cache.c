@@ -0,0 +1,392 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "main.h"
+
+#ifndef CACHE_VERSION
+#define CACHE_VERSION "unknown"
+#endif
+
+#if defined(__x86_64__)
+#define CACHE_TARGET "x86_64"
+#elif defined(__aarch64__)
+#define CACHE_TARGET "aarch64"
+#else
+#error
+#endif
+
+#define CACHE_PATH 4096
+#define CACHE_CHUNK 65536
+#define NSHARD 16
+
+/* SHA-256 state: the chaining value, the message length so far in bytes,
+   and the partial block not yet compressed. */
+typedef struct {
+    uint32_t h[8];
+    uint64_t len;
+    unsigned char buf[64];
+    size_t nbuf;
+} sha_t;
+
+/* An entry file as the directory scan sees it, oldest first after sorting. */
+typedef struct {
+    char name[CACHE_KEY];
+    struct timespec time;
+    off_t size;
+} ceentry_t;
+
+void cache_open(char *, size_t);
+void cache_extra(char *);
+bool cache_lookup(char *, char *, char *, FILE *, FILE *, FILE *);
+void cache_store(char *, FILE *, FILE *);
+void cache_report(FILE *);
+static void cache_count(bool);
+static void cache_evict(char *);
+static int cache_cmp(const void *, const void *);
+static void cache_path(char *, char *);
+static void cache_copy(FILE *, int, size_t);
+static void cache_append(int, FILE *);
+static void sha_init(sha_t *);
+static void sha_update(sha_t *, const void *, size_t);
+static void sha_final(sha_t *, unsigned char *);
+static void sha_block(sha_t *, const unsigned char *);
+
+static const uint32_t sha_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static char *dir;
+static size_t limit;
+static sha_t base;
+
+/* Every key starts from the compiler's version and target, so a rebuilt
+   compiler or the other backend never sees this one's entries. */
+void cache_open(char *path, size_t size) {
+    assert(strlen(path) + 2 * CACHE_KEY < CACHE_PATH);
+    dir = path;
+    limit = size;
+    if (mkdir(dir, 0777) != 0) {
+        assert(errno == EEXIST);
+    }
+    sha_init(&base);
+    sha_update(&base, CACHE_VERSION, sizeof(CACHE_VERSION));
+    sha_update(&base, CACHE_TARGET, sizeof(CACHE_TARGET));
+    return;
+}
+
+/* A file whose bytes shape the output, such as a profile, joins every key. */
+void cache_extra(char *path) {
+    FILE *fp = fopen(path, "rb");
+    assert(fp != NULL);
+    char buf[CACHE_CHUNK];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        sha_update(&base, buf, n);
+    }
+    assert(fclose(fp) == 0);
+    sha_update(&base, "", 1);
+    return;
+}
+
+/* Fills key from the options, the name (which only -g puts in the
+   output), whether dumps are wanted and the source, which is read whole;
+   on a hit the stored output and dumps are copied out without compiling.
+   On a miss ifp has been read to the end and must be rewound. */
+bool cache_lookup(char *key, char *conf, char *name, FILE *ifp, FILE *ofp, FILE *dfp) {
+    sha_t sha = base;
+    sha_update(&sha, conf, strlen(conf) + 1);
+    sha_update(&sha, name, strlen(name) + 1);
+    sha_update(&sha, dfp != NULL ? "d" : "", 1);
+    char buf[CACHE_CHUNK];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), ifp)) > 0) {
+        sha_update(&sha, buf, n);
+    }
+    assert(!ferror(ifp));
+    unsigned char digest[32];
+    sha_final(&sha, digest);
+    for (size_t i = 0; i < 32; i++) {
+        sprintf(key + 2 * i, "%02x", digest[i]);
+    }
+    char path[CACHE_PATH];
+    cache_path(path, key);
+    int fd = open(path, O_RDONLY);
+    uint64_t len[2];
+    struct stat st;
+    bool hit = fd >= 0 && read(fd, len, sizeof(len)) == sizeof(len) && fstat(fd, &st) == 0 &&
+               (uint64_t)st.st_size == sizeof(len) + len[0] + len[1];
+    if (hit) {
+        futimens(fd, NULL);
+        cache_copy(ofp, fd, len[0]);
+        if (dfp != NULL) {
+            cache_copy(dfp, fd, len[1]);
+        }
+    }
+    if (fd >= 0) {
+        assert(close(fd) == 0);
+    }
+    cache_count(hit);
+    return hit;
+}
+
+/* The entry is written under a temporary name and renamed into place, so a
+   concurrent reader sees either no entry or a whole one. */
+void cache_store(char *key, FILE *ofp, FILE *dfp) {
+    char path[CACHE_PATH];
+    char tmp[CACHE_PATH];
+    snprintf(path, sizeof(path), "%s/%c", dir, key[0]);
+    if (mkdir(path, 0777) != 0) {
+        assert(errno == EEXIST);
+    }
+    snprintf(tmp, sizeof(tmp), "%s/tmp.XXXXXX", dir);
+    int fd = mkstemp(tmp);
+    assert(fd >= 0);
+    assert(fchmod(fd, 0644) == 0);
+    assert(fseek(ofp, 0, SEEK_END) == 0);
+    uint64_t len[2] = {ftell(ofp), 0};
+    if (dfp != NULL) {
+        assert(fseek(dfp, 0, SEEK_END) == 0);
+        len[1] = ftell(dfp);
+    }
+    assert(write(fd, len, sizeof(len)) == sizeof(len));
+    cache_append(fd, ofp);
+    if (dfp != NULL) {
+        cache_append(fd, dfp);
+    }
+    assert(close(fd) == 0);
+    cache_path(path, key);
+    assert(rename(tmp, path) == 0);
+    cache_evict(key);
+    return;
+}
+
+void cache_report(FILE *ofp) {
+    char path[CACHE_PATH];
+    size_t entries = 0;
+    off_t bytes = 0;
+    for (size_t s = 0; s < NSHARD; s++) {
+        snprintf(path, sizeof(path), "%s/%c", dir, "0123456789abcdef"[s]);
+        DIR *d = opendir(path);
+        if (d == NULL) {
+            continue;
+        }
+        for (struct dirent *e; (e = readdir(d)) != NULL;) {
+            struct stat st;
+            if (e->d_name[0] != '.' && fstatat(dirfd(d), e->d_name, &st, 0) == 0) {
+                entries++;
+                bytes += st.st_size;
+            }
+        }
+        assert(closedir(d) == 0);
+    }
+    uint64_t count[2] = {0, 0};
+    snprintf(path, sizeof(path), "%s/stats", dir);
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        if (pread(fd, count, sizeof(count), 0) != sizeof(count)) {
+            count[0] = count[1] = 0;
+        }
+        assert(close(fd) == 0);
+    }
+    fprintf(ofp, "cache: %s\n", dir);
+    fprintf(ofp, "cache: hits %llu misses %llu\n", (unsigned long long)count[0], (unsigned long long)count[1]);
+    fprintf(ofp, "cache: entries %zu bytes %lld limit %zu\n", entries, (long long)bytes, limit);
+    return;
+}
+
+/* The hit and miss counts are two 64-bit counters in a fixed-size stats
+   file, updated under a write lock so concurrent compilers never lose one;
+   closing the file drops the lock. */
+void cache_count(bool hit) {
+    char path[CACHE_PATH];
+    snprintf(path, sizeof(path), "%s/stats", dir);
+    int fd = open(path, O_RDWR | O_CREAT, 0666);
+    if (fd < 0) {
+        return;
+    }
+    struct flock lock = {.l_type = F_WRLCK, .l_whence = SEEK_SET};
+    if (fcntl(fd, F_SETLKW, &lock) == 0) {
+        uint64_t count[2] = {0, 0};
+        if (pread(fd, count, sizeof(count), 0) != sizeof(count)) {
+            count[0] = count[1] = 0;
+        }
+        count[hit ? 0 : 1]++;
+        assert(pwrite(fd, count, sizeof(count), 0) == sizeof(count));
+    }
+    assert(close(fd) == 0);
+    return;
+}
+
+/* Each shard holds a sixteenth of the limit. Lookups refresh an entry's
+   modification time, so dropping the oldest first is least recently used;
+   a shard that overflows is trimmed to three quarters of its share so the
+   scan is not repeated on every store. Entries another compiler removed
+   first are simply skipped. */
+void cache_evict(char *key) {
+    char path[CACHE_PATH];
+    snprintf(path, sizeof(path), "%s/%c", dir, key[0]);
+    DIR *d = opendir(path);
+    assert(d != NULL);
+    ceentry_t *entry = NULL;
+    size_t nentry = 0, cap = 0;
+    off_t total = 0;
+    for (struct dirent *e; (e = readdir(d)) != NULL;) {
+        struct stat st;
+        if (e->d_name[0] == '.' || strlen(e->d_name) >= CACHE_KEY || fstatat(dirfd(d), e->d_name, &st, 0) != 0) {
+            continue;
+        }
+        if (nentry == cap) {
+            cap = cap == 0 ? 64 : cap * 2;
+            entry = realloc(entry, cap * sizeof(ceentry_t));
+            assert(entry != NULL);
+        }
+        strcpy(entry[nentry].name, e->d_name);
+        entry[nentry].time = st.st_mtim;
+        entry[nentry].size = st.st_size;
+        total += st.st_size;
+        nentry++;
+    }
+    off_t share = limit / NSHARD;
+    if (total > share) {
+        qsort(entry, nentry, sizeof(ceentry_t), cache_cmp);
+        for (size_t i = 0; i < nentry && total > share / 4 * 3; i++) {
+            if (unlinkat(dirfd(d), entry[i].name, 0) == 0) {
+                total -= entry[i].size;
+            }
+        }
+    }
+    assert(closedir(d) == 0);
+    free(entry);
+    return;
+}
+
+int cache_cmp(const void *a, const void *b) {
+    const struct timespec *x = &((const ceentry_t *)a)->time;
+    const struct timespec *y = &((const ceentry_t *)b)->time;
+    if (x->tv_sec != y->tv_sec) {
+        return (x->tv_sec > y->tv_sec) - (x->tv_sec < y->tv_sec);
+    }
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/* Entries are sharded on the key's first hex digit. */
+void cache_path(char *path, char *key) {
+    snprintf(path, CACHE_PATH, "%s/%c/%s", dir, key[0], key);
+    return;
+}
+
+void cache_copy(FILE *ofp, int fd, size_t len) {
+    char buf[CACHE_CHUNK];
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len < sizeof(buf) ? len : sizeof(buf));
+        assert(n > 0);
+        assert(fwrite(buf, 1, n, ofp) == (size_t)n);
+        len -= n;
+    }
+    return;
+}
+
+void cache_append(int fd, FILE *ifp) {
+    char buf[CACHE_CHUNK];
+    size_t n;
+    rewind(ifp);
+    while ((n = fread(buf, 1, sizeof(buf), ifp)) > 0) {
+        for (size_t done = 0; done < n;) {
+            ssize_t w = write(fd, buf + done, n - done);
+            assert(w > 0);
+            done += w;
+        }
+    }
+    assert(!ferror(ifp));
+    return;
+}
+
+void sha_init(sha_t *s) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(s->h, iv, sizeof(iv));
+    s->len = 0;
+    s->nbuf = 0;
+    return;
+}
+
+void sha_update(sha_t *s, const void *data, size_t len) {
+    const unsigned char *p = data;
+    s->len += len;
+    if (s->nbuf > 0) {
+        size_t n = 64 - s->nbuf < len ? 64 - s->nbuf : len;
+        memcpy(s->buf + s->nbuf, p, n);
+        s->nbuf += n;
+        p += n;
+        len -= n;
+        if (s->nbuf < 64) {
+            return;
+        }
+        sha_block(s, s->buf);
+        s->nbuf = 0;
+    }
+    for (; len >= 64; p += 64, len -= 64) {
+        sha_block(s, p);
+    }
+    memcpy(s->buf, p, len);
+    s->nbuf = len;
+    return;
+}
+
+void sha_final(sha_t *s, unsigned char *digest) {
+    uint64_t bits = s->len * 8;
+    unsigned char pad[72] = {0x80};
+    size_t npad = (s->nbuf < 56 ? 56 : 120) - s->nbuf;
+    for (size_t i = 0; i < 8; i++) {
+        pad[npad + i] = bits >> (56 - 8 * i);
+    }
+    sha_update(s, pad, npad + 8);
+    for (size_t i = 0; i < 32; i++) {
+        digest[i] = s->h[i / 4] >> (24 - 8 * (i % 4));
+    }
+    return;
+}
+
+#define ROR(x, n) ((x) >> (n) | (x) << (32 - (n)))
+
+void sha_block(sha_t *s, const unsigned char *p) {
+    uint32_t w[64];
+    for (size_t i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (size_t i = 16; i < 64; i++) {
+        uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ w[i - 15] >> 3;
+        uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ w[i - 2] >> 10;
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t v[8];
+    memcpy(v, s->h, sizeof(v));
+    for (size_t i = 0; i < 64; i++) {
+        uint32_t t1 = v[7] + (ROR(v[4], 6) ^ ROR(v[4], 11) ^ ROR(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + sha_k[i] + w[i];
+        uint32_t t2 = (ROR(v[0], 2) ^ ROR(v[0], 13) ^ ROR(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+        memmove(v + 1, v, 7 * sizeof(uint32_t));
+        v[4] += t1;
+        v[0] = t1 + t2;
+    }
+    for (size_t i = 0; i < 8; i++) {
+        s->h[i] += v[i];
+    }
+    return;
+}
@@ -0,0 +1,93 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "main.h"
+
+int main(int, char **);
+static bool forwardable(char *);
+static void fallback(char **);
+
+/* The thin client: it takes the same arguments as a single-file compile,
+   sends the source to the server named by COMPILER_SERVER and writes back
+   the reply, linking nothing but the socket code so that it starts without
+   the compiler's passes or their thread-local state. Anything it cannot
+   forward, and any request the server does not answer, is handed to the
+   full compiler by exec, so the result is always what main would give. */
+int main(int argc, char **argv) {
+    char *sock = getenv("COMPILER_SERVER");
+    char *path[2];
+    size_t npath = 0;
+    bool dumps = false;
+    size_t len = 1;
+    for (int i = 1; i < argc; i++) {
+        len += strlen(argv[i]) + 1;
+    }
+    char *conf = malloc(len);
+    assert(conf != NULL);
+    conf[0] = '\0';
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            if (npath == 2) {
+                fallback(argv);
+            }
+            path[npath++] = argv[i];
+        } else if (!forwardable(argv[i])) {
+            fallback(argv);
+        } else {
+            dumps |= strcmp(argv[i], "-fdump-tokens") == 0 || strcmp(argv[i], "-fdump-tree") == 0;
+            strcat(conf, argv[i]);
+            strcat(conf, "\n");
+        }
+    }
+    if (sock == NULL || npath != 2) {
+        fallback(argv);
+    }
+    FILE *ifp = fopen(path[0], "r");
+    FILE *ofp = fopen(path[1], strstr(conf, "-c\n") != NULL ? "wb" : "w");
+    if (ifp == NULL || ofp == NULL) {
+        fallback(argv);
+    }
+    if (!server_client(sock, conf, path[0], ifp, ofp, dumps ? stdout : NULL)) {
+        fallback(argv);
+    }
+    assert(fclose(ifp) == 0);
+    assert(fclose(ofp) == 0);
+    free(conf);
+    return 0;
+}
+
+/* Options that run the program, post-process assembly, print a report or
+   change the mode are left to main, as the server would refuse them. */
+bool forwardable(char *arg) {
+    static char *local[] = {"--run", "--interp", "--peephole", "--server", "--cache-stats", "-j",
+                            "-fpeephole-stats", "-fsched-stats", "-fsize-report", "-ftime-report", "-fmem-report"};
+    for (size_t i = 0; i < sizeof(local) / sizeof(local[0]); i++) {
+        if (strncmp(arg, local[i], strlen(local[i])) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* main sits next to the client, or is found on PATH like it. */
+void fallback(char **argv) {
+    char *slash = strrchr(argv[0], '/');
+    if (slash == NULL) {
+        argv[0] = "main";
+        execvp(argv[0], argv);
+    } else {
+        size_t len = slash - argv[0] + 1;
+        char *full = malloc(len + sizeof("main"));
+        assert(full != NULL);
+        memcpy(full, argv[0], len);
+        strcpy(full + len, "main");
+        argv[0] = full;
+        execv(argv[0], argv);
+    }
+    perror(argv[0]);
+    exit(127);
+}
@@ -0,0 +1,463 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include "main.h"
+
+#define BENCH_FUNC 64
+#define BENCH_LOOP 16
+#define BENCH_NSTAT 12
+#define BENCH_LINE 256
+#define BENCH_STACK ((size_t)1 << 30)
+#define BENCH_NPHASE 6
+
+/* The generated source grows in one buffer; asm is sized by a warm-up run so
+   the timed runs generate straight into memory. */
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} bnbuf_t;
+
+/* One line of the report and of the baseline file. A parameter must match
+   the baseline exactly; a measurement regresses when it falls (a rate) or
+   rises (a size) by more than the threshold. A rate also carries its noise,
+   the spread between the quartile runs as a percentage of the median. */
+typedef struct {
+    char *name;
+    double val;
+    double noise;
+    bool param;
+    bool rate;
+} bnstat_t;
+
+int main(int, char **);
+static void *bench_run(void *);
+static double bench_now(void);
+static void bench_stat(char *, double, double, bool, bool);
+static void bench_rate(char *, double, double *, size_t);
+static int bench_cmp(const void *, const void *);
+static void bench_write(FILE *);
+static int bench_compare(char *, double);
+static void gen_prog(void);
+static void gen_stmt(size_t, size_t);
+static void gen_expr(size_t);
+static void gen_leaf(void);
+static void gen_indent(size_t);
+static void gen_format(const char *, ...);
+static uint64_t gen_rand(size_t);
+
+static uint64_t seed = 1;
+static size_t nstmt = 2000;
+static size_t depth = 4;
+static size_t esize = 8;
+static size_t nvar = 16;
+static uint64_t state;
+static size_t left;
+static size_t nlive;
+static size_t func;
+static bnbuf_t src;
+static bnbuf_t out;
+static bnstat_t stat[BENCH_NSTAT];
+static size_t nstat;
+
+/* Generates one program from the seed, compiles it -r times through every
+   phase and reports each phase's median rate: tokens/s for the lexer,
+   nodes/s for the parser, output bytes/s for the rest, and the peak
+   resident set. With -b the report is checked against a baseline file and
+   the exit status is 1 on a regression beyond -t percent plus the noise
+   both runs measured; -w rewrites the baseline instead, as does a first
+   run with no baseline yet, and -p prints the program and stops. */
+int main(int argc, char **argv) {
+    size_t reps = 30;
+    double threshold = 10;
+    char *base = NULL;
+    bool update = false;
+    bool print = false;
+    for (int i = 1; i < argc; i++) {
+        char *opt = argv[i];
+        if (strcmp(opt, "-w") == 0) {
+            update = true;
+            continue;
+        } else if (strcmp(opt, "-p") == 0) {
+            print = true;
+            continue;
+        }
+        char *arg = argv[++i];
+        assert(arg != NULL);
+        if (strcmp(opt, "-s") == 0) {
+            seed = strtoull(arg, NULL, 10);
+        } else if (strcmp(opt, "-n") == 0) {
+            nstmt = strtoull(arg, NULL, 10);
+        } else if (strcmp(opt, "-d") == 0) {
+            depth = strtoull(arg, NULL, 10);
+        } else if (strcmp(opt, "-e") == 0) {
+            esize = strtoull(arg, NULL, 10);
+        } else if (strcmp(opt, "-v") == 0) {
+            nvar = strtoull(arg, NULL, 10);
+        } else if (strcmp(opt, "-r") == 0) {
+            reps = strtoull(arg, NULL, 10);
+        } else if (strcmp(opt, "-t") == 0) {
+            threshold = strtod(arg, NULL);
+        } else if (strcmp(opt, "-b") == 0) {
+            base = arg;
+        } else {
+            assert(false);
+        }
+    }
+    assert(nvar > 0 && reps > 0);
+    gen_prog();
+    if (print) {
+        assert(fwrite(src.buf, 1, src.len, stdout) == src.len);
+        free(src.buf);
+        return 0;
+    }
+    pthread_t thread;
+    pthread_attr_t attr;
+    assert(pthread_attr_init(&attr) == 0);
+    assert(pthread_attr_setstacksize(&attr, BENCH_STACK) == 0);
+    assert(pthread_create(&thread, &attr, bench_run, &reps) == 0);
+    assert(pthread_join(thread, NULL) == 0);
+    assert(pthread_attr_destroy(&attr) == 0);
+    bench_write(stdout);
+    fflush(stdout);
+    int status = 0;
+    bool first = base != NULL && !update && access(base, F_OK) != 0;
+    if (base != NULL && (update || first)) {
+        FILE *fp = fopen(base, "w");
+        assert(fp != NULL);
+        bench_write(fp);
+        assert(fclose(fp) == 0);
+        if (first) {
+            fprintf(stderr, "bench: no baseline in %s, so this run was recorded as one\n", base);
+        }
+    } else if (base != NULL) {
+        status = bench_compare(base, threshold);
+    }
+    free(src.buf);
+    free(out.buf);
+    return status;
+}
+
+/* The first run is a warm-up that sizes the asm buffer and is not timed;
+   when the buffer was too small it stops short of the passes. The range
+   analysis, allocator and generator are timed together, as the code
+   generation phase; the passes read the previous phase's output from
+   memory. It runs on a thread with a large stack, since the lexer and
+   parser recurse as deep as the program is long. */
+void *bench_run(void *arg) {
+    size_t reps = *(size_t *)arg;
+    double (*lap)[reps] = malloc(BENCH_NPHASE * sizeof(*lap));
+    assert(lap != NULL);
+    size_t ntok = 0;
+    size_t nnode = 0;
+    size_t nasm = 0;
+    size_t nout = 0;
+    for (size_t r = 0; r <= reps; r++) {
+        double d[BENCH_NPHASE];
+        FILE *ifp = fmemopen(src.buf, src.len, "r");
+        assert(ifp != NULL);
+        double t = bench_now();
+        tklist_t *tkl = lexer(ifp);
+        d[0] = bench_now() - t;
+        t = bench_now();
+        astree_t *ast = parser(tkl);
+        d[1] = bench_now() - t;
+        t = bench_now();
+        ranger(ast);
+        allocator(ast);
+        emitter_t *emt = emitter_memory(out.buf, out.cap);
+        generator(emt, ast);
+        nasm = emitter_close(emt);
+        d[2] = bench_now() - t;
+        ntok = tklist_count(tkl);
+        nnode = astree_count(ast);
+        assert(fclose(ifp) == 0);
+        tklist_free(tkl);
+        astree_free(ast);
+        if (nasm >= out.cap) {
+            assert(r == 0);
+            out.cap = nasm + 1;
+            out.buf = realloc(out.buf, out.cap);
+            assert(out.buf != NULL);
+            continue;
+        }
+        FILE *afp = fmemopen(out.buf, nasm, "r");
+        char *pbuf, *sbuf;
+        size_t plen, slen;
+        FILE *pfp = open_memstream(&pbuf, &plen);
+        assert(afp != NULL && pfp != NULL);
+        t = bench_now();
+        peephole(pfp, afp);
+        assert(fclose(pfp) == 0);
+        d[3] = bench_now() - t;
+        pfp = fmemopen(pbuf, plen, "r");
+        FILE *sfp = open_memstream(&sbuf, &slen);
+        assert(pfp != NULL && sfp != NULL);
+        t = bench_now();
+        scheduler(sfp, pfp);
+        assert(fclose(sfp) == 0);
+        d[4] = bench_now() - t;
+        nout = slen;
+        d[5] = d[0] + d[1] + d[2] + d[3] + d[4];
+        for (size_t i = 0; r > 0 && i < BENCH_NPHASE; i++) {
+            lap[i][r - 1] = d[i];
+        }
+        assert(fclose(afp) == 0);
+        assert(fclose(pfp) == 0);
+        free(pbuf);
+        free(sbuf);
+    }
+    struct rusage ru;
+    assert(getrusage(RUSAGE_SELF, &ru) == 0);
+    bench_stat("seed", seed, 0, true, false);
+    bench_stat("stmts", nstmt, 0, true, false);
+    bench_stat("depth", depth, 0, true, false);
+    bench_stat("expr", esize, 0, true, false);
+    bench_stat("vars", nvar, 0, true, false);
+    bench_rate("lex_tokens_per_s", ntok, lap[0], reps);
+    bench_rate("parse_nodes_per_s", nnode, lap[1], reps);
+    bench_rate("generate_bytes_per_s", nasm, lap[2], reps);
+    bench_rate("peephole_bytes_per_s", nasm, lap[3], reps);
+    bench_rate("schedule_bytes_per_s", nout, lap[4], reps);
+    bench_rate("total_bytes_per_s", nout, lap[5], reps);
+    bench_stat("peak_rss_kib", ru.ru_maxrss, 0, false, false);
+    free(lap);
+    return NULL;
+}
+
+double bench_now(void) {
+    struct timespec ts;
+    assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void bench_stat(char *name, double val, double noise, bool param, bool rate) {
+    assert(nstat < BENCH_NSTAT);
+    stat[nstat++] = (bnstat_t){name, val, noise, param, rate};
+    return;
+}
+
+/* The median of the run times, so a few runs slowed by the rest of the
+   machine move neither the rate nor, much, the noise. */
+void bench_rate(char *name, double amount, double *lap, size_t n) {
+    qsort(lap, n, sizeof(double), bench_cmp);
+    double mid = n % 2 == 1 ? lap[n / 2] : (lap[n / 2 - 1] + lap[n / 2]) / 2;
+    double noise = (lap[(n - 1) * 3 / 4] - lap[(n - 1) / 4]) / mid * 100;
+    bench_stat(name, amount / mid, noise, false, true);
+    return;
+}
+
+int bench_cmp(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+void bench_write(FILE *ofp) {
+    for (size_t i = 0; i < nstat; i++) {
+        fprintf(ofp, "%-24s %.0f", stat[i].name, stat[i].val);
+        if (stat[i].rate) {
+            fprintf(ofp, " %.1f", stat[i].noise);
+        }
+        fputc('\n', ofp);
+    }
+    return;
+}
+
+/* Names missing from either side are skipped, so a baseline from before a
+   new measurement was added still applies. The parameters come first, and
+   once one differs the measurements are not compared at all. A rate may
+   fall by the threshold plus the noise of the baseline and of this run. */
+int bench_compare(char *base, double threshold) {
+    FILE *fp = fopen(base, "r");
+    assert(fp != NULL);
+    int status = 0;
+    char line[BENCH_LINE];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char name[BENCH_LINE];
+        double val;
+        double noise = 0;
+        if (sscanf(line, "%s %lf %lf", name, &val, &noise) < 2) {
+            continue;
+        }
+        for (size_t i = 0; i < nstat; i++) {
+            if (strcmp(stat[i].name, name) != 0) {
+                continue;
+            }
+            if (stat[i].param && stat[i].val != val) {
+                fprintf(stderr, "bench: %s is %.0f but the baseline used %.0f\n", name, stat[i].val, val);
+                status = 2;
+            } else if (!stat[i].param && status != 2 && val > 0) {
+                double change = (stat[i].val - val) / val * 100;
+                double limit = threshold + (stat[i].rate ? noise + stat[i].noise : 0);
+                bool worse = stat[i].rate ? change < -limit : change > limit;
+                fprintf(stderr, "bench: %-24s %+7.1f%% (limit %.1f%%)%s\n", name, change, limit, worse ? "  REGRESSION" : "");
+                status = status == 0 && worse ? 1 : status;
+            }
+        }
+    }
+    assert(fclose(fp) == 0);
+    return status;
+}
+
+/* Functions of BENCH_FUNC statements each, every one taking two
+   parameters and declaring nvar locals of mixed widths, each initialized
+   from the ones before it; a function may call the ones before it, and
+   main calls the last. */
+void gen_prog(void) {
+    static const char *type[] = {"char", "short", "int", "long"};
+    state = seed * 0x9e3779b97f4a7c15 + 1;
+    left = nstmt;
+    for (func = 0; func == 0 || left > 0; func++) {
+        gen_format("long f%zu(long a, int b) {\n", func);
+        for (nlive = 0; nlive < nvar; nlive++) {
+            gen_format("    %s v%zu = ", type[gen_rand(4)], nlive);
+            gen_expr(gen_rand(esize + 1));
+            gen_format(";\n");
+        }
+        size_t end = left > BENCH_FUNC ? left - BENCH_FUNC : 0;
+        while (left > end) {
+            gen_stmt(depth, 1);
+        }
+        gen_format("    return ");
+        gen_expr(esize);
+        gen_format(";\n}\n");
+    }
+    gen_format("int main() {\n    return f%zu(1, 2) %% 128;\n}\n", func - 1);
+    return;
+}
+
+/* Loop counters are declared by the loop and never assigned in its body, so
+   every loop ends; the other statements assign the variables. */
+void gen_stmt(size_t nest, size_t indent) {
+    left -= left > 0;
+    uint64_t pick = gen_rand(nest > 0 ? 10 : 6);
+    gen_indent(indent);
+    if (pick < 6) {
+        gen_format("v%zu = ", gen_rand(nvar));
+        gen_expr(esize);
+        gen_format(";\n");
+        return;
+    }
+    if (pick < 8) {
+        gen_format("if (");
+        gen_expr(esize / 2);
+        gen_format(" < ");
+        gen_expr(esize / 2);
+        gen_format(") {\n");
+    } else if (pick < 9) {
+        gen_format("for (int i%zu = 0; i%zu < %d; i%zu = i%zu + 1) {\n", nest, nest, BENCH_LOOP, nest, nest);
+    } else {
+        gen_format("{\n");
+        gen_indent(indent + 1);
+        gen_format("long w%zu = %d;\n", nest, BENCH_LOOP);
+        gen_indent(indent + 1);
+        gen_format("while (w%zu > 0) {\n", nest);
+        indent++;
+    }
+    size_t n = 1 + gen_rand(4);
+    for (size_t i = 0; i < n && left > 0; i++) {
+        gen_stmt(nest - 1, indent + 1);
+    }
+    if (pick == 9) {
+        gen_indent(indent + 1);
+        gen_format("w%zu = w%zu - 1;\n", nest, nest);
+        gen_indent(indent);
+        gen_format("}\n");
+        indent--;
+    }
+    gen_indent(indent);
+    if (pick < 8 && gen_rand(2) == 0) {
+        gen_format("} else {\n");
+        gen_stmt(nest - 1, indent + 1);
+        gen_indent(indent);
+    }
+    gen_format("}\n");
+    return;
+}
+
+/* size counts the operators; a divisor is always a nonzero literal. */
+void gen_expr(size_t size) {
+    static const char *op[] = {"+", "-", "*", "/", "%", "<", "==", "!="};
+    if (size == 0) {
+        gen_leaf();
+        return;
+    }
+    uint64_t pick = gen_rand(16);
+    if (pick == 0) {
+        gen_format("(int)(");
+        gen_expr(size - 1);
+        gen_format(")");
+    } else if (pick == 1 && func > 0) {
+        size_t half = (size - 1) / 2;
+        gen_format("f%zu(", gen_rand(func));
+        gen_expr(half);
+        gen_format(", ");
+        gen_expr(size - 1 - half);
+        gen_format(")");
+    } else {
+        size_t half = gen_rand(size);
+        const char *o = op[gen_rand(8)];
+        gen_format("(");
+        gen_expr(half);
+        gen_format(" %s ", o);
+        if (o[0] == '/' || o[0] == '%') {
+            gen_format("%d", 1 + (int)gen_rand(97));
+        } else {
+            gen_expr(size - 1 - half);
+        }
+        gen_format(")");
+    }
+    return;
+}
+
+void gen_leaf(void) {
+    uint64_t pick = gen_rand(8);
+    if (pick < 5 && nlive > 0) {
+        gen_format("v%zu", gen_rand(nlive));
+    } else if (pick < 6) {
+        gen_format("%s", gen_rand(2) == 0 ? "a" : "b");
+    } else {
+        gen_format("%d", (int)gen_rand(1000));
+    }
+    return;
+}
+
+void gen_indent(size_t indent) {
+    gen_format("%*s", (int)(indent * 4), "");
+    return;
+}
+
+void gen_format(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    assert(n >= 0);
+    while (src.len + n + 1 > src.cap) {
+        src.cap = src.cap == 0 ? 65536 : src.cap * 2;
+        src.buf = realloc(src.buf, src.cap);
+        assert(src.buf != NULL);
+    }
+    va_start(ap, fmt);
+    vsnprintf(src.buf + src.len, n + 1, fmt, ap);
+    va_end(ap);
+    src.len += n;
+    return;
+}
+
+/* xorshift64*, so a seed gives the same program everywhere. */
+uint64_t gen_rand(size_t n) {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return n == 0 ? 0 : (state * 0x2545f4914f6cdd1d >> 32) % n;
+}
@@ -0,0 +1,123 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include "main.h"
+
+#define DRIVER_STACK ((size_t)1 << 30)
+
+/* One deque per worker: the owner takes jobs from the front, in input order,
+   and an idle worker steals from the back of someone else's. Jobs never
+   spawn jobs, so once every deque is empty the pool is done. */
+typedef struct {
+    pthread_mutex_t lock;
+    size_t *job;
+    size_t head;
+    size_t tail;
+} drqueue_t;
+
+void driver(size_t, size_t, void (*)(size_t));
+static void *driver_worker(void *);
+static bool driver_take(size_t, size_t *);
+static bool driver_steal(size_t, size_t *);
+static size_t driver_stack(void);
+
+static drqueue_t *queue;
+static size_t nqueue;
+static void (*work)(size_t);
+
+/* The calling thread is worker 0; the others get a stack as large as the
+   main thread's, since the lexer and parser recurse on deep input. */
+void driver(size_t nthread, size_t njob, void (*fn)(size_t)) {
+    nqueue = nthread < njob ? nthread : njob;
+    if (nqueue == 0) {
+        return;
+    }
+    work = fn;
+    queue = malloc(nqueue * sizeof(drqueue_t));
+    assert(queue != NULL);
+    for (size_t i = 0; i < nqueue; i++) {
+        assert(pthread_mutex_init(&queue[i].lock, NULL) == 0);
+        queue[i].job = malloc((njob / nqueue + 1) * sizeof(size_t));
+        assert(queue[i].job != NULL);
+        queue[i].head = queue[i].tail = 0;
+    }
+    for (size_t i = 0; i < njob; i++) {
+        drqueue_t *q = &queue[i % nqueue];
+        q->job[q->tail++] = i;
+    }
+    pthread_t *thread = malloc(nqueue * sizeof(pthread_t));
+    size_t *self = malloc(nqueue * sizeof(size_t));
+    assert(thread != NULL && self != NULL);
+    pthread_attr_t attr;
+    assert(pthread_attr_init(&attr) == 0);
+    assert(pthread_attr_setstacksize(&attr, driver_stack()) == 0);
+    for (size_t i = 1; i < nqueue; i++) {
+        self[i] = i;
+        assert(pthread_create(&thread[i], &attr, driver_worker, &self[i]) == 0);
+    }
+    self[0] = 0;
+    driver_worker(&self[0]);
+    for (size_t i = 1; i < nqueue; i++) {
+        assert(pthread_join(thread[i], NULL) == 0);
+    }
+    assert(pthread_attr_destroy(&attr) == 0);
+    for (size_t i = 0; i < nqueue; i++) {
+        assert(pthread_mutex_destroy(&queue[i].lock) == 0);
+        free(queue[i].job);
+    }
+    free(queue);
+    free(thread);
+    free(self);
+    return;
+}
+
+void *driver_worker(void *arg) {
+    size_t self = *(size_t *)arg;
+    size_t job;
+    for (;;) {
+        bool found = driver_take(self, &job);
+        for (size_t k = 1; !found && k < nqueue; k++) {
+            found = driver_steal((self + k) % nqueue, &job);
+        }
+        if (!found) {
+            break;
+        }
+        work(job);
+    }
+    return NULL;
+}
+
+bool driver_take(size_t i, size_t *job) {
+    drqueue_t *q = &queue[i];
+    assert(pthread_mutex_lock(&q->lock) == 0);
+    bool found = q->head < q->tail;
+    if (found) {
+        *job = q->job[q->head++];
+    }
+    assert(pthread_mutex_unlock(&q->lock) == 0);
+    return found;
+}
+
+bool driver_steal(size_t i, size_t *job) {
+    drqueue_t *q = &queue[i];
+    assert(pthread_mutex_lock(&q->lock) == 0);
+    bool found = q->head < q->tail;
+    if (found) {
+        *job = q->job[--q->tail];
+    }
+    assert(pthread_mutex_unlock(&q->lock) == 0);
+    return found;
+}
+
+size_t driver_stack(void) {
+    struct rlimit lim;
+    assert(getrlimit(RLIMIT_STACK, &lim) == 0);
+    if (lim.rlim_cur == RLIM_INFINITY || lim.rlim_cur > DRIVER_STACK) {
+        return DRIVER_STACK;
+    }
+    return lim.rlim_cur;
+}
@@ -0,0 +1,207 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "main.h"
+
+#define EMITTER_BUF (1 << 20)
+#define EMITTER_NUM 24
+
+/* A file emitter batches output in buf and hands it to write(2) when full; a
+   memory emitter writes straight into the caller's buf and keeps counting
+   past cap so the caller learns the size it would have needed. sent counts
+   what a file emitter has already handed on. */
+struct emitter_t {
+    FILE *fp;
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t sent;
+};
+
+emitter_t *emitter_file(FILE *);
+emitter_t *emitter_memory(char *, size_t);
+size_t emitter_close(emitter_t *);
+void emitter_puts(emitter_t *, const char *);
+void emitter_putc(emitter_t *, char);
+void emitter_format(emitter_t *, const char *, ...);
+static void emitter_write(emitter_t *, const char *, size_t);
+static void emitter_flush(emitter_t *);
+static void emitter_dec(emitter_t *, long long);
+static void emitter_udec(emitter_t *, unsigned long long);
+
+static const char digits[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+emitter_t *emitter_file(FILE *fp) {
+    emitter_t *e = malloc(sizeof(emitter_t));
+    assert(e != NULL);
+    e->fp = fp;
+    e->buf = malloc(EMITTER_BUF);
+    assert(e->buf != NULL);
+    e->len = 0;
+    e->cap = EMITTER_BUF;
+    e->sent = 0;
+    return e;
+}
+
+emitter_t *emitter_memory(char *buf, size_t cap) {
+    emitter_t *e = malloc(sizeof(emitter_t));
+    assert(e != NULL);
+    e->fp = NULL;
+    e->buf = buf;
+    e->len = 0;
+    e->cap = cap;
+    e->sent = 0;
+    return e;
+}
+
+/* Returns the number of bytes emitted; a memory buffer is NUL-terminated when
+   there is room, and holds everything only if the result is below cap. */
+size_t emitter_close(emitter_t *e) {
+    size_t len = e->len;
+    if (e->fp != NULL) {
+        emitter_flush(e);
+        len = e->sent;
+        free(e->buf);
+    } else if (len < e->cap) {
+        e->buf[len] = '\0';
+    }
+    free(e);
+    return len;
+}
+
+void emitter_puts(emitter_t *e, const char *s) {
+    emitter_write(e, s, strlen(s));
+    return;
+}
+
+void emitter_putc(emitter_t *e, char c) {
+    if (e->fp != NULL && e->len == e->cap) {
+        emitter_flush(e);
+    }
+    if (e->len < e->cap) {
+        e->buf[e->len] = c;
+    }
+    e->len++;
+    return;
+}
+
+/* The directives the generator needs, %s %c %d %u %zu %lld and %%, with
+   literal runs between them copied whole. */
+void emitter_format(emitter_t *e, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    while (*fmt != '\0') {
+        const char *pct = strchr(fmt, '%');
+        if (pct == NULL) {
+            emitter_write(e, fmt, strlen(fmt));
+            break;
+        }
+        emitter_write(e, fmt, pct - fmt);
+        fmt = pct + 1;
+        switch (*fmt++) {
+        case 's':
+            emitter_puts(e, va_arg(ap, const char *));
+            break;
+        case 'c':
+            emitter_putc(e, (char)va_arg(ap, int));
+            break;
+        case 'd':
+            emitter_dec(e, va_arg(ap, int));
+            break;
+        case 'u':
+            emitter_udec(e, va_arg(ap, unsigned));
+            break;
+        case 'z':
+            assert(*fmt++ == 'u');
+            emitter_udec(e, va_arg(ap, size_t));
+            break;
+        case 'l':
+            assert(fmt[0] == 'l' && fmt[1] == 'd');
+            fmt += 2;
+            emitter_dec(e, va_arg(ap, long long));
+            break;
+        case '%':
+            emitter_putc(e, '%');
+            break;
+        default:
+            assert(false);
+        }
+    }
+    va_end(ap);
+    return;
+}
+
+void emitter_write(emitter_t *e, const char *s, size_t n) {
+    if (e->fp == NULL) {
+        if (e->len < e->cap) {
+            memcpy(e->buf + e->len, s, n < e->cap - e->len ? n : e->cap - e->len);
+        }
+        e->len += n;
+        return;
+    }
+    if (e->len + n > e->cap) {
+        emitter_flush(e);
+    }
+    if (n > e->cap) {
+        assert(fwrite(s, 1, n, e->fp) == n);
+        assert(fflush(e->fp) == 0);
+        e->sent += n;
+        return;
+    }
+    memcpy(e->buf + e->len, s, n);
+    e->len += n;
+    return;
+}
+
+/* Anything stdio still holds for the stream goes out first so the two never
+   interleave. */
+void emitter_flush(emitter_t *e) {
+    assert(fflush(e->fp) == 0);
+    int fd = fileno(e->fp);
+    for (size_t done = 0; done < e->len;) {
+        ssize_t n = write(fd, e->buf + done, e->len - done);
+        assert(n > 0);
+        done += n;
+    }
+    e->sent += e->len;
+    e->len = 0;
+    return;
+}
+
+void emitter_dec(emitter_t *e, long long val) {
+    if (val < 0) {
+        emitter_putc(e, '-');
+        emitter_udec(e, 0 - (unsigned long long)val);
+    } else {
+        emitter_udec(e, val);
+    }
+    return;
+}
+
+/* Two digits per division, written backwards into a scratch buffer. */
+void emitter_udec(emitter_t *e, unsigned long long val) {
+    char num[EMITTER_NUM];
+    char *p = num + EMITTER_NUM;
+    while (val >= 100) {
+        unsigned pair = val % 100 * 2;
+        val /= 100;
+        *--p = digits[pair + 1];
+        *--p = digits[pair];
+    }
+    if (val >= 10) {
+        *--p = digits[val * 2 + 1];
+        *--p = digits[val * 2];
+    } else {
+        *--p = '0' + val;
+    }
+    emitter_write(e, p, num + EMITTER_NUM - p);
+    return;
+}
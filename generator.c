@@ -1,406 +1,1941 @@
 #include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "main.h"
 
-void generator(FILE *, astree_t *);
-static void generate_prog(FILE *, astree_t *);
-static void generate_stmt(FILE *, astree_t *);
-static void generate_expr(FILE *, astree_t *);
+typedef enum {
+    BR_OPND,
+    BR_LOAD,
+    BR_NUM,
+    BR_CAST,
+    BR_ASG,
+    BR_CALL,
+    BR_BIN,
+    BR_CMP,
+    BR_SET,
+    BR_INDEX,
+    BR_SUM,
+    BR_DISP,
+    BR_LEA,
+} bract_t;
 
-void generator(FILE *ofp, astree_t *ast) {
+typedef struct {
+    bool chain;
+    ntkind_t lhs;
+    askind_t first;
+    askind_t last;
+    ntkind_t left;
+    ntkind_t right;
+    bool swap;
+    size_t cost;
+    bract_t act;
+    bool (*cond)(astree_t *);
+} burs_t;
+
+typedef struct {
+    ntkind_t kind;
+    bool base;
+    bool index;
+    size_t reg;
+    size_t idx;
+    long long scale;
+    long long imm;
+    idlist_t *idl;
+} operand_t;
+
+/* A branch side that the profile says almost never runs, laid out after the
+   function's epilogue instead of in the hot path. */
+typedef struct {
+    astree_t *ast;
+    bool swap;
+} cold_t;
+
+void generator(emitter_t *, astree_t *);
+void generator_size(bool);
+void generator_omit(bool);
+void generator_instrument(char *);
+void generator_debug(char *);
+static void generate_prog(emitter_t *, astree_t *);
+static void generate_def(emitter_t *, astree_t *);
+static void generate_body(emitter_t *, astree_t *);
+static void generate_param(emitter_t *, astree_t *, size_t);
+static void generate_stmt(emitter_t *, astree_t *);
+static void generate_if(emitter_t *, astree_t *);
+static void generate_loop(emitter_t *, astree_t *);
+static void generate_cold(emitter_t *);
+static bool generate_count(astree_t *, size_t, uint64_t *);
+static void generate_profile(emitter_t *);
+static void generate_cond(emitter_t *, astree_t *, bool, char *, size_t);
+static void generate_expr(emitter_t *, astree_t *);
+static void generate_pair(emitter_t *, astree_t *, burs_t *, operand_t *, operand_t *);
+static void generate_call(emitter_t *, astree_t *);
+static void generate_move(emitter_t *, size_t *, size_t *, size_t);
+static size_t generate_need(astree_t *);
+static void burs_label(astree_t *);
+static void burs_reduce(emitter_t *, astree_t *, ntkind_t, operand_t *);
+static astree_t *burs_kid(astree_t *, size_t);
+static bool burs_rvar(astree_t *);
+static tykind_t burs_width(astree_t *);
+static bool burs_signed(astree_t *);
+static bool burs_fits(astree_t *);
+static void operand_push(operand_t *);
+static void operand_pop(emitter_t *, operand_t *);
+static void operand_free(operand_t *);
+static char *operand_name(operand_t *, tykind_t);
+static size_t reg_alloc(emitter_t *);
+static void reg_free(size_t);
+static void value_push(size_t);
+static size_t value_pop(emitter_t *);
+static void value_spill(emitter_t *);
+static void emit_prologue(emitter_t *, astree_t *);
+static void emit_epilogue(emitter_t *);
+static void emit_param(emitter_t *, idlist_t *, size_t);
+static void emit_inarg(emitter_t *, size_t, size_t);
+static void emit_outarg(emitter_t *, size_t, size_t, size_t);
+static size_t emit_reserve(emitter_t *, size_t, size_t);
+static void emit_release(emitter_t *, size_t);
+static void emit_load(emitter_t *, size_t, idlist_t *);
+static void emit_store(emitter_t *, size_t, idlist_t *);
+static void emit_num(emitter_t *, size_t, astree_t *);
+static void emit_bin(emitter_t *, askind_t, tykind_t, size_t, operand_t *, bool);
+static void emit_cmp(emitter_t *, tykind_t, operand_t *, operand_t *);
+static void emit_set(emitter_t *, askind_t, size_t);
+static void emit_lea(emitter_t *, tykind_t, size_t, operand_t *);
+static void emit_cast(emitter_t *, size_t, tykind_t, tykind_t);
+static void emit_mov(emitter_t *, size_t, size_t);
+static void emit_push(emitter_t *, size_t);
+static void emit_pop(emitter_t *, size_t);
+static void emit_save(emitter_t *, size_t *, size_t);
+static void emit_restore(emitter_t *, size_t *, size_t);
+static void emit_call(emitter_t *, astree_t *, size_t);
+static void emit_ret(emitter_t *, size_t);
+static void emit_jump(emitter_t *, char *, size_t);
+static void emit_jzero(emitter_t *, size_t, tykind_t, char *, size_t);
+static void emit_jnzero(emitter_t *, size_t, tykind_t, char *, size_t);
+static void emit_jcc(emitter_t *, askind_t, char *, size_t);
+static void emit_label(emitter_t *, char *, size_t);
+static void emit_loc(emitter_t *, astree_t *);
+static void emit_string(emitter_t *, char *);
+static void emit_count(emitter_t *, size_t, size_t);
+static void emit_dump(emitter_t *);
+
+#define NREG 32
+#define NHELD 4096
+#define NCOLD 4096
+#define PROFBIAS 8
+#define PAGESIZE 4096
+
+#define RULE(lhs, kind, left, right, cost, act, cond) {false, lhs, kind, kind, left, right, false, cost, act, cond}
+#define SWAP(lhs, kind, left, right, cost, act, cond) {false, lhs, kind, kind, left, right, true, cost, act, cond}
+#define CMP(left, right, cost) {false, NT_FLAGS, AS_EQ, AS_GE, left, right, false, cost, BR_CMP, NULL}
+#define CHAIN(lhs, from, cost, act) {true, lhs, AS_DEF, AS_DEF, from, NT_NONE, false, cost, act, NULL}
+
+#ifdef __x86_64__
+enum {
+    RAX,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15,
+};
+
+#define LEAFSIZE 128
+
+static bool burs_imm(astree_t *);
+static bool burs_mem(astree_t *);
+static bool burs_scale(astree_t *);
+static bool burs_scalel(astree_t *);
+static bool burs_neg(astree_t *);
+
+static size_t pool[] = {R10, R11, R9, R8, RCX, RSI, RDI};
+static size_t argreg[] = {RDI, RSI, RDX, RCX, R8, R9};
+static size_t calleereg[] = {RBX, R12, R13, R14, R15};
+static size_t retreg = RAX;
+static size_t tmpreg = RAX;
+static burs_t burs[] = {
+    RULE(NT_REG, AS_VAR, NT_NONE, NT_NONE, 1, BR_LOAD, NULL),
+    RULE(NT_RVAR, AS_VAR, NT_NONE, NT_NONE, 0, BR_OPND, burs_rvar),
+    RULE(NT_MEM, AS_VAR, NT_NONE, NT_NONE, 0, BR_OPND, burs_mem),
+    RULE(NT_REG, AS_NUM, NT_NONE, NT_NONE, 1, BR_NUM, NULL),
+    RULE(NT_IMM, AS_NUM, NT_NONE, NT_NONE, 0, BR_OPND, burs_imm),
+    RULE(NT_REG, AS_CAST, NT_REG, NT_NONE, 1, BR_CAST, NULL),
+    RULE(NT_REG, AS_ASG, NT_NONE, NT_NONE, 1, BR_ASG, NULL),
+    RULE(NT_REG, AS_FNC, NT_NONE, NT_NONE, 1, BR_CALL, NULL),
+    RULE(NT_REG, AS_ADD, NT_REG, NT_REG, 1, BR_BIN, NULL),
+    RULE(NT_REG, AS_ADD, NT_REG, NT_IMM, 1, BR_BIN, NULL),
+    RULE(NT_REG, AS_ADD, NT_REG, NT_RVAR, 1, BR_BIN, NULL),
+    RULE(NT_REG, AS_ADD, NT_REG, NT_MEM, 1, BR_BIN, NULL),
+    SWAP(NT_REG, AS_ADD, NT_IMM, NT_REG, 1, BR_BIN, NULL),
+    SWAP(NT_REG, AS_ADD, NT_RVAR, NT_REG, 1, BR_BIN, NULL),
+    SWAP(NT_REG, AS_ADD, NT_MEM, NT_REG, 1, BR_BIN, NULL),
+    RULE(NT_REG, AS_SUB, NT_REG, NT_REG, 1, BR_BIN, NULL),
+    RULE(NT_REG, AS_SUB, NT_REG, NT_IMM, 1, BR_BIN, NULL),
+    RULE(NT_REG, AS_SUB, NT_REG, NT_RVAR, 1, BR_BIN, NULL),
+    RULE(NT_REG, AS_SUB, NT_REG, NT_MEM, 1, BR_BIN, NULL),
+    RULE(NT_REG, AS_MUL, NT_REG, NT_REG, 3, BR_BIN, NULL),
+    RULE(NT_REG, AS_MUL, NT_REG, NT_IMM, 3, BR_BIN, NULL),
+    RULE(NT_REG, AS_MUL, NT_REG, NT_RVAR, 3, BR_BIN, NULL),
+    RULE(NT_REG, AS_MUL, NT_REG, NT_MEM, 3, BR_BIN, NULL),
+    SWAP(NT_REG, AS_MUL, NT_IMM, NT_REG, 3, BR_BIN, NULL),
+    SWAP(NT_REG, AS_MUL, NT_RVAR, NT_REG, 3, BR_BIN, NULL),
+    SWAP(NT_REG, AS_MUL, NT_MEM, NT_REG, 3, BR_BIN, NULL),
+    RULE(NT_REG, AS_DIV, NT_REG, NT_REG, 4, BR_BIN, NULL),
+    RULE(NT_REG, AS_DIV, NT_REG, NT_RVAR, 4, BR_BIN, NULL),
+    RULE(NT_REG, AS_DIV, NT_REG, NT_MEM, 4, BR_BIN, NULL),
+    RULE(NT_REG, AS_MOD, NT_REG, NT_REG, 4, BR_BIN, NULL),
+    RULE(NT_REG, AS_MOD, NT_REG, NT_RVAR, 4, BR_BIN, NULL),
+    RULE(NT_REG, AS_MOD, NT_REG, NT_MEM, 4, BR_BIN, NULL),
+    RULE(NT_INDEX, AS_MUL, NT_REG, NT_IMM, 0, BR_INDEX, burs_scale),
+    SWAP(NT_INDEX, AS_MUL, NT_IMM, NT_REG, 0, BR_INDEX, burs_scalel),
+    RULE(NT_SUM, AS_ADD, NT_REG, NT_REG, 0, BR_SUM, NULL),
+    RULE(NT_SUM, AS_ADD, NT_REG, NT_INDEX, 0, BR_SUM, NULL),
+    SWAP(NT_SUM, AS_ADD, NT_INDEX, NT_REG, 0, BR_SUM, NULL),
+    RULE(NT_ADDR, AS_ADD, NT_SUM, NT_IMM, 0, BR_DISP, NULL),
+    RULE(NT_ADDR, AS_ADD, NT_INDEX, NT_IMM, 0, BR_DISP, NULL),
+    SWAP(NT_ADDR, AS_ADD, NT_IMM, NT_SUM, 0, BR_DISP, NULL),
+    SWAP(NT_ADDR, AS_ADD, NT_IMM, NT_INDEX, 0, BR_DISP, NULL),
+    RULE(NT_ADDR, AS_SUB, NT_SUM, NT_IMM, 0, BR_DISP, burs_neg),
+    RULE(NT_ADDR, AS_SUB, NT_INDEX, NT_IMM, 0, BR_DISP, burs_neg),
+    CMP(NT_REG, NT_REG, 1),
+    CMP(NT_REG, NT_IMM, 1),
+    CMP(NT_REG, NT_RVAR, 1),
+    CMP(NT_REG, NT_MEM, 1),
+    CMP(NT_RVAR, NT_REG, 1),
+    CMP(NT_RVAR, NT_IMM, 1),
+    CMP(NT_RVAR, NT_RVAR, 1),
+    CMP(NT_RVAR, NT_MEM, 1),
+    CMP(NT_MEM, NT_REG, 1),
+    CMP(NT_MEM, NT_IMM, 1),
+    CMP(NT_MEM, NT_RVAR, 1),
+    CHAIN(NT_REG, NT_FLAGS, 2, BR_SET),
+    CHAIN(NT_REG, NT_INDEX, 1, BR_LEA),
+    CHAIN(NT_REG, NT_SUM, 1, BR_LEA),
+    CHAIN(NT_REG, NT_ADDR, 1, BR_LEA),
+};
+#elif __aarch64__
+#define LEAFSIZE 256
+
+static bool burs_imm(astree_t *);
+static bool burs_scale(astree_t *);
+static bool burs_scalel(astree_t *);
+
+static size_t pool[] = {9, 10, 11, 12, 13, 14, 15, 8};
+static size_t argreg[] = {0, 1, 2, 3, 4, 5, 6, 7};
+static size_t calleereg[] = {19, 20, 21, 22, 23, 24, 25, 26, 27, 28};
+static size_t retreg = 0;
+static size_t tmpreg = 16;
+static burs_t burs[] = {
+    RULE(NT_REG, AS_VAR, NT_NONE, NT_NONE, 1, BR_LOAD, NULL),
+    RULE(NT_RVAR, AS_VAR, NT_NONE, NT_NONE, 0, BR_OPND, burs_rvar),
+    RULE(NT_REG, AS_NUM, NT_NONE, NT_NONE, 1, BR_NUM, NULL),
+    RULE(NT_IMM, AS_NUM, NT_NONE, NT_NONE, 0, BR_OPND, burs_imm),
+    RULE(NT_REG, AS_CAST, NT_REG, NT_NONE, 1, BR_CAST, NULL),
+    RULE(NT_REG, AS_ASG, NT_NONE, NT_NONE, 1, BR_ASG, NULL),
+    RULE(NT_REG, AS_FNC, NT_NONE, NT_NONE, 1, BR_CALL, NULL),
+    RULE(NT_REG, AS_ADD, NT_REG, NT_REG, 1, BR_BIN, NULL),
+    RULE(NT_REG, AS_ADD, NT_REG, NT_IMM, 1, BR_BIN, NULL),
+    RULE(NT_REG, AS_ADD, NT_REG, NT_RVAR, 1, BR_BIN, NULL),
+    RULE(NT_REG, AS_ADD, NT_REG, NT_INDEX, 1, BR_BIN, NULL),
+    SWAP(NT_REG, AS_ADD, NT_IMM, NT_REG, 1, BR_BIN, NULL),
+    SWAP(NT_REG, AS_ADD, NT_RVAR, NT_REG, 1, BR_BIN, NULL),
+    SWAP(NT_REG, AS_ADD, NT_INDEX, NT_REG, 1, BR_BIN, NULL),
+    RULE(NT_REG, AS_SUB, NT_REG, NT_REG, 1, BR_BIN, NULL),
+    RULE(NT_REG, AS_SUB, NT_REG, NT_IMM, 1, BR_BIN, NULL),
+    RULE(NT_REG, AS_SUB, NT_REG, NT_RVAR, 1, BR_BIN, NULL),
+    RULE(NT_REG, AS_SUB, NT_REG, NT_INDEX, 1, BR_BIN, NULL),
+    RULE(NT_REG, AS_MUL, NT_REG, NT_REG, 3, BR_BIN, NULL),
+    RULE(NT_REG, AS_MUL, NT_REG, NT_RVAR, 3, BR_BIN, NULL),
+    SWAP(NT_REG, AS_MUL, NT_RVAR, NT_REG, 3, BR_BIN, NULL),
+    RULE(NT_REG, AS_DIV, NT_REG, NT_REG, 4, BR_BIN, NULL),
+    RULE(NT_REG, AS_DIV, NT_REG, NT_RVAR, 4, BR_BIN, NULL),
+    RULE(NT_REG, AS_MOD, NT_REG, NT_REG, 4, BR_BIN, NULL),
+    RULE(NT_REG, AS_MOD, NT_REG, NT_RVAR, 4, BR_BIN, NULL),
+    RULE(NT_INDEX, AS_MUL, NT_REG, NT_IMM, 0, BR_INDEX, burs_scale),
+    SWAP(NT_INDEX, AS_MUL, NT_IMM, NT_REG, 0, BR_INDEX, burs_scalel),
+    RULE(NT_PROD, AS_MUL, NT_REG, NT_REG, 0, BR_SUM, NULL),
+    RULE(NT_REG, AS_ADD, NT_REG, NT_PROD, 3, BR_BIN, NULL),
+    SWAP(NT_REG, AS_ADD, NT_PROD, NT_REG, 3, BR_BIN, NULL),
+    RULE(NT_REG, AS_SUB, NT_REG, NT_PROD, 3, BR_BIN, NULL),
+    CMP(NT_REG, NT_REG, 1),
+    CMP(NT_REG, NT_IMM, 1),
+    CMP(NT_REG, NT_RVAR, 1),
+    CMP(NT_RVAR, NT_REG, 1),
+    CMP(NT_RVAR, NT_IMM, 1),
+    CMP(NT_RVAR, NT_RVAR, 1),
+    CHAIN(NT_REG, NT_FLAGS, 1, BR_SET),
+    CHAIN(NT_REG, NT_INDEX, 1, BR_LEA),
+};
+#endif
+
+static size_t npool = sizeof(pool) / sizeof(*pool);
+static size_t nargreg = sizeof(argreg) / sizeof(*argreg);
+static size_t ncalleereg = sizeof(calleereg) / sizeof(*calleereg);
+static size_t nburs = sizeof(burs) / sizeof(*burs);
+static _Thread_local astree_t *func;
+static _Thread_local bool used[NREG];
+static _Thread_local size_t held[NHELD];
+static _Thread_local size_t nheld;
+static _Thread_local size_t nspill;
+static _Thread_local size_t nsave;
+static _Thread_local size_t ndef;
+static bool optsize;
+static bool omit = true;
+static _Thread_local bool frameless;
+static _Thread_local bool spilled;
+static _Thread_local cold_t cold[NCOLD];
+static _Thread_local size_t ncold;
+static char *instrument;
+static _Thread_local char *debug;
+static _Thread_local uint64_t *profkey;
+static _Thread_local size_t nprofkey;
+
+void generator(emitter_t *ofp, astree_t *ast) {
+    ndef = 0;
+    for (size_t i = 0; i < nprofkey; i++) {
+        profkey[i] = 0;
+    }
     generate_prog(ofp, ast);
     return;
 }
 
-#ifdef __x86_64__
-void generate_prog(FILE *ofp, astree_t *ast) {
-    fputs(".global main\n", ofp);
-    fputs("main:\n", ofp);
-    fputs("    pushq %rbp\n", ofp);
-    fputs("    movq %rsp, %rbp\n", ofp);
-    fputs("    subq $256, %rsp\n", ofp);
-    generate_stmt(ofp, ast);
-    fputs("    movq %rbp, %rsp\n", ofp);
-    fputs("    popq %rbp\n", ofp);
-    fputs("    ret\n", ofp);
+void generator_size(bool on) {
+    optsize = on;
+    return;
+}
+
+void generator_omit(bool on) {
+    omit = on;
+    return;
+}
+
+void generator_instrument(char *path) {
+    instrument = path;
+    return;
+}
+
+void generator_debug(char *path) {
+    debug = path;
+    return;
+}
+
+void generate_prog(emitter_t *ofp, astree_t *ast) {
+    if (debug != NULL) {
+        emitter_puts(ofp, "    .file 1 ");
+        emit_string(ofp, debug);
+        emitter_putc(ofp, '\n');
+    }
+    for (; ast != NULL; ast = ast->def_next) {
+        if (!ast->def_proto) {
+            generate_def(ofp, ast);
+        }
+    }
+    if (instrument != NULL) {
+        generate_profile(ofp);
+    }
+    return;
+}
+
+void generate_def(emitter_t *ofp, astree_t *ast) {
+    ndef++;
+    func = ast;
+    assert(ast->def_nreg <= ncalleereg);
+    frameless = omit && ast->def_leaf && ast->def_size <= LEAFSIZE;
+    if (frameless) {
+        emitter_t *dry = emitter_memory(NULL, 0);
+        generate_body(dry, ast);
+        generate_cold(dry);
+        emitter_close(dry);
+        frameless = !spilled;
+    }
+    emit_prologue(ofp, ast);
+    generate_body(ofp, ast);
+    if (optsize) {
+        emit_label(ofp, ".Lret", ndef);
+    }
+    emit_epilogue(ofp);
+    generate_cold(ofp);
+    if (debug != NULL) {
+        emitter_puts(ofp, "    .cfi_endproc\n");
+    }
+    return;
+}
+
+/* A frameless leaf addresses its locals off the stack pointer, which a spill
+   push would move, so generate_def does a dry run to rule spills out first. */
+void generate_body(emitter_t *ofp, astree_t *ast) {
+    for (size_t i = 0; i < NREG; i++) {
+        used[i] = false;
+    }
+    nheld = nspill = nsave = ncold = 0;
+    spilled = false;
+    profile_func(ast->def_id);
+    generate_param(ofp, ast->def_param, 0);
+    generate_stmt(ofp, ast->def_body);
+    return;
+}
+
+/* Parameters past the argument registers are loaded from the caller's
+   outgoing area through a scratch register, which is free on entry. */
+void generate_param(emitter_t *ofp, astree_t *ast, size_t idx) {
+    if (ast == NULL) {
+        return;
+    }
+    if (idx < nargreg) {
+        emit_param(ofp, ast->arg_val->var_idl, argreg[idx]);
+    } else {
+        size_t reg = reg_alloc(ofp);
+        emit_inarg(ofp, reg, idx - nargreg);
+        emit_param(ofp, ast->arg_val->var_idl, reg);
+        reg_free(reg);
+    }
+    generate_param(ofp, ast->arg_next, idx + 1);
     return;
 }
 
-void generate_stmt(FILE *ofp, astree_t *ast) {
+void generate_stmt(emitter_t *ofp, astree_t *ast) {
     if (ast == NULL) {
         return;
     }
+    if (ast->kind != AS_BLK) {
+        emit_loc(ofp, ast);
+    }
     switch (ast->kind) {
     case AS_BLK:
         generate_stmt(ofp, ast->blk_body);
         generate_stmt(ofp, ast->blk_next);
         break;
     case AS_IF:
-        generate_expr(ofp, ast->if_cond);
-        fputs("    popq %rax\n", ofp);
-        fputs("    cmpq $0, %rax\n", ofp);
-        fprintf(ofp, "    je .Lelse%zu\n", ast->if_jmp);
-        generate_stmt(ofp, ast->if_then);
-        fprintf(ofp, "    jmp .Lend%zu\n", ast->if_jmp);
-        fprintf(ofp, ".Lelse%zu:\n", ast->if_jmp);
-        generate_stmt(ofp, ast->if_else);
-        fprintf(ofp, ".Lend%zu:\n", ast->if_jmp);
+        generate_if(ofp, ast);
         break;
     case AS_WHILE:
-        fprintf(ofp, ".Lbegin%zu:\n", ast->while_jmp);
-        generate_expr(ofp, ast->while_cond);
-        fputs("    popq %rax\n", ofp);
-        fputs("    cmpq $0, %rax\n", ofp);
-        fprintf(ofp, "    je .Lend%zu\n", ast->while_jmp);
-        generate_stmt(ofp, ast->while_body);
-        fprintf(ofp, "    jmp .Lbegin%zu\n", ast->while_jmp);
-        fprintf(ofp, ".Lend%zu:\n", ast->while_jmp);
-        break;
     case AS_FOR:
-        generate_expr(ofp, ast->for_init);
-        fprintf(ofp, ".Lbegin%zu:\n", ast->for_jmp);
-        generate_expr(ofp, ast->for_cond);
-        fputs("    popq %rax\n", ofp);
-        fputs("    cmpq $0, %rax\n", ofp);
-        fprintf(ofp, "    je .Lend%zu\n", ast->for_jmp);
-        generate_stmt(ofp, ast->for_body);
-        generate_expr(ofp, ast->for_step);
-        fprintf(ofp, "    jmp .Lbegin%zu\n", ast->for_jmp);
-        fprintf(ofp, ".Lend%zu:\n", ast->for_jmp);
-        break;
-    case AS_RET:
-        generate_expr(ofp, ast->bin_left);
-        fputs("    popq %rax\n", ofp);
-        fputs("    movq %rbp, %rsp\n", ofp);
-        fputs("    popq %rbp\n", ofp);
-        fputs("    ret\n", ofp);
+        generate_loop(ofp, ast);
+        break;
+    case AS_RET: {
+        generate_expr(ofp, ast->ret_val);
+        size_t reg = value_pop(ofp);
+        if (optsize) {
+            emit_mov(ofp, retreg, reg);
+            emit_jump(ofp, ".Lret", ndef);
+        } else {
+            emit_ret(ofp, reg);
+        }
+        reg_free(reg);
         break;
+    }
     default:
         generate_expr(ofp, ast);
-        fputs("    popq %rax\n", ofp);
+        reg_free(value_pop(ofp));
         break;
     }
     return;
 }
 
-void generate_expr(FILE *ofp, astree_t *ast) {
+/* With a profile the hotter side falls through, and a side that runs less
+   than 1/PROFBIAS as often as the other is moved out of line entirely. */
+void generate_if(emitter_t *ofp, astree_t *ast) {
+    uint64_t count[2] = {0, 0};
+    size_t jmp = ast->if_jmp;
+    bool swap = generate_count(ast, jmp, count) && count[1] > count[0];
+    long long val;
+    if (ranger_known(ast->if_cond, &val)) {
+        generate_stmt(ofp, val != 0 ? ast->if_then : ast->if_else);
+        return;
+    }
+    astree_t *hot = swap ? ast->if_else : ast->if_then;
+    astree_t *away = swap ? ast->if_then : ast->if_else;
+    char *label = swap ? ".Lthen" : ".Lelse";
+    generate_cond(ofp, ast->if_cond, swap, label, jmp);
+    emit_count(ofp, jmp, swap);
+    generate_stmt(ofp, hot);
+    if (away != NULL && count[swap] > PROFBIAS * count[!swap]) {
+        assert(ncold < NCOLD);
+        cold[ncold].ast = ast;
+        cold[ncold++].swap = swap;
+    } else {
+        emit_jump(ofp, ".Lend", jmp);
+        emit_label(ofp, label, jmp);
+        emit_count(ofp, jmp, !swap);
+        generate_stmt(ofp, away);
+    }
+    emit_label(ofp, ".Lend", jmp);
+    return;
+}
+
+/* A loop the profile shows iterating more often than it is entered is
+   rotated so each iteration costs one conditional branch instead of a
+   conditional branch and a jump. */
+void generate_loop(emitter_t *ofp, astree_t *ast) {
+    bool isfor = ast->kind == AS_FOR;
+    astree_t *cond = isfor ? ast->for_cond : ast->while_cond;
+    astree_t *body = isfor ? ast->for_body : ast->while_body;
+    size_t jmp = isfor ? ast->for_jmp : ast->while_jmp;
+    uint64_t count[2] = {0, 0};
+    if (isfor) {
+        generate_stmt(ofp, ast->for_init);
+    }
+    bool rotate = generate_count(ast, jmp, count) && cond != NULL && count[0] > count[1];
+    if (rotate) {
+        emit_jump(ofp, ".Lcond", jmp);
+    }
+    emit_label(ofp, ".Lbegin", jmp);
+    if (cond != NULL && !rotate) {
+        emit_loc(ofp, cond);
+        generate_cond(ofp, cond, false, ".Lend", jmp);
+    }
+    emit_count(ofp, jmp, 0);
+    generate_stmt(ofp, body);
+    if (isfor) {
+        generate_stmt(ofp, ast->for_step);
+    }
+    if (rotate) {
+        emit_label(ofp, ".Lcond", jmp);
+        emit_loc(ofp, cond);
+        generate_cond(ofp, cond, true, ".Lbegin", jmp);
+    } else {
+        emit_jump(ofp, ".Lbegin", jmp);
+    }
+    emit_label(ofp, ".Lend", jmp);
+    emit_count(ofp, jmp, 1);
+    return;
+}
+
+/* Cold sides can themselves defer colder sides, so this runs until the
+   queue stays empty. */
+void generate_cold(emitter_t *ofp) {
+    for (size_t i = 0; i < ncold; i++) {
+        astree_t *ast = cold[i].ast;
+        bool swap = cold[i].swap;
+        emit_label(ofp, swap ? ".Lthen" : ".Lelse", ast->if_jmp);
+        emit_count(ofp, ast->if_jmp, !swap);
+        generate_stmt(ofp, swap ? ast->if_then : ast->if_else);
+        emit_jump(ofp, ".Lend", ast->if_jmp);
+    }
+    ncold = 0;
+    return;
+}
+
+/* Every site is keyed whether or not a profile is in use, so that keys stay
+   in step between the instrumented build and the optimized one. */
+bool generate_count(astree_t *ast, size_t jmp, uint64_t *count) {
+    uint64_t key = profile_key(ast);
+    if (instrument != NULL) {
+        if (jmp >= nprofkey) {
+            size_t n = nprofkey == 0 ? 256 : nprofkey;
+            while (n <= jmp) {
+                n *= 2;
+            }
+            profkey = realloc(profkey, n * sizeof(uint64_t));
+            assert(profkey != NULL);
+            for (size_t i = nprofkey; i < n; i++) {
+                profkey[i] = 0;
+            }
+            nprofkey = n;
+        }
+        profkey[jmp] = key;
+    }
+    return profile_count(key, count);
+}
+
+/* The counter table is indexed by jump ID and written out whole, keys
+   included, by a destructor the program runs at exit; unused slots carry
+   key 0 and are skipped when the profile is read back. */
+void generate_profile(emitter_t *ofp) {
+    emit_dump(ofp);
+    emitter_puts(ofp, ".section .fini_array, \"aw\"\n");
+    emitter_puts(ofp, "    .p2align 3\n");
+    emitter_puts(ofp, "    .quad .Lprofdump\n");
+    emitter_puts(ofp, ".data\n");
+    emitter_puts(ofp, "    .p2align 3\n");
+    emitter_puts(ofp, ".Lprof:\n");
+    size_t n = nprofkey;
+    while (n > 0 && profkey[n - 1] == 0) {
+        n--;
+    }
+    for (size_t i = 0; i < n; i++) {
+        emitter_format(ofp, "    .quad %lld, 0, 0\n", (long long)profkey[i]);
+    }
+    emitter_puts(ofp, ".Lprofend:\n");
+    emitter_puts(ofp, ".section .rodata\n");
+    emitter_puts(ofp, ".Lprofpath:\n");
+    emitter_puts(ofp, "    .asciz ");
+    emit_string(ofp, instrument);
+    emitter_putc(ofp, '\n');
+    emitter_puts(ofp, ".text\n");
+    return;
+}
+
+void generate_cond(emitter_t *ofp, astree_t *ast, bool sense, char *label, size_t jmp) {
+    static askind_t inverse[] = {AS_NE, AS_EQ, AS_GE, AS_GT, AS_LE, AS_LT};
+    long long val;
+    if (ranger_known(ast, &val)) {
+        if ((val != 0) == sense) {
+            emit_jump(ofp, label, jmp);
+        }
+    } else if ((ast->kind == AS_EQ || ast->kind == AS_NE) && ast->bin_right->kind == AS_NUM && ast->bin_right->num_val == 0) {
+        generate_expr(ofp, ast->bin_left);
+        size_t reg = value_pop(ofp);
+        if ((ast->kind == AS_EQ) != sense) {
+            emit_jnzero(ofp, reg, ast->bin_left->type, label, jmp);
+        } else {
+            emit_jzero(ofp, reg, ast->bin_left->type, label, jmp);
+        }
+        reg_free(reg);
+    } else if (ast->kind >= AS_EQ && ast->kind <= AS_GE) {
+        operand_t flags;
+        burs_label(ast);
+        burs_reduce(ofp, ast, NT_FLAGS, &flags);
+        emit_jcc(ofp, sense ? inverse[ast->kind - AS_EQ] : ast->kind, label, jmp);
+    } else {
+        generate_expr(ofp, ast);
+        size_t reg = value_pop(ofp);
+        if (sense) {
+            emit_jnzero(ofp, reg, ast->type, label, jmp);
+        } else {
+            emit_jzero(ofp, reg, ast->type, label, jmp);
+        }
+        reg_free(reg);
+    }
+    return;
+}
+
+void generate_expr(emitter_t *ofp, astree_t *ast) {
+    operand_t op;
+    burs_label(ast);
+    burs_reduce(ofp, ast, NT_REG, &op);
+    return;
+}
+
+void generate_pair(emitter_t *ofp, astree_t *ast, burs_t *rule, operand_t *left, operand_t *right) {
+    if (generate_need(ast->bin_right) > generate_need(ast->bin_left)) {
+        burs_reduce(ofp, ast->bin_right, rule->right, right);
+        burs_reduce(ofp, ast->bin_left, rule->left, left);
+        operand_pop(ofp, left);
+        operand_pop(ofp, right);
+    } else {
+        burs_reduce(ofp, ast->bin_left, rule->left, left);
+        burs_reduce(ofp, ast->bin_right, rule->right, right);
+        operand_pop(ofp, right);
+        operand_pop(ofp, left);
+    }
+    if (rule->swap) {
+        operand_t tmp = *left;
+        *left = *right;
+        *right = tmp;
+    }
+    return;
+}
+
+/* Arguments past the argument registers go to an area reserved below
+   everything already on the stack, so the values held across the call are
+   spilled before it rather than saved after; each is stored as soon as it
+   is computed, at an offset that counts the spills made since. */
+void generate_call(emitter_t *ofp, astree_t *ast) {
+    size_t narg = 0;
+    for (astree_t *arg = ast->fnc_arg; arg != NULL; arg = arg->arg_next) {
+        narg++;
+    }
+    size_t nstack = narg > nargreg ? narg - nargreg : 0;
+    size_t area = 0;
+    if (nstack > 0) {
+        while (nspill < nheld) {
+            value_spill(ofp);
+        }
+        area = emit_reserve(ofp, nstack, nspill + nsave);
+        nsave += area;
+    }
+    size_t base = nspill;
+    size_t idx = 0;
+    for (astree_t *arg = ast->fnc_arg; arg != NULL; arg = arg->arg_next, idx++) {
+        generate_expr(ofp, arg->arg_val);
+        if (idx >= nargreg) {
+            size_t reg = value_pop(ofp);
+            emit_outarg(ofp, reg, idx - nargreg, nspill - base);
+            reg_free(reg);
+        }
+    }
+    narg -= nstack;
+    size_t src[NREG];
+    for (size_t i = narg; i > 0; i--) {
+        src[i - 1] = value_pop(ofp);
+    }
+    emit_save(ofp, &held[nspill], nheld - nspill);
+    nsave += nheld - nspill;
+    generate_move(ofp, argreg, src, narg);
+    for (size_t i = 0; i < narg; i++) {
+        reg_free(src[i]);
+    }
+    emit_call(ofp, ast, nspill + nsave);
+    emit_restore(ofp, &held[nspill], nheld - nspill);
+    nsave -= nheld - nspill;
+    if (area > 0) {
+        emit_release(ofp, area);
+        nsave -= area;
+    }
+    size_t reg = reg_alloc(ofp);
+    emit_mov(ofp, reg, retreg);
+    if (ast->type < TY_INT) {
+        emit_cast(ofp, reg, TY_INT, ast->type);
+    }
+    value_push(reg);
+    return;
+}
+
+void generate_move(emitter_t *ofp, size_t *dst, size_t *reg, size_t len) {
+    bool done[NREG] = {false};
+    size_t src[NREG];
+    size_t left = len;
+    for (size_t i = 0; i < len; i++) {
+        src[i] = reg[i];
+        if (dst[i] == src[i]) {
+            done[i] = true;
+            left--;
+        }
+    }
+    while (left > 0) {
+        bool moved = false;
+        for (size_t i = 0; i < len; i++) {
+            if (done[i]) {
+                continue;
+            }
+            bool busy = false;
+            for (size_t j = 0; j < len; j++) {
+                busy |= !done[j] && j != i && src[j] == dst[i];
+            }
+            if (!busy) {
+                emit_mov(ofp, dst[i], src[i]);
+                done[i] = moved = true;
+                left--;
+            }
+        }
+        if (!moved) {
+            for (size_t i = 0; i < len; i++) {
+                if (!done[i]) {
+                    emit_mov(ofp, tmpreg, src[i]);
+                    src[i] = tmpreg;
+                    break;
+                }
+            }
+        }
+    }
+    return;
+}
+
+size_t generate_need(astree_t *ast) {
     switch (ast->kind) {
     case AS_ADD:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    popq %rbx\n", ofp);
-        fputs("    popq %rax\n", ofp);
-        fputs("    addq %rbx, %rax\n", ofp);
-        fputs("    pushq %rax\n", ofp);
-        break;
     case AS_SUB:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    popq %rbx\n", ofp);
-        fputs("    popq %rax\n", ofp);
-        fputs("    subq %rbx, %rax\n", ofp);
-        fputs("    pushq %rax\n", ofp);
-        break;
     case AS_MUL:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    popq %rbx\n", ofp);
-        fputs("    popq %rax\n", ofp);
-        fputs("    imulq %rbx\n", ofp);
-        fputs("    pushq %rax\n", ofp);
-        break;
     case AS_DIV:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    popq %rbx\n", ofp);
-        fputs("    popq %rax\n", ofp);
-        fputs("    cqto\n", ofp);
-        fputs("    idivq %rbx\n", ofp);
-        fputs("    pushq %rax\n", ofp);
-        break;
     case AS_MOD:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    popq %rbx\n", ofp);
-        fputs("    popq %rax\n", ofp);
-        fputs("    cqto\n", ofp);
-        fputs("    idivq %rbx\n", ofp);
-        fputs("    pushq %rdx\n", ofp);
-        break;
     case AS_EQ:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    popq %rbx\n", ofp);
-        fputs("    popq %rax\n", ofp);
-        fputs("    cmpq %rbx, %rax\n", ofp);
-        fputs("    sete %al\n", ofp);
-        fputs("    movzbq %al, %rax\n", ofp);
-        fputs("    pushq %rax\n", ofp);
-        break;
     case AS_NE:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    popq %rbx\n", ofp);
-        fputs("    popq %rax\n", ofp);
-        fputs("    cmpq %rbx, %rax\n", ofp);
-        fputs("    setne %al\n", ofp);
-        fputs("    movzbq %al, %rax\n", ofp);
-        fputs("    pushq %rax\n", ofp);
-        break;
     case AS_LT:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    popq %rbx\n", ofp);
-        fputs("    popq %rax\n", ofp);
-        fputs("    cmpq %rbx, %rax\n", ofp);
-        fputs("    setl %al\n", ofp);
-        fputs("    movzbq %al, %rax\n", ofp);
-        fputs("    pushq %rax\n", ofp);
-        break;
     case AS_LE:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    popq %rbx\n", ofp);
-        fputs("    popq %rax\n", ofp);
-        fputs("    cmpq %rbx, %rax\n", ofp);
-        fputs("    setle %al\n", ofp);
-        fputs("    movzbq %al, %rax\n", ofp);
-        fputs("    pushq %rax\n", ofp);
-        break;
     case AS_GT:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    popq %rbx\n", ofp);
-        fputs("    popq %rax\n", ofp);
-        fputs("    cmpq %rbx, %rax\n", ofp);
-        fputs("    setg %al\n", ofp);
-        fputs("    movzbq %al, %rax\n", ofp);
-        fputs("    pushq %rax\n", ofp);
-        break;
-    case AS_GE:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    popq %rbx\n", ofp);
-        fputs("    popq %rax\n", ofp);
-        fputs("    cmpq %rbx, %rax\n", ofp);
-        fputs("    setge %al\n", ofp);
-        fputs("    movzbq %al, %rax\n", ofp);
-        fputs("    pushq %rax\n", ofp);
-        break;
+    case AS_GE: {
+        size_t left = generate_need(ast->bin_left);
+        size_t right = generate_need(ast->bin_right);
+        return left == right ? left + 1 : left > right ? left : right;
+    }
     case AS_ASG:
-        generate_expr(ofp, ast->bin_right);
-        fputs("    popq %rax\n", ofp);
-        fprintf(ofp, "    movq %%rax, -%zu(%%rbp)\n", ast->bin_left->var_ofs << 3);
-        fputs("    pushq %rax\n", ofp);
-        break;
+        return generate_need(ast->bin_right);
+    case AS_CAST:
+        return generate_need(ast->cast_val);
     case AS_FNC:
-        fprintf(ofp, "    call %s\n", ast->fnc_id);
-        fputs("    pushq %rax\n", ofp);
-        break;
-    case AS_VAR:
-        fprintf(ofp, "    movq -%zu(%%rbp), %%rax\n", ast->var_ofs << 3);
-        fputs("    pushq %rax\n", ofp);
-        break;
-    case AS_NUM:
-        fprintf(ofp, "    pushq $%lld\n", ast->num_val);
-        break;
+        return npool;
     default:
-        assert(false);
+        return 1;
     }
-    return;
-}
-#elif __aarch64__
-void generate_prog(FILE *ofp, astree_t *ast) {
-    fputs(".global main\n", ofp);
-    fputs("main:\n", ofp);
-    fputs("    stp x29, x30, [sp, #-16]!\n", ofp);
-    fputs("    mov x29, sp\n", ofp);
-    fputs("    sub sp, sp, #256\n", ofp);
-    generate_stmt(ofp, ast);
-    fputs("    mov sp, x29\n", ofp);
-    fputs("    ldp x29, x30, [sp], #16\n", ofp);
-    fputs("    ret\n", ofp);
-    return;
 }
 
-void generate_stmt(FILE *ofp, astree_t *ast) {
-    if (ast == NULL) {
-        return;
-    }
+void burs_label(astree_t *ast) {
     switch (ast->kind) {
-    case AS_BLK:
-        generate_stmt(ofp, ast->blk_body);
-        generate_stmt(ofp, ast->blk_next);
-        break;
-    case AS_IF:
-        generate_expr(ofp, ast->if_cond);
-        fputs("    ldr x0, [sp], #16\n", ofp);
-        fputs("    cmp x0, #0\n", ofp);
-        fprintf(ofp, "    beq .Lelse%zu\n", ast->if_jmp);
-        generate_stmt(ofp, ast->if_then);
-        fprintf(ofp, "    b .Lend%zu\n", ast->if_jmp);
-        fprintf(ofp, ".Lelse%zu:\n", ast->if_jmp);
-        generate_stmt(ofp, ast->if_else);
-        fprintf(ofp, ".Lend%zu:\n", ast->if_jmp);
-        break;
-    case AS_WHILE:
-        fprintf(ofp, ".Lbegin%zu:\n", ast->while_jmp);
-        generate_expr(ofp, ast->while_cond);
-        fputs("    ldr x0, [sp], #16\n", ofp);
-        fputs("    cmp x0, #0\n", ofp);
-        fprintf(ofp, "    beq .Lend%zu\n", ast->while_jmp);
-        generate_stmt(ofp, ast->while_body);
-        fprintf(ofp, "    b .Lbegin%zu\n", ast->while_jmp);
-        fprintf(ofp, ".Lend%zu:\n", ast->while_jmp);
+    case AS_ADD:
+    case AS_SUB:
+    case AS_MUL:
+    case AS_DIV:
+    case AS_MOD:
+    case AS_EQ:
+    case AS_NE:
+    case AS_LT:
+    case AS_LE:
+    case AS_GT:
+    case AS_GE:
+        burs_label(ast->bin_left);
+        burs_label(ast->bin_right);
         break;
-    case AS_FOR:
-        generate_expr(ofp, ast->for_init);
-        fprintf(ofp, ".Lbegin%zu:\n", ast->for_jmp);
-        generate_expr(ofp, ast->for_cond);
-        fputs("    ldr x0, [sp], #16\n", ofp);
-        fputs("    cmp x0, #0\n", ofp);
-        fprintf(ofp, "    beq .Lend%zu\n", ast->for_jmp);
-        generate_stmt(ofp, ast->for_body);
-        generate_expr(ofp, ast->for_step);
-        fprintf(ofp, "    b .Lbegin%zu\n", ast->for_jmp);
-        fprintf(ofp, ".Lend%zu:\n", ast->for_jmp);
-        break;
-    case AS_RET:
-        generate_expr(ofp, ast->bin_left);
-        fputs("    ldr x0, [sp], #16\n", ofp);
-        fputs("    mov sp, x29\n", ofp);
-        fputs("    ldp x29, x30, [sp], #16\n", ofp);
-        fputs("    ret\n", ofp);
+    case AS_CAST:
+        burs_label(ast->cast_val);
         break;
     default:
-        generate_expr(ofp, ast);
-        fputs("    ldr x0, [sp], #16\n", ofp);
         break;
     }
+    for (size_t nt = 0; nt < NNT; nt++) {
+        ast->cost[nt] = SIZE_MAX;
+    }
+    for (size_t i = 0; i < nburs; i++) {
+        burs_t *rule = &burs[i];
+        if (rule->chain || ast->kind < rule->first || ast->kind > rule->last || (rule->cond != NULL && !rule->cond(ast))) {
+            continue;
+        }
+        size_t cost = rule->cost;
+        if (rule->left != NT_NONE) {
+            size_t kid = burs_kid(ast, 0)->cost[rule->left];
+            cost = kid == SIZE_MAX ? SIZE_MAX : cost + kid;
+        }
+        if (rule->right != NT_NONE && cost != SIZE_MAX) {
+            size_t kid = burs_kid(ast, 1)->cost[rule->right];
+            cost = kid == SIZE_MAX ? SIZE_MAX : cost + kid;
+        }
+        if (cost < ast->cost[rule->lhs]) {
+            ast->cost[rule->lhs] = cost;
+            ast->rule[rule->lhs] = i;
+        }
+    }
+    for (bool change = true; change;) {
+        change = false;
+        for (size_t i = 0; i < nburs; i++) {
+            burs_t *rule = &burs[i];
+            if (rule->chain && ast->cost[rule->left] != SIZE_MAX && ast->cost[rule->left] + rule->cost < ast->cost[rule->lhs]) {
+                ast->cost[rule->lhs] = ast->cost[rule->left] + rule->cost;
+                ast->rule[rule->lhs] = i;
+                change = true;
+            }
+        }
+    }
     return;
 }
 
-void generate_expr(FILE *ofp, astree_t *ast) {
-    switch (ast->kind) {
-    case AS_ADD:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    ldr x1, [sp], #16\n", ofp);
-        fputs("    ldr x0, [sp], #16\n", ofp);
-        fputs("    add x0, x0, x1\n", ofp);
-        fputs("    str x0, [sp, #-16]!\n", ofp);
-        break;
-    case AS_SUB:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    ldr x1, [sp], #16\n", ofp);
-        fputs("    ldr x0, [sp], #16\n", ofp);
-        fputs("    sub x0, x0, x1\n", ofp);
-        fputs("    str x0, [sp, #-16]!\n", ofp);
-        break;
-    case AS_MUL:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    ldr x1, [sp], #16\n", ofp);
-        fputs("    ldr x0, [sp], #16\n", ofp);
-        fputs("    mul x0, x0, x1\n", ofp);
-        fputs("    str x0, [sp, #-16]!\n", ofp);
+void burs_reduce(emitter_t *ofp, astree_t *ast, ntkind_t nt, operand_t *op) {
+    assert(ast->cost[nt] != SIZE_MAX);
+    burs_t *rule = &burs[ast->rule[nt]];
+    operand_t left, right;
+    *op = (operand_t){.kind = nt};
+    switch (rule->act) {
+    case BR_OPND:
+        if (ast->kind == AS_NUM) {
+            op->imm = ast->num_val;
+        } else {
+            op->idl = ast->var_idl;
+        }
         break;
-    case AS_DIV:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    ldr x1, [sp], #16\n", ofp);
-        fputs("    ldr x0, [sp], #16\n", ofp);
-        fputs("    sdiv x0, x0, x1\n", ofp);
-        fputs("    str x0, [sp, #-16]!\n", ofp);
+    case BR_LOAD: {
+        size_t reg = reg_alloc(ofp);
+        emit_load(ofp, reg, ast->var_idl);
+        value_push(reg);
+        op->base = true;
         break;
-    case AS_MOD:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    ldr x1, [sp], #16\n", ofp);
-        fputs("    ldr x0, [sp], #16\n", ofp);
-        fputs("    sdiv x2, x0, x1\n", ofp);
-        fputs("    msub x0, x1, x2, x0\n", ofp);
-        fputs("    str x0, [sp, #-16]!\n", ofp);
+    }
+    case BR_NUM: {
+        size_t reg = reg_alloc(ofp);
+        emit_num(ofp, reg, ast);
+        value_push(reg);
+        op->base = true;
         break;
-    case AS_EQ:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    ldr x1, [sp], #16\n", ofp);
-        fputs("    ldr x0, [sp], #16\n", ofp);
-        fputs("    cmp x0, x1\n", ofp);
-        fputs("    cset x0, eq\n", ofp);
-        fputs("    str x0, [sp, #-16]!\n", ofp);
+    }
+    case BR_CAST: {
+        burs_reduce(ofp, ast->cast_val, rule->left, &left);
+        size_t reg = value_pop(ofp);
+        if (!burs_fits(ast)) {
+            emit_cast(ofp, reg, ast->cast_val->type, ast->type);
+        }
+        value_push(reg);
+        op->base = true;
         break;
-    case AS_NE:
-        generate_expr(ofp, ast->bin_left);
+    }
+    case BR_ASG: {
         generate_expr(ofp, ast->bin_right);
-        fputs("    ldr x1, [sp], #16\n", ofp);
-        fputs("    ldr x0, [sp], #16\n", ofp);
-        fputs("    cmp x0, x1\n", ofp);
-        fputs("    cset x0, ne\n", ofp);
-        fputs("    str x0, [sp, #-16]!\n", ofp);
+        size_t reg = value_pop(ofp);
+        emit_store(ofp, reg, ast->bin_left->var_idl);
+        value_push(reg);
+        op->base = true;
         break;
-    case AS_LT:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    ldr x1, [sp], #16\n", ofp);
-        fputs("    ldr x0, [sp], #16\n", ofp);
-        fputs("    cmp x0, x1\n", ofp);
-        fputs("    cset x0, lt\n", ofp);
-        fputs("    str x0, [sp, #-16]!\n", ofp);
+    }
+    case BR_CALL:
+        generate_call(ofp, ast);
+        op->base = true;
         break;
-    case AS_LE:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    ldr x1, [sp], #16\n", ofp);
-        fputs("    ldr x0, [sp], #16\n", ofp);
-        fputs("    cmp x0, x1\n", ofp);
-        fputs("    cset x0, le\n", ofp);
-        fputs("    str x0, [sp, #-16]!\n", ofp);
+    case BR_BIN:
+        generate_pair(ofp, ast, rule, &left, &right);
+        emit_bin(ofp, ast->kind, burs_width(ast), left.reg, &right, burs_signed(ast));
+        operand_free(&right);
+        value_push(left.reg);
+        op->base = true;
         break;
-    case AS_GT:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    ldr x1, [sp], #16\n", ofp);
-        fputs("    ldr x0, [sp], #16\n", ofp);
-        fputs("    cmp x0, x1\n", ofp);
-        fputs("    cset x0, gt\n", ofp);
-        fputs("    str x0, [sp, #-16]!\n", ofp);
+    case BR_CMP:
+        generate_pair(ofp, ast, rule, &left, &right);
+        emit_cmp(ofp, burs_width(ast), &left, &right);
+        operand_free(&left);
+        operand_free(&right);
         break;
-    case AS_GE:
-        generate_expr(ofp, ast->bin_left);
-        generate_expr(ofp, ast->bin_right);
-        fputs("    ldr x1, [sp], #16\n", ofp);
-        fputs("    ldr x0, [sp], #16\n", ofp);
-        fputs("    cmp x0, x1\n", ofp);
-        fputs("    cset x0, ge\n", ofp);
-        fputs("    str x0, [sp, #-16]!\n", ofp);
+    case BR_SET: {
+        burs_reduce(ofp, ast, rule->left, &left);
+        size_t reg = reg_alloc(ofp);
+        emit_set(ofp, ast->kind, reg);
+        value_push(reg);
+        op->base = true;
         break;
-    case AS_ASG:
-        generate_expr(ofp, ast->bin_right);
-        fputs("    ldr x0, [sp], #16\n", ofp);
-        fprintf(ofp, "    str x0, [x29, #-%zu]\n", ast->bin_left->var_ofs << 4);
-        fputs("    str x0, [sp, #-16]!\n", ofp);
+    }
+    case BR_INDEX:
+        generate_pair(ofp, ast, rule, &left, &right);
+        op->index = true;
+        op->idx = left.reg;
+        op->scale = right.imm;
+        operand_push(op);
         break;
-    case AS_FNC:
-        fprintf(ofp, "    bl %s\n", ast->fnc_id);
-        fputs("    str x0, [sp, #-16]!\n", ofp);
+    case BR_SUM:
+        generate_pair(ofp, ast, rule, &left, &right);
+        op->base = op->index = true;
+        op->reg = left.reg;
+        op->idx = right.kind == NT_INDEX ? right.idx : right.reg;
+        op->scale = right.kind == NT_INDEX ? right.scale : 1;
+        operand_push(op);
         break;
-    case AS_VAR:
-        fprintf(ofp, "    ldr x0, [x29, #-%zu]\n", ast->var_ofs << 4);
-        fputs("    str x0, [sp, #-16]!\n", ofp);
+    case BR_DISP:
+        generate_pair(ofp, ast, rule, &left, &right);
+        *op = left;
+        op->kind = nt;
+        op->imm = ast->kind == AS_SUB ? -right.imm : right.imm;
+        operand_push(op);
         break;
-    case AS_NUM:
-        fprintf(ofp, "    mov x0, #%lld\n", ast->num_val);
-        fputs("    str x0, [sp, #-16]!\n", ofp);
+    case BR_LEA: {
+        burs_reduce(ofp, ast, rule->left, &left);
+        operand_pop(ofp, &left);
+        size_t reg = left.base ? left.reg : left.idx;
+        emit_lea(ofp, ast->type, reg, &left);
+        if (left.base && left.index) {
+            reg_free(left.idx);
+        }
+        value_push(reg);
+        op->base = true;
         break;
+    }
     default:
         assert(false);
     }
     return;
 }
+
+astree_t *burs_kid(astree_t *ast, size_t idx) {
+    if (ast->kind == AS_CAST) {
+        return ast->cast_val;
+    }
+    return idx == 0 ? ast->bin_left : ast->bin_right;
+}
+
+bool burs_rvar(astree_t *ast) {
+    return ast->var_idl->reg != 0 && ast->var_idl->type >= TY_INT;
+}
+
+/* A long result the ranges put in [0, UINT32_MAX] is the zero extension of
+   its low half, which a 32-bit instruction computes from the operands' low
+   halves; a division needs the operands themselves in that range, and a
+   comparison needs them in int's. */
+tykind_t burs_width(astree_t *ast) {
+    astree_t *left = ast->bin_left, *right = ast->bin_right;
+    switch (ast->kind) {
+    case AS_DIV:
+    case AS_MOD:
+        if (ast->type == TY_LONG && !burs_signed(ast) && left->hi <= UINT32_MAX && right->hi <= UINT32_MAX) {
+            return TY_INT;
+        }
+        return ast->type;
+    case AS_EQ:
+    case AS_NE:
+    case AS_LT:
+    case AS_LE:
+    case AS_GT:
+    case AS_GE:
+        if (left->lo >= INT_MIN && left->hi <= INT_MAX && right->lo >= INT_MIN && right->hi <= INT_MAX) {
+            return TY_INT;
+        }
+        return left->type;
+    default:
+        return ast->type == TY_LONG && ast->lo >= 0 && ast->hi <= UINT32_MAX ? TY_INT : ast->type;
+    }
+}
+
+/* Division of non-negative operands is the same signed or unsigned, and
+   unsigned needs no sign extension of the dividend. */
+bool burs_signed(astree_t *ast) {
+    return ast->bin_left->lo < 0 || ast->bin_right->lo < 0;
+}
+
+/* A value already in range for char or short is its own sign extension. */
+bool burs_fits(astree_t *ast) {
+    long long max = ast->type == TY_CHAR ? SCHAR_MAX : ast->type == TY_SHORT ? SHRT_MAX : 0;
+    return max != 0 && ast->cast_val->lo >= -max - 1 && ast->cast_val->hi <= max;
+}
+
+void operand_push(operand_t *op) {
+    if (op->base) {
+        value_push(op->reg);
+    }
+    if (op->index) {
+        value_push(op->idx);
+    }
+    return;
+}
+
+void operand_pop(emitter_t *ofp, operand_t *op) {
+    if (op->index) {
+        op->idx = value_pop(ofp);
+    }
+    if (op->base) {
+        op->reg = value_pop(ofp);
+    }
+    return;
+}
+
+void operand_free(operand_t *op) {
+    if (op->base) {
+        reg_free(op->reg);
+    }
+    if (op->index) {
+        reg_free(op->idx);
+    }
+    return;
+}
+
+size_t reg_alloc(emitter_t *ofp) {
+    for (size_t i = 0; i < npool; i++) {
+        if (!used[pool[i]]) {
+            used[pool[i]] = true;
+            return pool[i];
+        }
+    }
+    value_spill(ofp);
+    return reg_alloc(ofp);
+}
+
+void reg_free(size_t reg) {
+    used[reg] = false;
+    return;
+}
+
+void value_push(size_t reg) {
+    assert(nheld < NHELD);
+    held[nheld++] = reg;
+    return;
+}
+
+size_t value_pop(emitter_t *ofp) {
+    assert(nheld > 0);
+    if (nspill < nheld) {
+        return held[--nheld];
+    }
+    nheld--;
+    nspill--;
+    size_t reg = reg_alloc(ofp);
+    emit_pop(ofp, reg);
+    return reg;
+}
+
+/* Pushes the deepest value still in a register. */
+void value_spill(emitter_t *ofp) {
+    assert(nspill < nheld);
+    spilled = true;
+    emit_push(ofp, held[nspill]);
+    reg_free(held[nspill++]);
+    return;
+}
+
+void emit_label(emitter_t *ofp, char *label, size_t jmp) {
+    emitter_format(ofp, "%s%zu:\n", label, jmp);
+    return;
+}
+
+/* Nodes the parser synthesized have no position and keep the previous one. */
+void emit_loc(emitter_t *ofp, astree_t *ast) {
+    if (debug != NULL && ast->line != 0) {
+        emitter_format(ofp, "    .loc 1 %zu %zu\n", ast->line, ast->col);
+    }
+    return;
+}
+
+void emit_string(emitter_t *ofp, char *str) {
+    emitter_putc(ofp, '"');
+    for (; *str != '\0'; str++) {
+        if (*str == '"' || *str == '\\') {
+            emitter_putc(ofp, '\\');
+        }
+        emitter_putc(ofp, *str);
+    }
+    emitter_putc(ofp, '"');
+    return;
+}
+
+#ifdef __x86_64__
+static char *regname[][4] = {
+    {"%al", "%ax", "%eax", "%rax"},
+    {"%cl", "%cx", "%ecx", "%rcx"},
+    {"%dl", "%dx", "%edx", "%rdx"},
+    {"%bl", "%bx", "%ebx", "%rbx"},
+    {"%spl", "%sp", "%esp", "%rsp"},
+    {"%bpl", "%bp", "%ebp", "%rbp"},
+    {"%sil", "%si", "%esi", "%rsi"},
+    {"%dil", "%di", "%edi", "%rdi"},
+    {"%r8b", "%r8w", "%r8d", "%r8"},
+    {"%r9b", "%r9w", "%r9d", "%r9"},
+    {"%r10b", "%r10w", "%r10d", "%r10"},
+    {"%r11b", "%r11w", "%r11d", "%r11"},
+    {"%r12b", "%r12w", "%r12d", "%r12"},
+    {"%r13b", "%r13w", "%r13d", "%r13"},
+    {"%r14b", "%r14w", "%r14d", "%r14"},
+    {"%r15b", "%r15w", "%r15d", "%r15"},
+};
+static char movsfx[] = {'b', 'w', 'l', 'q'};
+
+#define FP (frameless ? "%rsp" : "%rbp")
+
+void emit_prologue(emitter_t *ofp, astree_t *ast) {
+    emitter_format(ofp, ".global %s\n", ast->def_id);
+    emitter_format(ofp, "%s:\n", ast->def_id);
+    if (debug != NULL) {
+        emitter_puts(ofp, "    .cfi_startproc\n");
+        emit_loc(ofp, ast);
+    }
+    if (!frameless) {
+        emitter_puts(ofp, "    pushq %rbp\n");
+        if (debug != NULL) {
+            emitter_puts(ofp, "    .cfi_def_cfa_offset 16\n");
+            emitter_puts(ofp, "    .cfi_offset %rbp, -16\n");
+        }
+        emitter_puts(ofp, "    movq %rsp, %rbp\n");
+        if (debug != NULL) {
+            emitter_puts(ofp, "    .cfi_def_cfa_register %rbp\n");
+        }
+        size_t size = ast->def_size;
+        for (; size > PAGESIZE; size -= PAGESIZE) {
+            emitter_format(ofp, "    subq $%d, %%rsp\n", PAGESIZE);
+            emitter_puts(ofp, "    orq $0, (%rsp)\n");
+        }
+        if (size > 0) {
+            emitter_format(ofp, "    subq $%zu, %%rsp\n", size);
+        }
+    }
+    for (size_t i = 0; i < ast->def_nreg; i++) {
+        emitter_format(ofp, "    movq %s, -%zu(%s)\n", regname[calleereg[i]][TY_LONG], 8 * (i + 1), FP);
+    }
+    return;
+}
+
+void emit_epilogue(emitter_t *ofp) {
+    for (size_t i = 0; i < func->def_nreg; i++) {
+        emitter_format(ofp, "    movq -%zu(%s), %s\n", 8 * (i + 1), FP, regname[calleereg[i]][TY_LONG]);
+    }
+    if (!frameless && optsize) {
+        emitter_puts(ofp, "    leave\n");
+    } else if (!frameless) {
+        emitter_puts(ofp, "    movq %rbp, %rsp\n");
+        emitter_puts(ofp, "    popq %rbp\n");
+    }
+    emitter_puts(ofp, "    ret\n");
+    return;
+}
+
+void emit_param(emitter_t *ofp, idlist_t *idl, size_t reg) {
+    if (idl->reg == 0) {
+        emit_store(ofp, reg, idl);
+        return;
+    }
+    size_t dst = calleereg[idl->reg - 1];
+    switch (idl->type) {
+    case TY_CHAR:
+        emitter_format(ofp, "    movsbl %s, %s\n", regname[reg][TY_CHAR], regname[dst][TY_INT]);
+        break;
+    case TY_SHORT:
+        emitter_format(ofp, "    movswl %s, %s\n", regname[reg][TY_SHORT], regname[dst][TY_INT]);
+        break;
+    case TY_INT:
+    case TY_LONG:
+        emit_store(ofp, reg, idl);
+        break;
+    default:
+        assert(false);
+    }
+    return;
+}
+
+/* Above the return address, and above the saved %rbp in a framed function. */
+void emit_inarg(emitter_t *ofp, size_t reg, size_t idx) {
+    emitter_format(ofp, "    movq %zu(%s), %s\n", (frameless ? 8 : 16) + 8 * idx, FP, regname[reg][TY_LONG]);
+    return;
+}
+
+/* depth is the number of pushes made since the area was reserved. */
+void emit_outarg(emitter_t *ofp, size_t reg, size_t idx, size_t depth) {
+    emitter_format(ofp, "    movq %s, %zu(%%rsp)\n", regname[reg][TY_LONG], 8 * (idx + depth));
+    return;
+}
+
+/* Returns the area in pushes, padded so the call lands 16-byte aligned. */
+size_t emit_reserve(emitter_t *ofp, size_t nslot, size_t depth) {
+    size_t area = nslot + (nslot + depth) % 2;
+    emitter_format(ofp, "    subq $%zu, %%rsp\n", 8 * area);
+    return area;
+}
+
+void emit_release(emitter_t *ofp, size_t area) {
+    emitter_format(ofp, "    addq $%zu, %%rsp\n", 8 * area);
+    return;
+}
+
+void emit_load(emitter_t *ofp, size_t reg, idlist_t *idl) {
+    if (idl->reg != 0) {
+        tykind_t type = idl->type == TY_LONG ? TY_LONG : TY_INT;
+        emitter_format(ofp, "    mov%c %s, %s\n", movsfx[type], regname[calleereg[idl->reg - 1]][type], regname[reg][type]);
+        return;
+    }
+    switch (idl->type) {
+    case TY_CHAR:
+        emitter_format(ofp, "    movsbl -%zu(%s), %s\n", idl->ofs, FP, regname[reg][TY_INT]);
+        break;
+    case TY_SHORT:
+        emitter_format(ofp, "    movswl -%zu(%s), %s\n", idl->ofs, FP, regname[reg][TY_INT]);
+        break;
+    case TY_INT:
+        emitter_format(ofp, "    movl -%zu(%s), %s\n", idl->ofs, FP, regname[reg][TY_INT]);
+        break;
+    case TY_LONG:
+        emitter_format(ofp, "    movq -%zu(%s), %s\n", idl->ofs, FP, regname[reg][TY_LONG]);
+        break;
+    default:
+        assert(false);
+    }
+    return;
+}
+
+void emit_store(emitter_t *ofp, size_t reg, idlist_t *idl) {
+    if (idl->reg != 0) {
+        tykind_t type = idl->type == TY_LONG ? TY_LONG : TY_INT;
+        emitter_format(ofp, "    mov%c %s, %s\n", movsfx[type], regname[reg][type], regname[calleereg[idl->reg - 1]][type]);
+        return;
+    }
+    emitter_format(ofp, "    mov%c %s, -%zu(%s)\n", movsfx[idl->type], regname[reg][idl->type], idl->ofs, FP);
+    return;
+}
+
+void emit_num(emitter_t *ofp, size_t reg, astree_t *ast) {
+    if (optsize && ast->num_val == 0) {
+        emitter_format(ofp, "    xorl %s, %s\n", regname[reg][TY_INT], regname[reg][TY_INT]);
+    } else if (ast->type != TY_LONG || (optsize && ast->num_val >= 0 && ast->num_val <= UINT32_MAX)) {
+        emitter_format(ofp, "    movl $%lld, %s\n", ast->num_val, regname[reg][TY_INT]);
+    } else if (ast->num_val == (int)ast->num_val) {
+        emitter_format(ofp, "    movq $%lld, %s\n", ast->num_val, regname[reg][TY_LONG]);
+    } else {
+        emitter_format(ofp, "    movabsq $%lld, %s\n", ast->num_val, regname[reg][TY_LONG]);
+    }
+    return;
+}
+
+void emit_bin(emitter_t *ofp, askind_t kind, tykind_t type, size_t dst, operand_t *src, bool sign) {
+    char sfx = movsfx[type];
+    char *d = regname[dst][type], *s = operand_name(src, type);
+    bool one = optsize && src->kind == NT_IMM && src->imm == 1;
+    switch (kind) {
+    case AS_ADD:
+        if (one) {
+            emitter_format(ofp, "    inc%c %s\n", sfx, d);
+        } else {
+            emitter_format(ofp, "    add%c %s, %s\n", sfx, s, d);
+        }
+        break;
+    case AS_SUB:
+        if (one) {
+            emitter_format(ofp, "    dec%c %s\n", sfx, d);
+        } else {
+            emitter_format(ofp, "    sub%c %s, %s\n", sfx, s, d);
+        }
+        break;
+    case AS_MUL:
+        emitter_format(ofp, "    imul%c %s, %s\n", sfx, s, d);
+        break;
+    case AS_DIV:
+    case AS_MOD:
+        assert(src->kind != NT_IMM);
+        emitter_format(ofp, "    mov%c %s, %s\n", sfx, d, regname[RAX][type]);
+        if (sign) {
+            emitter_puts(ofp, type == TY_LONG ? "    cqto\n" : "    cltd\n");
+        } else {
+            emitter_puts(ofp, "    xorl %edx, %edx\n");
+        }
+        emitter_format(ofp, "    %s%c %s\n", sign ? "idiv" : "div", sfx, s);
+        emitter_format(ofp, "    mov%c %s, %s\n", sfx, regname[kind == AS_DIV ? RAX : RDX][type], d);
+        break;
+    default:
+        assert(false);
+    }
+    return;
+}
+
+void emit_cmp(emitter_t *ofp, tykind_t type, operand_t *left, operand_t *right) {
+    char *l = operand_name(left, type);
+    if (optsize && right->kind == NT_IMM && right->imm == 0 && left->kind != NT_MEM) {
+        emitter_format(ofp, "    test%c %s, %s\n", movsfx[type], l, l);
+    } else {
+        emitter_format(ofp, "    cmp%c %s, %s\n", movsfx[type], operand_name(right, type), l);
+    }
+    return;
+}
+
+void emit_set(emitter_t *ofp, askind_t kind, size_t reg) {
+    static char *set[] = {"sete", "setne", "setl", "setle", "setg", "setge"};
+    emitter_format(ofp, "    %s %s\n", set[kind - AS_EQ], regname[reg][TY_CHAR]);
+    emitter_format(ofp, "    movzbl %s, %s\n", regname[reg][TY_CHAR], regname[reg][TY_INT]);
+    return;
+}
+
+void emit_lea(emitter_t *ofp, tykind_t type, size_t reg, operand_t *addr) {
+    emitter_format(ofp, "    lea%c %s, %s\n", movsfx[type], operand_name(addr, type), regname[reg][type]);
+    return;
+}
+
+void emit_cast(emitter_t *ofp, size_t reg, tykind_t from, tykind_t to) {
+    switch (to) {
+    case TY_CHAR:
+        emitter_format(ofp, "    movsbl %s, %s\n", regname[reg][TY_CHAR], regname[reg][TY_INT]);
+        break;
+    case TY_SHORT:
+        if (from != TY_CHAR) {
+            emitter_format(ofp, "    movswl %s, %s\n", regname[reg][TY_SHORT], regname[reg][TY_INT]);
+        }
+        break;
+    case TY_INT:
+        break;
+    case TY_LONG:
+        emitter_format(ofp, "    movslq %s, %s\n", regname[reg][TY_INT], regname[reg][TY_LONG]);
+        break;
+    default:
+        assert(false);
+    }
+    return;
+}
+
+void emit_mov(emitter_t *ofp, size_t dst, size_t src) {
+    if (dst != src) {
+        emitter_format(ofp, "    movq %s, %s\n", regname[src][TY_LONG], regname[dst][TY_LONG]);
+    }
+    return;
+}
+
+void emit_push(emitter_t *ofp, size_t reg) {
+    emitter_format(ofp, "    pushq %s\n", regname[reg][TY_LONG]);
+    return;
+}
+
+void emit_pop(emitter_t *ofp, size_t reg) {
+    emitter_format(ofp, "    popq %s\n", regname[reg][TY_LONG]);
+    return;
+}
+
+void emit_save(emitter_t *ofp, size_t *reg, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        emit_push(ofp, reg[i]);
+    }
+    return;
+}
+
+void emit_restore(emitter_t *ofp, size_t *reg, size_t len) {
+    for (size_t i = len; i > 0; i--) {
+        emit_pop(ofp, reg[i - 1]);
+    }
+    return;
+}
+
+void emit_call(emitter_t *ofp, astree_t *ast, size_t depth) {
+    if (depth % 2 == 1) {
+        emitter_puts(ofp, "    subq $8, %rsp\n");
+    }
+    if (ast->fnc_def == NULL) {
+        emitter_puts(ofp, optsize ? "    xorl %eax, %eax\n" : "    movl $0, %eax\n");
+    }
+    emitter_format(ofp, "    call %s\n", ast->fnc_id);
+    if (depth % 2 == 1) {
+        emitter_puts(ofp, "    addq $8, %rsp\n");
+    }
+    return;
+}
+
+void emit_ret(emitter_t *ofp, size_t reg) {
+    emit_mov(ofp, retreg, reg);
+    emit_epilogue(ofp);
+    return;
+}
+
+void emit_jump(emitter_t *ofp, char *label, size_t jmp) {
+    emitter_format(ofp, "    jmp %s%zu\n", label, jmp);
+    return;
+}
+
+void emit_jzero(emitter_t *ofp, size_t reg, tykind_t type, char *label, size_t jmp) {
+    emitter_format(ofp, "    test%c %s, %s\n", movsfx[type], regname[reg][type], regname[reg][type]);
+    emitter_format(ofp, "    je %s%zu\n", label, jmp);
+    return;
+}
+
+void emit_jnzero(emitter_t *ofp, size_t reg, tykind_t type, char *label, size_t jmp) {
+    emitter_format(ofp, "    test%c %s, %s\n", movsfx[type], regname[reg][type], regname[reg][type]);
+    emitter_format(ofp, "    jne %s%zu\n", label, jmp);
+    return;
+}
+
+void emit_jcc(emitter_t *ofp, askind_t kind, char *label, size_t jmp) {
+    static char *jcc[] = {"jne", "je", "jge", "jg", "jle", "jl"};
+    emitter_format(ofp, "    %s %s%zu\n", jcc[kind - AS_EQ], label, jmp);
+    return;
+}
+
+void emit_count(emitter_t *ofp, size_t jmp, size_t side) {
+    if (instrument != NULL) {
+        emitter_format(ofp, "    incq .Lprof+%zu(%%rip)\n", 24 * jmp + 8 * (side + 1));
+    }
+    return;
+}
+
+void emit_dump(emitter_t *ofp) {
+    emitter_puts(ofp, ".Lprofdump:\n");
+    emitter_puts(ofp, "    pushq %rbx\n");
+    emitter_puts(ofp, "    leaq .Lprofpath(%rip), %rdi\n");
+    emitter_format(ofp, "    movl $%d, %%esi\n", O_WRONLY | O_CREAT | O_APPEND);
+    emitter_puts(ofp, "    movl $420, %edx\n");
+    emitter_puts(ofp, "    movl $0, %eax\n");
+    emitter_puts(ofp, "    call open\n");
+    emitter_puts(ofp, "    movl %eax, %ebx\n");
+    emitter_puts(ofp, "    testl %eax, %eax\n");
+    emitter_puts(ofp, "    js .Lprofdone\n");
+    emitter_puts(ofp, "    movl %eax, %edi\n");
+    emitter_puts(ofp, "    leaq .Lprof(%rip), %rsi\n");
+    emitter_puts(ofp, "    leaq .Lprofend(%rip), %rdx\n");
+    emitter_puts(ofp, "    subq %rsi, %rdx\n");
+    emitter_puts(ofp, "    call write\n");
+    emitter_puts(ofp, "    movl %ebx, %edi\n");
+    emitter_puts(ofp, "    call close\n");
+    emitter_puts(ofp, ".Lprofdone:\n");
+    emitter_puts(ofp, "    popq %rbx\n");
+    emitter_puts(ofp, "    ret\n");
+    return;
+}
+
+char *operand_name(operand_t *op, tykind_t type) {
+    static _Thread_local char name[4][64];
+    static _Thread_local size_t n;
+    char *s = name[n++ % 4];
+    switch (op->kind) {
+    case NT_REG:
+        snprintf(s, sizeof(name[0]), "%s", regname[op->reg][type]);
+        break;
+    case NT_IMM:
+        snprintf(s, sizeof(name[0]), "$%lld", op->imm);
+        break;
+    case NT_MEM:
+        snprintf(s, sizeof(name[0]), "-%zu(%s)", op->idl->ofs, FP);
+        break;
+    case NT_RVAR:
+        snprintf(s, sizeof(name[0]), "%s", regname[calleereg[op->idl->reg - 1]][type]);
+        break;
+    case NT_INDEX:
+    case NT_SUM:
+    case NT_ADDR:
+        snprintf(s, sizeof(name[0]), "%lld(%s,%s,%lld)", op->imm, op->base ? regname[op->reg][TY_LONG] : "", regname[op->idx][TY_LONG], op->scale);
+        break;
+    default:
+        assert(false);
+    }
+    return s;
+}
+
+bool burs_imm(astree_t *ast) {
+    return ast->num_val >= INT_MIN && ast->num_val <= INT_MAX;
+}
+
+bool burs_mem(astree_t *ast) {
+    return ast->var_idl->reg == 0 && ast->var_idl->type >= TY_INT;
+}
+
+bool burs_scale(astree_t *ast) {
+    long long val = ast->bin_right->num_val;
+    return ast->bin_right->kind == AS_NUM && (val == 2 || val == 4 || val == 8);
+}
+
+bool burs_scalel(astree_t *ast) {
+    long long val = ast->bin_left->num_val;
+    return ast->bin_left->kind == AS_NUM && (val == 2 || val == 4 || val == 8);
+}
+
+bool burs_neg(astree_t *ast) {
+    return ast->bin_right->num_val != INT_MIN;
+}
+#elif __aarch64__
+#define R(n) {"w" #n, "x" #n}
+
+static char *regname[][2] = {
+    R(0), R(1), R(2), R(3), R(4), R(5), R(6), R(7),
+    R(8), R(9), R(10), R(11), R(12), R(13), R(14), R(15),
+    R(16), R(17), R(18), R(19), R(20), R(21), R(22), R(23),
+    R(24), R(25), R(26), R(27), R(28), R(29), R(30),
+};
+
+#define W(reg) regname[reg][0]
+#define X(reg) regname[reg][1]
+#define REG(reg, type) regname[reg][(type) == TY_LONG]
+
+static char *emit_slot(emitter_t *, size_t);
+static int scale_shift(long long);
+
+
+void emit_prologue(emitter_t *ofp, astree_t *ast) {
+    emitter_format(ofp, ".global %s\n", ast->def_id);
+    emitter_format(ofp, "%s:\n", ast->def_id);
+    if (debug != NULL) {
+        emitter_puts(ofp, "    .cfi_startproc\n");
+        emit_loc(ofp, ast);
+    }
+    if (!frameless) {
+        emitter_puts(ofp, "    stp x29, x30, [sp, #-16]!\n");
+        if (debug != NULL) {
+            emitter_puts(ofp, "    .cfi_def_cfa_offset 16\n");
+            emitter_puts(ofp, "    .cfi_offset 29, -16\n");
+            emitter_puts(ofp, "    .cfi_offset 30, -8\n");
+        }
+        emitter_puts(ofp, "    mov x29, sp\n");
+        if (debug != NULL) {
+            emitter_puts(ofp, "    .cfi_def_cfa_register 29\n");
+        }
+    }
+    size_t size = ast->def_size;
+    for (; size > PAGESIZE; size -= PAGESIZE) {
+        emitter_format(ofp, "    sub sp, sp, #%d\n", PAGESIZE);
+        emitter_puts(ofp, "    str xzr, [sp]\n");
+    }
+    if (size > 0) {
+        emitter_format(ofp, "    sub sp, sp, #%zu\n", size);
+        if (debug != NULL && frameless) {
+            emitter_format(ofp, "    .cfi_def_cfa_offset %zu\n", ast->def_size);
+        }
+    }
+    for (size_t i = 0; i < ast->def_nreg; i += 2) {
+        if (i + 1 < ast->def_nreg) {
+            emitter_format(ofp, "    stp %s, %s, %s\n", X(calleereg[i + 1]), X(calleereg[i]), emit_slot(ofp, 8 * (i + 2)));
+        } else {
+            emitter_format(ofp, "    str %s, %s\n", X(calleereg[i]), emit_slot(ofp, 8 * (i + 1)));
+        }
+    }
+    return;
+}
+
+void emit_epilogue(emitter_t *ofp) {
+    for (size_t i = 0; i < func->def_nreg; i += 2) {
+        if (i + 1 < func->def_nreg) {
+            emitter_format(ofp, "    ldp %s, %s, %s\n", X(calleereg[i + 1]), X(calleereg[i]), emit_slot(ofp, 8 * (i + 2)));
+        } else {
+            emitter_format(ofp, "    ldr %s, %s\n", X(calleereg[i]), emit_slot(ofp, 8 * (i + 1)));
+        }
+    }
+    if (frameless && func->def_size > 0) {
+        emitter_format(ofp, "    add sp, sp, #%zu\n", func->def_size);
+    } else if (!frameless) {
+        emitter_puts(ofp, "    mov sp, x29\n");
+        emitter_puts(ofp, "    ldp x29, x30, [sp], #16\n");
+    }
+    emitter_puts(ofp, "    ret\n");
+    return;
+}
+
+void emit_param(emitter_t *ofp, idlist_t *idl, size_t reg) {
+    if (idl->reg == 0) {
+        emit_store(ofp, reg, idl);
+        return;
+    }
+    size_t dst = calleereg[idl->reg - 1];
+    switch (idl->type) {
+    case TY_CHAR:
+        emitter_format(ofp, "    sxtb %s, %s\n", W(dst), W(reg));
+        break;
+    case TY_SHORT:
+        emitter_format(ofp, "    sxth %s, %s\n", W(dst), W(reg));
+        break;
+    case TY_INT:
+    case TY_LONG:
+        emit_store(ofp, reg, idl);
+        break;
+    default:
+        assert(false);
+    }
+    return;
+}
+
+/* Above the saved frame record, or above the locals in a frameless leaf. */
+void emit_inarg(emitter_t *ofp, size_t reg, size_t idx) {
+    if (frameless) {
+        emitter_format(ofp, "    ldr %s, [sp, #%zu]\n", X(reg), func->def_size + 8 * idx);
+    } else {
+        emitter_format(ofp, "    ldr %s, [x29, #%zu]\n", X(reg), 16 + 8 * idx);
+    }
+    return;
+}
+
+/* depth is the number of 16-byte pushes made since the area was reserved. */
+void emit_outarg(emitter_t *ofp, size_t reg, size_t idx, size_t depth) {
+    emitter_format(ofp, "    str %s, [sp, #%zu]\n", X(reg), 8 * idx + 16 * depth);
+    return;
+}
+
+/* Returns the area in 8-byte slots, rounded to keep sp 16-byte aligned. */
+size_t emit_reserve(emitter_t *ofp, size_t nslot, size_t depth) {
+    (void)depth;
+    size_t area = (nslot + 1) / 2 * 2;
+    emitter_format(ofp, "    sub sp, sp, #%zu\n", 8 * area);
+    return area;
+}
+
+void emit_release(emitter_t *ofp, size_t area) {
+    emitter_format(ofp, "    add sp, sp, #%zu\n", 8 * area);
+    return;
+}
+
+void emit_load(emitter_t *ofp, size_t reg, idlist_t *idl) {
+    if (idl->reg != 0) {
+        emitter_format(ofp, "    mov %s, %s\n", REG(reg, idl->type), REG(calleereg[idl->reg - 1], idl->type));
+        return;
+    }
+    char *slot = emit_slot(ofp, idl->ofs);
+    switch (idl->type) {
+    case TY_CHAR:
+        emitter_format(ofp, "    ldrsb %s, %s\n", W(reg), slot);
+        break;
+    case TY_SHORT:
+        emitter_format(ofp, "    ldrsh %s, %s\n", W(reg), slot);
+        break;
+    case TY_INT:
+        emitter_format(ofp, "    ldr %s, %s\n", W(reg), slot);
+        break;
+    case TY_LONG:
+        emitter_format(ofp, "    ldr %s, %s\n", X(reg), slot);
+        break;
+    default:
+        assert(false);
+    }
+    return;
+}
+
+void emit_store(emitter_t *ofp, size_t reg, idlist_t *idl) {
+    if (idl->reg != 0) {
+        emitter_format(ofp, "    mov %s, %s\n", REG(calleereg[idl->reg - 1], idl->type), REG(reg, idl->type));
+        return;
+    }
+    char *slot = emit_slot(ofp, idl->ofs);
+    switch (idl->type) {
+    case TY_CHAR:
+        emitter_format(ofp, "    strb %s, %s\n", W(reg), slot);
+        break;
+    case TY_SHORT:
+        emitter_format(ofp, "    strh %s, %s\n", W(reg), slot);
+        break;
+    case TY_INT:
+        emitter_format(ofp, "    str %s, %s\n", W(reg), slot);
+        break;
+    case TY_LONG:
+        emitter_format(ofp, "    str %s, %s\n", X(reg), slot);
+        break;
+    default:
+        assert(false);
+    }
+    return;
+}
+
+void emit_num(emitter_t *ofp, size_t reg, astree_t *ast) {
+    size_t nhalf = ast->type == TY_LONG ? 4 : 2;
+    uint64_t val = (uint64_t)ast->num_val;
+    size_t nzero = 0, nones = 0;
+    for (size_t i = 0; i < nhalf; i++) {
+        nzero += (val >> 16 * i & 0xffff) == 0;
+        nones += (val >> 16 * i & 0xffff) == 0xffff;
+    }
+    unsigned fill = nones > nzero ? 0xffff : 0;
+    char *r = REG(reg, ast->type);
+    bool first = true;
+    for (size_t i = 0; i < nhalf; i++) {
+        unsigned half = val >> 16 * i & 0xffff;
+        if (half == fill && (i > 0 || (nzero < nhalf && nones < nhalf))) {
+            continue;
+        }
+        if (first && fill != 0) {
+            emitter_format(ofp, "    movn %s, #%u", r, ~half & 0xffff);
+        } else {
+            emitter_format(ofp, "    %s %s, #%u", first ? "movz" : "movk", r, half);
+        }
+        if (i > 0) {
+            emitter_format(ofp, ", lsl #%zu", 16 * i);
+        }
+        emitter_putc(ofp, '\n');
+        first = false;
+    }
+    return;
+}
+
+void emit_bin(emitter_t *ofp, askind_t kind, tykind_t type, size_t dst, operand_t *src, bool sign) {
+    char *d = REG(dst, type), *s = operand_name(src, type), *t = REG(16, type);
+    switch (kind) {
+    case AS_ADD:
+        if (src->kind == NT_PROD) {
+            emitter_format(ofp, "    madd %s, %s, %s\n", d, s, d);
+        } else {
+            emitter_format(ofp, "    add %s, %s, %s\n", d, d, s);
+        }
+        break;
+    case AS_SUB:
+        if (src->kind == NT_PROD) {
+            emitter_format(ofp, "    msub %s, %s, %s\n", d, s, d);
+        } else {
+            emitter_format(ofp, "    sub %s, %s, %s\n", d, d, s);
+        }
+        break;
+    case AS_MUL:
+        emitter_format(ofp, "    mul %s, %s, %s\n", d, d, s);
+        break;
+    case AS_DIV:
+        emitter_format(ofp, "    %s %s, %s, %s\n", sign ? "sdiv" : "udiv", d, d, s);
+        break;
+    case AS_MOD:
+        emitter_format(ofp, "    %s %s, %s, %s\n", sign ? "sdiv" : "udiv", t, d, s);
+        emitter_format(ofp, "    msub %s, %s, %s, %s\n", d, t, s, d);
+        break;
+    default:
+        assert(false);
+    }
+    return;
+}
+
+void emit_cmp(emitter_t *ofp, tykind_t type, operand_t *left, operand_t *right) {
+    emitter_format(ofp, "    cmp %s, %s\n", operand_name(left, type), operand_name(right, type));
+    return;
+}
+
+void emit_set(emitter_t *ofp, askind_t kind, size_t reg) {
+    static char *cond[] = {"eq", "ne", "lt", "le", "gt", "ge"};
+    emitter_format(ofp, "    cset %s, %s\n", W(reg), cond[kind - AS_EQ]);
+    return;
+}
+
+void emit_lea(emitter_t *ofp, tykind_t type, size_t reg, operand_t *addr) {
+    assert(addr->kind == NT_INDEX);
+    emitter_format(ofp, "    lsl %s, %s, #%d\n", REG(reg, type), REG(addr->idx, type), scale_shift(addr->scale));
+    return;
+}
+
+void emit_cast(emitter_t *ofp, size_t reg, tykind_t from, tykind_t to) {
+    switch (to) {
+    case TY_CHAR:
+        emitter_format(ofp, "    sxtb %s, %s\n", W(reg), W(reg));
+        break;
+    case TY_SHORT:
+        if (from != TY_CHAR) {
+            emitter_format(ofp, "    sxth %s, %s\n", W(reg), W(reg));
+        }
+        break;
+    case TY_INT:
+        break;
+    case TY_LONG:
+        emitter_format(ofp, "    sxtw %s, %s\n", X(reg), W(reg));
+        break;
+    default:
+        assert(false);
+    }
+    return;
+}
+
+void emit_mov(emitter_t *ofp, size_t dst, size_t src) {
+    if (dst != src) {
+        emitter_format(ofp, "    mov %s, %s\n", X(dst), X(src));
+    }
+    return;
+}
+
+void emit_push(emitter_t *ofp, size_t reg) {
+    emitter_format(ofp, "    str %s, [sp, #-16]!\n", X(reg));
+    return;
+}
+
+void emit_pop(emitter_t *ofp, size_t reg) {
+    emitter_format(ofp, "    ldr %s, [sp], #16\n", X(reg));
+    return;
+}
+
+void emit_save(emitter_t *ofp, size_t *reg, size_t len) {
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        emitter_format(ofp, "    stp %s, %s, [sp, #-16]!\n", X(reg[i]), X(reg[i + 1]));
+    }
+    if (len % 2 != 0) {
+        emit_push(ofp, reg[len - 1]);
+    }
+    return;
+}
+
+void emit_restore(emitter_t *ofp, size_t *reg, size_t len) {
+    if (len % 2 != 0) {
+        emit_pop(ofp, reg[len - 1]);
+    }
+    for (size_t i = len / 2 * 2; i > 0; i -= 2) {
+        emitter_format(ofp, "    ldp %s, %s, [sp], #16\n", X(reg[i - 2]), X(reg[i - 1]));
+    }
+    return;
+}
+
+void emit_call(emitter_t *ofp, astree_t *ast, size_t depth) {
+    (void)depth;
+    emitter_format(ofp, "    bl %s\n", ast->fnc_id);
+    return;
+}
+
+void emit_ret(emitter_t *ofp, size_t reg) {
+    emit_mov(ofp, retreg, reg);
+    emit_epilogue(ofp);
+    return;
+}
+
+void emit_jump(emitter_t *ofp, char *label, size_t jmp) {
+    emitter_format(ofp, "    b %s%zu\n", label, jmp);
+    return;
+}
+
+void emit_jzero(emitter_t *ofp, size_t reg, tykind_t type, char *label, size_t jmp) {
+    emitter_format(ofp, "    cbz %s, %s%zu\n", REG(reg, type), label, jmp);
+    return;
+}
+
+void emit_jnzero(emitter_t *ofp, size_t reg, tykind_t type, char *label, size_t jmp) {
+    emitter_format(ofp, "    cbnz %s, %s%zu\n", REG(reg, type), label, jmp);
+    return;
+}
+
+void emit_jcc(emitter_t *ofp, askind_t kind, char *label, size_t jmp) {
+    static char *cond[] = {"ne", "eq", "ge", "gt", "le", "lt"};
+    emitter_format(ofp, "    b.%s %s%zu\n", cond[kind - AS_EQ], label, jmp);
+    return;
+}
+
+void emit_count(emitter_t *ofp, size_t jmp, size_t side) {
+    if (instrument != NULL) {
+        size_t ofs = 24 * jmp + 8 * (side + 1);
+        emitter_format(ofp, "    adrp x16, .Lprof+%zu\n", ofs);
+        emitter_format(ofp, "    add x16, x16, :lo12:.Lprof+%zu\n", ofs);
+        emitter_puts(ofp, "    ldr x17, [x16]\n");
+        emitter_puts(ofp, "    add x17, x17, #1\n");
+        emitter_puts(ofp, "    str x17, [x16]\n");
+    }
+    return;
+}
+
+void emit_dump(emitter_t *ofp) {
+    emitter_puts(ofp, ".Lprofdump:\n");
+    emitter_puts(ofp, "    stp x29, x30, [sp, #-16]!\n");
+    emitter_puts(ofp, "    stp x19, x20, [sp, #-16]!\n");
+    emitter_puts(ofp, "    adrp x0, .Lprofpath\n");
+    emitter_puts(ofp, "    add x0, x0, :lo12:.Lprofpath\n");
+    emitter_format(ofp, "    mov w1, #%d\n", O_WRONLY | O_CREAT | O_APPEND);
+    emitter_puts(ofp, "    mov w2, #420\n");
+    emitter_puts(ofp, "    bl open\n");
+    emitter_puts(ofp, "    mov w19, w0\n");
+    emitter_puts(ofp, "    tbnz w0, #31, .Lprofdone\n");
+    emitter_puts(ofp, "    adrp x1, .Lprof\n");
+    emitter_puts(ofp, "    add x1, x1, :lo12:.Lprof\n");
+    emitter_puts(ofp, "    adrp x2, .Lprofend\n");
+    emitter_puts(ofp, "    add x2, x2, :lo12:.Lprofend\n");
+    emitter_puts(ofp, "    sub x2, x2, x1\n");
+    emitter_puts(ofp, "    bl write\n");
+    emitter_puts(ofp, "    mov w0, w19\n");
+    emitter_puts(ofp, "    bl close\n");
+    emitter_puts(ofp, ".Lprofdone:\n");
+    emitter_puts(ofp, "    ldp x19, x20, [sp], #16\n");
+    emitter_puts(ofp, "    ldp x29, x30, [sp], #16\n");
+    emitter_puts(ofp, "    ret\n");
+    return;
+}
+
+char *operand_name(operand_t *op, tykind_t type) {
+    static _Thread_local char name[4][64];
+    static _Thread_local size_t n;
+    char *s = name[n++ % 4];
+    switch (op->kind) {
+    case NT_REG:
+        snprintf(s, sizeof(name[0]), "%s", REG(op->reg, type));
+        break;
+    case NT_IMM:
+        snprintf(s, sizeof(name[0]), "#%lld", op->imm);
+        break;
+    case NT_RVAR:
+        snprintf(s, sizeof(name[0]), "%s", REG(calleereg[op->idl->reg - 1], type));
+        break;
+    case NT_INDEX:
+        snprintf(s, sizeof(name[0]), "%s, lsl #%d", REG(op->idx, type), scale_shift(op->scale));
+        break;
+    case NT_PROD:
+        snprintf(s, sizeof(name[0]), "%s, %s", REG(op->reg, type), REG(op->idx, type));
+        break;
+    default:
+        assert(false);
+    }
+    return s;
+}
+
+bool burs_imm(astree_t *ast) {
+    long long val = ast->num_val;
+    return val >= 0 && (val <= 0xfff || (val <= 0xfff000 && (val & 0xfff) == 0));
+}
+
+bool burs_scale(astree_t *ast) {
+    long long val = ast->bin_right->num_val;
+    return ast->bin_right->kind == AS_NUM && val >= 2 && (val & (val - 1)) == 0;
+}
+
+bool burs_scalel(astree_t *ast) {
+    long long val = ast->bin_left->num_val;
+    return ast->bin_left->kind == AS_NUM && val >= 2 && (val & (val - 1)) == 0;
+}
+
+int scale_shift(long long scale) {
+    int shift = 0;
+    while ((1LL << shift) < scale) {
+        shift++;
+    }
+    return shift;
+}
+
+char *emit_slot(emitter_t *ofp, size_t ofs) {
+    static _Thread_local char slot[32];
+    if (frameless) {
+        snprintf(slot, sizeof(slot), "[sp, #%zu]", func->def_size - ofs);
+        return slot;
+    }
+    if (ofs <= 256) {
+        snprintf(slot, sizeof(slot), "[x29, #-%zu]", ofs);
+        return slot;
+    }
+    emitter_format(ofp, "    movz x16, #%zu\n", ofs & 0xffff);
+    if (ofs >> 16 != 0) {
+        emitter_format(ofp, "    movk x16, #%zu, lsl #16\n", ofs >> 16 & 0xffff);
+    }
+    emitter_puts(ofp, "    sub x16, x29, x16\n");
+    snprintf(slot, sizeof(slot), "[x16]");
+    return slot;
+}
 #else
 #error
 #endif
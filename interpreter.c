@@ -0,0 +1,739 @@
+#include <assert.h>
+#include <dlfcn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+
+#define VM_NONE SIZE_MAX
+#define VM_STACK (1 << 20)
+#define VM_DEPTH (1 << 16)
+#define VM_NARG 8
+
+typedef enum {
+    VM_LOADK,
+    VM_MOV,
+    VM_ADDW,
+    VM_ADDL,
+    VM_ADDKW,
+    VM_ADDKL,
+    VM_SUBW,
+    VM_SUBL,
+    VM_MULW,
+    VM_MULL,
+    VM_DIVW,
+    VM_DIVL,
+    VM_MODW,
+    VM_MODL,
+    VM_SEXT8,
+    VM_SEXT16,
+    VM_SEXT32,
+    VM_EQ,
+    VM_NE,
+    VM_LT,
+    VM_LE,
+    VM_GT,
+    VM_GE,
+    VM_JMP,
+    VM_JZ,
+    VM_JNZ,
+    VM_JEQ,
+    VM_JNE,
+    VM_JLT,
+    VM_JLE,
+    VM_JGT,
+    VM_JGE,
+    VM_JEQK,
+    VM_JNEK,
+    VM_JLTK,
+    VM_JLEK,
+    VM_JGTK,
+    VM_JGEK,
+    VM_CALL,
+    VM_CALLX,
+    VM_RET,
+} vmop_t;
+
+/* Three-address code over a per-call register window; c doubles as the branch
+   target, callee or builtin index, and go is the handler address filled in
+   just before execution. */
+typedef struct {
+    const void *go;
+    uint16_t op;
+    uint16_t a;
+    uint16_t b;
+    uint32_t c;
+    long long imm;
+} vminsn_t;
+
+typedef struct {
+    astree_t *def;
+    size_t entry;
+    size_t nreg;
+    size_t nparam;
+} vmfunc_t;
+
+typedef struct {
+    char *name;
+    long long (*fn)(long long *);
+    void *addr;
+} vmextern_t;
+
+typedef struct {
+    vminsn_t *pc;
+    long long *reg;
+    size_t dst;
+} vmframe_t;
+
+int interpreter(astree_t *);
+static void lower_def(vmfunc_t *);
+static void lower_stmt(astree_t *);
+static size_t lower_cond(astree_t *, bool);
+static size_t lower_expr(astree_t *, size_t);
+static size_t lower_left(astree_t *, astree_t *);
+static size_t lower_call(astree_t *, size_t);
+static size_t lower_dst(size_t);
+static bool lower_hasasg(astree_t *);
+static size_t emit(vmop_t, size_t, size_t, size_t, long long);
+static size_t func_find(astree_t *);
+static size_t extern_find(char *);
+static long long vm_run(size_t);
+static long long vm_extern(vmextern_t *, long long *);
+static long long builtin_putchar(long long *);
+static long long builtin_getchar(long long *);
+static long long builtin_abs(long long *);
+static long long builtin_labs(long long *);
+static long long builtin_exit(long long *);
+
+static vminsn_t *code;
+static size_t ncode;
+static size_t ccode;
+static vmfunc_t *func;
+static size_t nfunc;
+static vmextern_t *ext;
+static size_t next;
+static size_t cext;
+static size_t nvar;
+static size_t top;
+static size_t maxtop;
+
+static vmextern_t builtin[] = {
+    {"putchar", builtin_putchar, NULL},
+    {"getchar", builtin_getchar, NULL},
+    {"abs", builtin_abs, NULL},
+    {"labs", builtin_labs, NULL},
+    {"exit", builtin_exit, NULL},
+};
+
+static size_t nbuiltin = sizeof(builtin) / sizeof(*builtin);
+
+int interpreter(astree_t *ast) {
+    for (astree_t *def = ast; def != NULL; def = def->def_next) {
+        nfunc++;
+    }
+    func = calloc(nfunc + 1, sizeof(vmfunc_t));
+    assert(func != NULL);
+    size_t entry = VM_NONE;
+    nfunc = 0;
+    for (astree_t *def = ast; def != NULL; def = def->def_next) {
+        if (strcmp(def->def_id, "main") == 0 && !def->def_proto) {
+            entry = nfunc;
+        }
+        func[nfunc++].def = def;
+    }
+    assert(entry != VM_NONE);
+    for (size_t i = 0; i < nfunc; i++) {
+        if (!func[i].def->def_proto) {
+            lower_def(&func[i]);
+        }
+    }
+    long long status = vm_run(entry);
+    free(code);
+    free(func);
+    free(ext);
+    code = NULL;
+    func = NULL;
+    ext = NULL;
+    ncode = ccode = nfunc = next = cext = 0;
+    return (int)status;
+}
+
+/* Locals live in registers 0..nvar-1 by their idlist index, so parameters,
+   declared first, arrive in 0..nparam-1; temporaries are stacked above. */
+void lower_def(vmfunc_t *fn) {
+    astree_t *def = fn->def;
+    nvar = def->def_local != NULL ? def->def_local->idx + 1 : 0;
+    top = maxtop = nvar;
+    fn->entry = ncode;
+    for (astree_t *param = def->def_param; param != NULL; param = param->arg_next) {
+        fn->nparam++;
+    }
+    lower_stmt(def->def_body);
+    size_t zero = lower_dst(VM_NONE);
+    emit(VM_LOADK, zero, 0, 0, 0);
+    emit(VM_RET, zero, 0, 0, 0);
+    fn->nreg = maxtop;
+    return;
+}
+
+/* Loops are rotated so that each iteration runs a single fused
+   compare-and-branch at the bottom. */
+void lower_stmt(astree_t *ast) {
+    if (ast == NULL) {
+        return;
+    }
+    switch (ast->kind) {
+    case AS_BLK:
+        lower_stmt(ast->blk_body);
+        lower_stmt(ast->blk_next);
+        break;
+    case AS_IF: {
+        size_t skip = lower_cond(ast->if_cond, false);
+        lower_stmt(ast->if_then);
+        if (ast->if_else != NULL) {
+            size_t join = emit(VM_JMP, 0, 0, 0, 0);
+            code[skip].c = ncode;
+            lower_stmt(ast->if_else);
+            code[join].c = ncode;
+        } else {
+            code[skip].c = ncode;
+        }
+        break;
+    }
+    case AS_WHILE: {
+        size_t enter = emit(VM_JMP, 0, 0, 0, 0);
+        size_t body = ncode;
+        lower_stmt(ast->while_body);
+        code[enter].c = ncode;
+        size_t back = lower_cond(ast->while_cond, true);
+        code[back].c = body;
+        break;
+    }
+    case AS_FOR: {
+        lower_stmt(ast->for_init);
+        size_t enter = emit(VM_JMP, 0, 0, 0, 0);
+        size_t body = ncode;
+        lower_stmt(ast->for_body);
+        lower_stmt(ast->for_step);
+        code[enter].c = ncode;
+        if (ast->for_cond != NULL) {
+            size_t back = lower_cond(ast->for_cond, true);
+            code[back].c = body;
+        } else {
+            emit(VM_JMP, 0, 0, body, 0);
+        }
+        break;
+    }
+    case AS_RET:
+        emit(VM_RET, lower_expr(ast->ret_val, VM_NONE), 0, 0, 0);
+        break;
+    default:
+        lower_expr(ast, VM_NONE);
+        break;
+    }
+    top = nvar;
+    return;
+}
+
+/* Emits a branch taken when the condition equals sense and returns its index
+   so the caller can fill in the target. */
+size_t lower_cond(astree_t *ast, bool sense) {
+    static vmop_t jump[][2] = {
+        [AS_EQ] = {VM_JNE, VM_JEQ},
+        [AS_NE] = {VM_JEQ, VM_JNE},
+        [AS_LT] = {VM_JGE, VM_JLT},
+        [AS_LE] = {VM_JGT, VM_JLE},
+        [AS_GT] = {VM_JLE, VM_JGT},
+        [AS_GE] = {VM_JLT, VM_JGE},
+    };
+    size_t mark = top, idx;
+    switch (ast->kind) {
+    case AS_EQ:
+    case AS_NE:
+    case AS_LT:
+    case AS_LE:
+    case AS_GT:
+    case AS_GE: {
+        size_t left = lower_left(ast->bin_left, ast->bin_right);
+        if (ast->bin_right->kind == AS_NUM) {
+            idx = emit(jump[ast->kind][sense] + VM_JEQK - VM_JEQ, left, 0, 0, ast->bin_right->num_val);
+        } else {
+            idx = emit(jump[ast->kind][sense], left, lower_expr(ast->bin_right, VM_NONE), 0, 0);
+        }
+        break;
+    }
+    default:
+        idx = emit(sense ? VM_JNZ : VM_JZ, lower_expr(ast, VM_NONE), 0, 0, 0);
+        break;
+    }
+    top = mark;
+    return idx;
+}
+
+/* Evaluates ast into dst, or into whatever register already holds it when dst
+   is VM_NONE, and returns that register. */
+size_t lower_expr(astree_t *ast, size_t dst) {
+    size_t mark = top, src;
+    switch (ast->kind) {
+    case AS_NUM:
+        dst = lower_dst(dst);
+        emit(VM_LOADK, dst, 0, 0, ast->num_val);
+        break;
+    case AS_VAR:
+        src = ast->var_idl->idx;
+        if (dst == VM_NONE) {
+            return src;
+        }
+        if (dst != src) {
+            emit(VM_MOV, dst, src, 0, 0);
+        }
+        break;
+    case AS_ASG:
+        src = ast->bin_left->var_idl->idx;
+        lower_expr(ast->bin_right, src);
+        if (dst == VM_NONE) {
+            return src;
+        }
+        if (dst != src) {
+            emit(VM_MOV, dst, src, 0, 0);
+        }
+        break;
+    case AS_CAST:
+        src = lower_expr(ast->cast_val, VM_NONE);
+        if (ast->type >= ast->cast_val->type && dst == VM_NONE) {
+            return src;
+        }
+        top = mark;
+        dst = lower_dst(dst);
+        if (ast->type < ast->cast_val->type) {
+            emit(ast->type == TY_CHAR ? VM_SEXT8 : ast->type == TY_SHORT ? VM_SEXT16 : VM_SEXT32, dst, src, 0, 0);
+        } else if (dst != src) {
+            emit(VM_MOV, dst, src, 0, 0);
+        }
+        break;
+    case AS_ADD:
+    case AS_SUB:
+    case AS_MUL:
+    case AS_DIV:
+    case AS_MOD:
+    case AS_EQ:
+    case AS_NE:
+    case AS_LT:
+    case AS_LE:
+    case AS_GT:
+    case AS_GE: {
+        static vmop_t op[][2] = {
+            [AS_ADD] = {VM_ADDW, VM_ADDL},
+            [AS_SUB] = {VM_SUBW, VM_SUBL},
+            [AS_MUL] = {VM_MULW, VM_MULL},
+            [AS_DIV] = {VM_DIVW, VM_DIVL},
+            [AS_MOD] = {VM_MODW, VM_MODL},
+            [AS_EQ] = {VM_EQ, VM_EQ},
+            [AS_NE] = {VM_NE, VM_NE},
+            [AS_LT] = {VM_LT, VM_LT},
+            [AS_LE] = {VM_LE, VM_LE},
+            [AS_GT] = {VM_GT, VM_GT},
+            [AS_GE] = {VM_GE, VM_GE},
+        };
+        bool wide = ast->type == TY_LONG;
+        src = lower_left(ast->bin_left, ast->bin_right);
+        if ((ast->kind == AS_ADD || ast->kind == AS_SUB) && ast->bin_right->kind == AS_NUM) {
+            unsigned long long imm = ast->bin_right->num_val;
+            top = mark;
+            dst = lower_dst(dst);
+            emit(wide ? VM_ADDKL : VM_ADDKW, dst, src, 0, ast->kind == AS_ADD ? (long long)imm : (long long)(0 - imm));
+            break;
+        }
+        size_t right = lower_expr(ast->bin_right, VM_NONE);
+        top = mark;
+        dst = lower_dst(dst);
+        emit(op[ast->kind][wide], dst, src, right, 0);
+        break;
+    }
+    case AS_FNC:
+        dst = lower_call(ast, dst);
+        break;
+    default:
+        assert(false);
+    }
+    return dst;
+}
+
+/* The left operand of a binary node, copied out of its variable's register if
+   the right operand might assign that variable before it is read. */
+size_t lower_left(astree_t *left, astree_t *right) {
+    size_t src = lower_expr(left, VM_NONE);
+    if (src < nvar && lower_hasasg(right)) {
+        size_t tmp = lower_dst(VM_NONE);
+        emit(VM_MOV, tmp, src, 0, 0);
+        return tmp;
+    }
+    return src;
+}
+
+/* Arguments are evaluated into consecutive registers; calls to functions the
+   program does not define go through the extern table and have their result
+   narrowed to the declared type here, since nothing else guarantees it. */
+size_t lower_call(astree_t *ast, size_t dst) {
+    size_t mark = top, narg = 0;
+    for (astree_t *arg = ast->fnc_arg; arg != NULL; arg = arg->arg_next) {
+        top = mark + narg + 1;
+        maxtop = top > maxtop ? top : maxtop;
+        lower_expr(arg->arg_val, mark + narg++);
+    }
+    top = mark;
+    dst = lower_dst(dst);
+    if (ast->fnc_def != NULL && !ast->fnc_def->def_proto) {
+        emit(VM_CALL, dst, mark, func_find(ast->fnc_def), 0);
+        return dst;
+    }
+    assert(narg <= VM_NARG);
+    emit(VM_CALLX, dst, mark, extern_find(ast->fnc_id), 0);
+    if (ast->type != TY_LONG) {
+        emit(ast->type == TY_CHAR ? VM_SEXT8 : ast->type == TY_SHORT ? VM_SEXT16 : VM_SEXT32, dst, dst, 0, 0);
+    }
+    return dst;
+}
+
+size_t lower_dst(size_t dst) {
+    if (dst != VM_NONE) {
+        return dst;
+    }
+    dst = top++;
+    maxtop = top > maxtop ? top : maxtop;
+    return dst;
+}
+
+bool lower_hasasg(astree_t *ast) {
+    if (ast == NULL) {
+        return false;
+    }
+    switch (ast->kind) {
+    case AS_ASG:
+        return true;
+    case AS_CAST:
+        return lower_hasasg(ast->cast_val);
+    case AS_FNC:
+        return lower_hasasg(ast->fnc_arg);
+    case AS_ARG:
+        return lower_hasasg(ast->arg_val) || lower_hasasg(ast->arg_next);
+    case AS_VAR:
+    case AS_NUM:
+        return false;
+    default:
+        return lower_hasasg(ast->bin_left) || lower_hasasg(ast->bin_right);
+    }
+}
+
+size_t emit(vmop_t op, size_t a, size_t b, size_t c, long long imm) {
+    assert(a <= UINT16_MAX && b <= UINT16_MAX && c <= UINT32_MAX);
+    if (ncode == ccode) {
+        ccode = ccode == 0 ? 256 : ccode * 2;
+        code = realloc(code, sizeof(vminsn_t) * ccode);
+        assert(code != NULL);
+    }
+    code[ncode] = (vminsn_t){NULL, op, a, b, c, imm};
+    return ncode++;
+}
+
+size_t func_find(astree_t *def) {
+    for (size_t i = 0; i < nfunc; i++) {
+        if (func[i].def == def) {
+            return i;
+        }
+    }
+    assert(false);
+    return 0;
+}
+
+/* Builtins first, then any symbol the process can already see, so a
+   validation harness can preload its own runtime. */
+size_t extern_find(char *name) {
+    for (size_t i = 0; i < next; i++) {
+        if (strcmp(ext[i].name, name) == 0) {
+            return i;
+        }
+    }
+    if (next == cext) {
+        cext = cext == 0 ? 16 : cext * 2;
+        ext = realloc(ext, sizeof(vmextern_t) * cext);
+        assert(ext != NULL);
+    }
+    for (size_t i = 0; i < nbuiltin; i++) {
+        if (strcmp(builtin[i].name, name) == 0) {
+            ext[next] = builtin[i];
+            return next++;
+        }
+    }
+    void *self = dlopen(NULL, RTLD_NOW);
+    assert(self != NULL);
+    void *addr = dlsym(self, name);
+    if (addr == NULL) {
+        fprintf(stderr, "interpreter: undefined function '%s'\n", name);
+        assert(false);
+    }
+    ext[next] = (vmextern_t){name, NULL, addr};
+    return next++;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define VM_NEXT() goto *pc->go
+
+long long vm_run(size_t entry) {
+    static const void *label[] = {
+        [VM_LOADK] = &&op_loadk,
+        [VM_MOV] = &&op_mov,
+        [VM_ADDW] = &&op_addw,
+        [VM_ADDL] = &&op_addl,
+        [VM_ADDKW] = &&op_addkw,
+        [VM_ADDKL] = &&op_addkl,
+        [VM_SUBW] = &&op_subw,
+        [VM_SUBL] = &&op_subl,
+        [VM_MULW] = &&op_mulw,
+        [VM_MULL] = &&op_mull,
+        [VM_DIVW] = &&op_divw,
+        [VM_DIVL] = &&op_divl,
+        [VM_MODW] = &&op_modw,
+        [VM_MODL] = &&op_modl,
+        [VM_SEXT8] = &&op_sext8,
+        [VM_SEXT16] = &&op_sext16,
+        [VM_SEXT32] = &&op_sext32,
+        [VM_EQ] = &&op_eq,
+        [VM_NE] = &&op_ne,
+        [VM_LT] = &&op_lt,
+        [VM_LE] = &&op_le,
+        [VM_GT] = &&op_gt,
+        [VM_GE] = &&op_ge,
+        [VM_JMP] = &&op_jmp,
+        [VM_JZ] = &&op_jz,
+        [VM_JNZ] = &&op_jnz,
+        [VM_JEQ] = &&op_jeq,
+        [VM_JNE] = &&op_jne,
+        [VM_JLT] = &&op_jlt,
+        [VM_JLE] = &&op_jle,
+        [VM_JGT] = &&op_jgt,
+        [VM_JGE] = &&op_jge,
+        [VM_JEQK] = &&op_jeqk,
+        [VM_JNEK] = &&op_jnek,
+        [VM_JLTK] = &&op_jltk,
+        [VM_JLEK] = &&op_jlek,
+        [VM_JGTK] = &&op_jgtk,
+        [VM_JGEK] = &&op_jgek,
+        [VM_CALL] = &&op_call,
+        [VM_CALLX] = &&op_callx,
+        [VM_RET] = &&op_ret,
+    };
+    for (size_t i = 0; i < ncode; i++) {
+        code[i].go = label[code[i].op];
+    }
+    long long *stack = malloc(sizeof(long long) * VM_STACK);
+    vmframe_t *frame = malloc(sizeof(vmframe_t) * VM_DEPTH);
+    assert(stack != NULL && frame != NULL);
+    long long *r = stack, result;
+    size_t depth = 0, nreg = func[entry].nreg;
+    vminsn_t *pc = code + func[entry].entry;
+    VM_NEXT();
+op_loadk:
+    r[pc->a] = pc->imm;
+    pc++;
+    VM_NEXT();
+op_mov:
+    r[pc->a] = r[pc->b];
+    pc++;
+    VM_NEXT();
+op_addw:
+    r[pc->a] = (int32_t)(uint32_t)((uint64_t)r[pc->b] + (uint64_t)r[pc->c]);
+    pc++;
+    VM_NEXT();
+op_addl:
+    r[pc->a] = (int64_t)((uint64_t)r[pc->b] + (uint64_t)r[pc->c]);
+    pc++;
+    VM_NEXT();
+op_addkw:
+    r[pc->a] = (int32_t)(uint32_t)((uint64_t)r[pc->b] + (uint64_t)pc->imm);
+    pc++;
+    VM_NEXT();
+op_addkl:
+    r[pc->a] = (int64_t)((uint64_t)r[pc->b] + (uint64_t)pc->imm);
+    pc++;
+    VM_NEXT();
+op_subw:
+    r[pc->a] = (int32_t)(uint32_t)((uint64_t)r[pc->b] - (uint64_t)r[pc->c]);
+    pc++;
+    VM_NEXT();
+op_subl:
+    r[pc->a] = (int64_t)((uint64_t)r[pc->b] - (uint64_t)r[pc->c]);
+    pc++;
+    VM_NEXT();
+op_mulw:
+    r[pc->a] = (int32_t)(uint32_t)((uint64_t)r[pc->b] * (uint64_t)r[pc->c]);
+    pc++;
+    VM_NEXT();
+op_mull:
+    r[pc->a] = (int64_t)((uint64_t)r[pc->b] * (uint64_t)r[pc->c]);
+    pc++;
+    VM_NEXT();
+op_divw:
+    r[pc->a] = (int32_t)(uint32_t)(r[pc->b] / r[pc->c]);
+    pc++;
+    VM_NEXT();
+op_divl:
+    r[pc->a] = r[pc->c] == -1 ? (int64_t)(0 - (uint64_t)r[pc->b]) : r[pc->b] / r[pc->c];
+    pc++;
+    VM_NEXT();
+op_modw:
+    r[pc->a] = r[pc->b] % r[pc->c];
+    pc++;
+    VM_NEXT();
+op_modl:
+    r[pc->a] = r[pc->c] == -1 ? 0 : r[pc->b] % r[pc->c];
+    pc++;
+    VM_NEXT();
+op_sext8:
+    r[pc->a] = (int8_t)(uint8_t)r[pc->b];
+    pc++;
+    VM_NEXT();
+op_sext16:
+    r[pc->a] = (int16_t)(uint16_t)r[pc->b];
+    pc++;
+    VM_NEXT();
+op_sext32:
+    r[pc->a] = (int32_t)(uint32_t)r[pc->b];
+    pc++;
+    VM_NEXT();
+op_eq:
+    r[pc->a] = r[pc->b] == r[pc->c];
+    pc++;
+    VM_NEXT();
+op_ne:
+    r[pc->a] = r[pc->b] != r[pc->c];
+    pc++;
+    VM_NEXT();
+op_lt:
+    r[pc->a] = r[pc->b] < r[pc->c];
+    pc++;
+    VM_NEXT();
+op_le:
+    r[pc->a] = r[pc->b] <= r[pc->c];
+    pc++;
+    VM_NEXT();
+op_gt:
+    r[pc->a] = r[pc->b] > r[pc->c];
+    pc++;
+    VM_NEXT();
+op_ge:
+    r[pc->a] = r[pc->b] >= r[pc->c];
+    pc++;
+    VM_NEXT();
+op_jmp:
+    pc = code + pc->c;
+    VM_NEXT();
+op_jz:
+    pc = r[pc->a] == 0 ? code + pc->c : pc + 1;
+    VM_NEXT();
+op_jnz:
+    pc = r[pc->a] != 0 ? code + pc->c : pc + 1;
+    VM_NEXT();
+op_jeq:
+    pc = r[pc->a] == r[pc->b] ? code + pc->c : pc + 1;
+    VM_NEXT();
+op_jne:
+    pc = r[pc->a] != r[pc->b] ? code + pc->c : pc + 1;
+    VM_NEXT();
+op_jlt:
+    pc = r[pc->a] < r[pc->b] ? code + pc->c : pc + 1;
+    VM_NEXT();
+op_jle:
+    pc = r[pc->a] <= r[pc->b] ? code + pc->c : pc + 1;
+    VM_NEXT();
+op_jgt:
+    pc = r[pc->a] > r[pc->b] ? code + pc->c : pc + 1;
+    VM_NEXT();
+op_jge:
+    pc = r[pc->a] >= r[pc->b] ? code + pc->c : pc + 1;
+    VM_NEXT();
+op_jeqk:
+    pc = r[pc->a] == pc->imm ? code + pc->c : pc + 1;
+    VM_NEXT();
+op_jnek:
+    pc = r[pc->a] != pc->imm ? code + pc->c : pc + 1;
+    VM_NEXT();
+op_jltk:
+    pc = r[pc->a] < pc->imm ? code + pc->c : pc + 1;
+    VM_NEXT();
+op_jlek:
+    pc = r[pc->a] <= pc->imm ? code + pc->c : pc + 1;
+    VM_NEXT();
+op_jgtk:
+    pc = r[pc->a] > pc->imm ? code + pc->c : pc + 1;
+    VM_NEXT();
+op_jgek:
+    pc = r[pc->a] >= pc->imm ? code + pc->c : pc + 1;
+    VM_NEXT();
+op_call: {
+    vmfunc_t *callee = &func[pc->c];
+    long long *window = r + nreg;
+    assert(window + callee->nreg + VM_NARG <= stack + VM_STACK && depth < VM_DEPTH);
+    memcpy(window, r + pc->b, sizeof(long long) * callee->nparam);
+    frame[depth++] = (vmframe_t){pc + 1, r, pc->a};
+    r = window;
+    nreg = callee->nreg;
+    pc = code + callee->entry;
+    VM_NEXT();
+}
+op_callx:
+    r[pc->a] = vm_extern(&ext[pc->c], r + pc->b);
+    pc++;
+    VM_NEXT();
+op_ret:
+    result = r[pc->a];
+    if (depth == 0) {
+        free(stack);
+        free(frame);
+        return result;
+    }
+    depth--;
+    nreg = r - frame[depth].reg;
+    r = frame[depth].reg;
+    r[frame[depth].dst] = result;
+    pc = frame[depth].pc;
+    VM_NEXT();
+}
+
+#undef VM_NEXT
+#pragma GCC diagnostic pop
+
+/* Symbols found by dlsym are called with VM_NARG integer arguments whatever
+   their arity, which both targets' calling conventions tolerate. */
+long long vm_extern(vmextern_t *fn, long long *arg) {
+    if (fn->fn != NULL) {
+        return fn->fn(arg);
+    }
+    long (*call)(long, long, long, long, long, long, long, long);
+    memcpy(&call, &fn->addr, sizeof(call));
+    return call(arg[0], arg[1], arg[2], arg[3], arg[4], arg[5], arg[6], arg[7]);
+}
+
+long long builtin_putchar(long long *arg) {
+    return putchar((int)arg[0]);
+}
+
+long long builtin_getchar(long long *arg) {
+    (void)arg;
+    return getchar();
+}
+
+long long builtin_abs(long long *arg) {
+    return arg[0] < 0 ? -arg[0] : arg[0];
+}
+
+long long builtin_labs(long long *arg) {
+    return arg[0] < 0 ? -arg[0] : arg[0];
+}
+
+long long builtin_exit(long long *arg) {
+    exit((int)arg[0]);
+}
@@ -0,0 +1,25 @@
+long rt_param(long n);
+long rt_sink(long v);
+
+long steps(long n) {
+    long k = 0;
+    while (n != 1) {
+        if (n % 2 == 0) n = n / 2;
+        else n = 3 * n + 1;
+        k = k + 1;
+    }
+    return k;
+}
+
+int main() {
+    long limit = rt_param(400000);
+    long best = 0;
+    long total = 0;
+    for (long n = 1; n < limit; n = n + 1) {
+        long k = steps(n);
+        if (k > best) best = k;
+        total = total + k;
+    }
+    rt_sink(total);
+    return rt_sink(best) % 256;
+}
@@ -0,0 +1,11 @@
+long rt_param(long n);
+long rt_sink(long v);
+
+long fib(long n) {
+    if (n < 2) return n;
+    return fib(n - 1) + fib(n - 2);
+}
+
+int main() {
+    return rt_sink(fib(rt_param(35))) % 256;
+}
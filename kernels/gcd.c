@@ -0,0 +1,20 @@
+long rt_param(long n);
+long rt_sink(long v);
+
+long gcd(long a, long b) {
+    while (b != 0) {
+        long t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+int main() {
+    long n = rt_param(1500);
+    long sum = 0;
+    for (long i = 1; i <= n; i = i + 1)
+        for (long j = 1; j <= n; j = j + 1)
+            sum = sum + gcd(i, j);
+    return rt_sink(sum) % 256;
+}
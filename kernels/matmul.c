@@ -0,0 +1,26 @@
+long rt_alloc(long n);
+long rt_load(long i);
+long rt_store(long i, long v);
+long rt_param(long n);
+long rt_sink(long v);
+
+int main() {
+    long n = rt_param(240);
+    long a = 0;
+    long b = n * n;
+    long c = 2 * n * n;
+    rt_alloc(3 * n * n);
+    for (long i = 0; i < n * n; i = i + 1) {
+        rt_store(a + i, i % 7 - 3);
+        rt_store(b + i, i % 5 - 2);
+    }
+    for (long i = 0; i < n; i = i + 1)
+        for (long j = 0; j < n; j = j + 1) {
+            long s = 0;
+            for (long k = 0; k < n; k = k + 1) s = s + rt_load(a + i * n + k) * rt_load(b + k * n + j);
+            rt_store(c + i * n + j, s);
+        }
+    long sum = 0;
+    for (long i = 0; i < n * n; i = i + 1) sum = sum + rt_load(c + i) * (i % 11);
+    return rt_sink(sum) % 256;
+}
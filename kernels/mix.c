@@ -0,0 +1,18 @@
+long rt_param(long n);
+long rt_sink(long v);
+
+int main() {
+    long n = rt_param(20000000);
+    int h = 0;
+    short s = 1;
+    char c = 7;
+    long acc = 0;
+    for (long i = 0; i < n; i = i + 1) {
+        h = h * 31 + i;
+        s = s * 5 + h;
+        c = c + s / 3;
+        if (c < 0) acc = acc + c;
+        else acc = acc - h % 1000;
+    }
+    return rt_sink(acc + h + s + c) % 256;
+}
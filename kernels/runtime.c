@@ -0,0 +1,45 @@
+#include <assert.h>
+#include <stdlib.h>
+
+/* The kernels have no arrays or pointers, so their memory lives here and is
+   reached by index. rt_param hides constants from gcc's optimizer and
+   rt_sink keeps results alive, so -O2 cannot fold a kernel away. Every
+   function returns long so the kernels can declare it as they declare their
+   own. */
+long rt_alloc(long);
+long rt_load(long);
+long rt_store(long, long);
+long rt_param(long);
+long rt_sink(long);
+
+static long *mem;
+static long size;
+static volatile long sink;
+
+long rt_alloc(long n) {
+    free(mem);
+    mem = calloc(n, sizeof(long));
+    assert(mem != NULL);
+    size = n;
+    return n;
+}
+
+long rt_load(long i) {
+    assert(i >= 0 && i < size);
+    return mem[i];
+}
+
+long rt_store(long i, long val) {
+    assert(i >= 0 && i < size);
+    mem[i] = val;
+    return val;
+}
+
+long rt_param(long val) {
+    return val;
+}
+
+long rt_sink(long val) {
+    sink += val;
+    return sink;
+}
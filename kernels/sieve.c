@@ -0,0 +1,18 @@
+long rt_alloc(long n);
+long rt_load(long i);
+long rt_store(long i, long v);
+long rt_param(long n);
+long rt_sink(long v);
+
+int main() {
+    long n = rt_param(2000000);
+    rt_alloc(n);
+    long count = 0;
+    for (long i = 2; i < n; i = i + 1) {
+        if (rt_load(i) == 0) {
+            count = count + 1;
+            for (long j = i * i; j < n; j = j + i) rt_store(j, 1);
+        }
+    }
+    return rt_sink(count) % 256;
+}
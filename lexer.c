@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <ctype.h>
 #include <stdbool.h>
@@ -7,25 +8,48 @@
 #include "main.h"
 
 tklist_t *lexer(FILE *);
+static tklist_t *lexer_token(FILE *);
+static int lexer_getc(FILE *);
+static void lexer_ungetc(int, FILE *);
 bool tklist_read(tklist_t **, tkkind_t);
 bool tklist_match(tklist_t *, tkkind_t);
 bool tklist_kind(tklist_t *, tkkind_t);
 bool tklist_exist(tklist_t *);
 void tklist_next(tklist_t **);
-void tklist_show(tklist_t *);
-static void tklist_show_impl(tklist_t *);
+void tklist_show(FILE *, tklist_t *);
+static void tklist_show_impl(FILE *, tklist_t *);
+size_t tklist_count(tklist_t *);
 void tklist_free(tklist_t *);
 
+#ifndef NO_POSITIONS
+static _Thread_local size_t line;
+static _Thread_local size_t col;
+static _Thread_local size_t lastcol;
+#endif
+
 tklist_t *lexer(FILE *ifp) {
+#ifndef NO_POSITIONS
+    line = col = 1;
+#endif
+    return lexer_token(ifp);
+}
+
+tklist_t *lexer_token(FILE *ifp) {
     int chr;
     do {
-        chr = fgetc(ifp);
+        chr = lexer_getc(ifp);
     } while (isspace(chr));
     if (chr == EOF) {
         return NULL;
     }
     tklist_t *tkl = malloc(sizeof(tklist_t));
     assert(tkl != NULL);
+#ifdef NO_POSITIONS
+    tkl->line = tkl->col = 0;
+#else
+    tkl->line = line;
+    tkl->col = col - 1;
+#endif
     if (chr == '+') {
         tkl->kind = TK_ADD;
     } else if (chr == '-') {
@@ -37,34 +61,34 @@ tklist_t *lexer(FILE *ifp) {
     } else if (chr == '%') {
         tkl->kind = TK_MOD;
     } else if (chr == '=') {
-        chr = fgetc(ifp);
+        chr = lexer_getc(ifp);
         if (chr == '=') {
             tkl->kind = TK_EQ;
         } else {
-            ungetc(chr, ifp);
+            lexer_ungetc(chr, ifp);
             tkl->kind = TK_ASG;
         }
     } else if (chr == '!') {
-        chr = fgetc(ifp);
+        chr = lexer_getc(ifp);
         if (chr == '=') {
             tkl->kind = TK_NE;
         } else {
             assert(false);
         }
     } else if (chr == '<') {
-        chr = fgetc(ifp);
+        chr = lexer_getc(ifp);
         if (chr == '=') {
             tkl->kind = TK_LE;
         } else {
-            ungetc(chr, ifp);
+            lexer_ungetc(chr, ifp);
             tkl->kind = TK_LT;
         }
     } else if (chr == '>') {
-        chr = fgetc(ifp);
+        chr = lexer_getc(ifp);
         if (chr == '=') {
             tkl->kind = TK_GE;
         } else {
-            ungetc(chr, ifp);
+            lexer_ungetc(chr, ifp);
             tkl->kind = TK_GT;
         }
     } else if (chr == ',') {
@@ -82,10 +106,10 @@ tklist_t *lexer(FILE *ifp) {
     } else if (isdigit(chr)) {
         tkl->kind = TK_NUM;
         tkl->num = chr - '0';
-        while (isdigit(chr = fgetc(ifp))) {
+        while (isdigit(chr = lexer_getc(ifp))) {
             tkl->num = tkl->num * 10 + chr - '0';
         }
-        ungetc(chr, ifp);
+        lexer_ungetc(chr, ifp);
     } else if (isalpha(chr) || chr == '_') {
         char *str = malloc(sizeof(char) * 16);
         assert(str != NULL);
@@ -96,11 +120,11 @@ tklist_t *lexer(FILE *ifp) {
                 assert(str != NULL);
             }
             str[len++] = chr;
-        } while (isalnum(chr = fgetc(ifp)) || chr == '_');
+        } while (isalnum(chr = lexer_getc(ifp)) || chr == '_');
         str = realloc(str, sizeof(char) * (len + 1));
         assert(str != NULL);
         str[len] = '\0';
-        ungetc(chr, ifp);
+        lexer_ungetc(chr, ifp);
         if (strcmp(str, "if") == 0) {
             free(str);
             tkl->kind = TK_IF;
@@ -116,6 +140,18 @@ tklist_t *lexer(FILE *ifp) {
         } else if (strcmp(str, "return") == 0) {
             free(str);
             tkl->kind = TK_RET;
+        } else if (strcmp(str, "char") == 0) {
+            free(str);
+            tkl->kind = TK_CHAR;
+        } else if (strcmp(str, "short") == 0) {
+            free(str);
+            tkl->kind = TK_SHORT;
+        } else if (strcmp(str, "int") == 0) {
+            free(str);
+            tkl->kind = TK_INT;
+        } else if (strcmp(str, "long") == 0) {
+            free(str);
+            tkl->kind = TK_LONG;
         } else {
             tkl->kind = TK_ID;
             tkl->id = str;
@@ -123,10 +159,44 @@ tklist_t *lexer(FILE *ifp) {
     } else {
         assert(false);
     }
-    tkl->next = lexer(ifp);
+    tkl->next = lexer_token(ifp);
     return tkl;
 }
 
+/* Positions are 1-based; col is the column of the next character, and a
+   newline pushed back restores the column the line ended at. Built with
+   -DNO_POSITIONS none are kept and every token is at 0, so the cost of the
+   tracking can be timed against a normal build. */
+int lexer_getc(FILE *ifp) {
+    int chr = getc_unlocked(ifp);
+#ifndef NO_POSITIONS
+    if (chr == '\n') {
+        line++;
+        lastcol = col;
+        col = 1;
+    } else if (chr != EOF) {
+        col++;
+    }
+#endif
+    return chr;
+}
+
+void lexer_ungetc(int chr, FILE *ifp) {
+    if (chr == EOF) {
+        return;
+    }
+    ungetc(chr, ifp);
+#ifndef NO_POSITIONS
+    if (chr == '\n') {
+        line--;
+        col = lastcol;
+    } else {
+        col--;
+    }
+#endif
+    return;
+}
+
 bool tklist_read(tklist_t **tkl, tkkind_t kind) {
     return tklist_match(*tkl, kind) && (tklist_next(tkl), true);
 }
@@ -148,103 +218,123 @@ void tklist_next(tklist_t **tkl) {
     return;
 }
 
-void tklist_show(tklist_t *tkl) {
-    fputs("tklist:", stdout);
-    tklist_show_impl(tkl);
-    putchar('\n');
+void tklist_show(FILE *ofp, tklist_t *tkl) {
+    fputs("tklist:", ofp);
+    tklist_show_impl(ofp, tkl);
+    fputc('\n', ofp);
     return;
 }
 
-void tklist_show_impl(tklist_t *tkl) {
+void tklist_show_impl(FILE *ofp, tklist_t *tkl) {
     if (tkl == NULL) {
         return;
     }
-    putchar(' ');
-    putchar('(');
+    fputc(' ', ofp);
+    fputc('(', ofp);
     switch (tkl->kind) {
     case TK_ADD:
-        fputs("TK_ADD: '+'", stdout);
+        fputs("TK_ADD: '+'", ofp);
         break;
     case TK_SUB:
-        fputs("TK_SUB: '-'", stdout);
+        fputs("TK_SUB: '-'", ofp);
         break;
     case TK_MUL:
-        fputs("TK_MUL: '*'", stdout);
+        fputs("TK_MUL: '*'", ofp);
         break;
     case TK_DIV:
-        fputs("TK_DIV: '/'", stdout);
+        fputs("TK_DIV: '/'", ofp);
         break;
     case TK_MOD:
-        fputs("TK_MOD: '%'", stdout);
+        fputs("TK_MOD: '%'", ofp);
         break;
     case TK_EQ:
-        fputs("TK_EQ: '=='", stdout);
+        fputs("TK_EQ: '=='", ofp);
         break;
     case TK_NE:
-        fputs("TK_NE: '!='", stdout);
+        fputs("TK_NE: '!='", ofp);
         break;
     case TK_LT:
-        fputs("TK_LT: '<'", stdout);
+        fputs("TK_LT: '<'", ofp);
         break;
     case TK_LE:
-        fputs("TK_LE: '<='", stdout);
+        fputs("TK_LE: '<='", ofp);
         break;
     case TK_GT:
-        fputs("TK_GT: '>'", stdout);
+        fputs("TK_GT: '>'", ofp);
         break;
     case TK_GE:
-        fputs("TK_GE: '>='", stdout);
+        fputs("TK_GE: '>='", ofp);
         break;
     case TK_ASG:
-        fputs("TK_ASG: '='", stdout);
+        fputs("TK_ASG: '='", ofp);
         break;
     case TK_CMA:
-        fputs("TK_CMA: ','", stdout);
+        fputs("TK_CMA: ','", ofp);
         break;
     case TK_LPRN:
-        fputs("TK_LPRN: '('", stdout);
+        fputs("TK_LPRN: '('", ofp);
         break;
     case TK_RPRN:
-        fputs("TK_RPRN: ')'", stdout);
+        fputs("TK_RPRN: ')'", ofp);
         break;
     case TK_LBRC:
-        fputs("TK_LBRC: '{'", stdout);
+        fputs("TK_LBRC: '{'", ofp);
         break;
     case TK_RBRC:
-        fputs("TK_RBRC: '}'", stdout);
+        fputs("TK_RBRC: '}'", ofp);
         break;
     case TK_SCLN:
-        fputs("TK_SCLN: ';'", stdout);
+        fputs("TK_SCLN: ';'", ofp);
         break;
     case TK_IF:
-        fputs("TK_IF: 'if'", stdout);
+        fputs("TK_IF: 'if'", ofp);
         break;
     case TK_ELSE:
-        fputs("TK_ELSE: 'else'", stdout);
+        fputs("TK_ELSE: 'else'", ofp);
         break;
     case TK_WHILE:
-        fputs("TK_WHILE: 'while'", stdout);
+        fputs("TK_WHILE: 'while'", ofp);
         break;
     case TK_FOR:
-        fputs("TK_FOR: 'for'", stdout);
+        fputs("TK_FOR: 'for'", ofp);
         break;
     case TK_RET:
-        fputs("TK_RET: 'return'", stdout);
+        fputs("TK_RET: 'return'", ofp);
+        break;
+    case TK_CHAR:
+        fputs("TK_CHAR: 'char'", ofp);
+        break;
+    case TK_SHORT:
+        fputs("TK_SHORT: 'short'", ofp);
+        break;
+    case TK_INT:
+        fputs("TK_INT: 'int'", ofp);
+        break;
+    case TK_LONG:
+        fputs("TK_LONG: 'long'", ofp);
         break;
     case TK_ID:
-        printf("TK_ID: '%s'", tkl->id);
+        fprintf(ofp, "TK_ID: '%s'", tkl->id);
         break;
     case TK_NUM:
-        printf("TK_NUM: '%lld'", tkl->num);
+        fprintf(ofp, "TK_NUM: '%lld'", tkl->num);
         break;
     default:
         assert(false);
     }
-    putchar(')');
-    tklist_show_impl(tkl->next);
+    fputc(')', ofp);
+    tklist_show_impl(ofp, tkl->next);
     return;
 }
 
+size_t tklist_count(tklist_t *tkl) {
+    size_t n = 0;
+    for (; tkl != NULL; tkl = tkl->next) {
+        n++;
+    }
+    return n;
+}
+
 void tklist_free(tklist_t *tkl) {
     if (tkl->next != NULL) {
         tklist_free(tkl->next);
@@ -1,21 +1,345 @@
 #include <assert.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "main.h"
 
+int main(int, char **);
+static int compile(char *, FILE *, FILE *, FILE *);
+static int cached(char *, FILE *, FILE *, FILE *);
+static void build(size_t);
+static char *outpath(char *);
+static FILE *pass(void (*)(FILE *, FILE *), FILE *);
+static void copy(FILE *, FILE *);
+
+static bool post;
+static bool optimize = true;
+static bool schedule = true;
+static bool ranges = true;
+static bool sizes;
+static bool object;
+static bool run;
+static bool interp;
+static bool debug;
+static bool dumptok;
+static bool dumptree;
+static bool reporting;
+static bool cache;
+static char **path;
+static char *conf;
+
+/* With -j every path is an input, compiled next to itself as .s (or .o with
+   -c) by a pool of workers; with --server the options are served to the
+   thin client on a socket; otherwise it is one input and one output.
+   conf lists the options that shape the output, one per line. Each of the
+   three goes through the cache in COMPILER_CACHE when that is set, bounded
+   by COMPILER_CACHE_SIZE MiB. The reports on stderr describe a single
+   compile, so none of that applies when one is asked for. */
 int main(int argc, char **argv) {
-    assert(argc == 3);
-    FILE *ifp = fopen(argv[1], "r");
-    FILE *ofp = fopen(argv[2], "w");
+    bool stats = false;
+    bool schedstats = false;
+    bool instrument = false;
+    bool timing = false;
+    bool memory = false;
+    bool json = false;
+    bool cachestats = false;
+    bool perfmap = false;
+    char *sock = NULL;
+    char *prof = NULL;
+    size_t nthread = 0;
+    int status = 0;
+    size_t npath = 0;
+    size_t len = 1;
+    for (int i = 1; i < argc; i++) {
+        len += strlen(argv[i]) + 1;
+    }
+    path = malloc(argc * sizeof(char *));
+    conf = malloc(len);
+    assert(path != NULL && conf != NULL);
+    conf[0] = '\0';
+    for (int i = 1; i < argc; i++) {
+        bool option = true;
+        if (strcmp(argv[i], "--peephole") == 0) {
+            post = true;
+        } else if (strcmp(argv[i], "-fno-peephole") == 0) {
+            optimize = false;
+        } else if (strcmp(argv[i], "-fpeephole-stats") == 0) {
+            stats = true;
+        } else if (strcmp(argv[i], "-fno-schedule") == 0) {
+            schedule = false;
+        } else if (strcmp(argv[i], "-fsched-stats") == 0) {
+            scheduler_report(stderr);
+            schedstats = true;
+        } else if (strcmp(argv[i], "-fno-vrp") == 0) {
+            ranges = false;
+        } else if (strcmp(argv[i], "-Os") == 0) {
+            generator_size(true);
+        } else if (strcmp(argv[i], "-fno-omit-frame-pointer") == 0) {
+            generator_omit(false);
+        } else if (strcmp(argv[i], "-fsize-report") == 0) {
+            sizes = true;
+        } else if (strcmp(argv[i], "-ftime-report") == 0 || strcmp(argv[i], "-ftime-report=json") == 0) {
+            timing = true;
+            json |= argv[i][13] == '=';
+        } else if (strcmp(argv[i], "-fmem-report") == 0 || strcmp(argv[i], "-fmem-report=json") == 0) {
+            memory = true;
+            json |= argv[i][12] == '=';
+        } else if (strcmp(argv[i], "-fdump-tokens") == 0) {
+            dumptok = true;
+        } else if (strcmp(argv[i], "-fdump-tree") == 0) {
+            dumptree = true;
+        } else if (strcmp(argv[i], "--run") == 0) {
+            run = true;
+        } else if (strcmp(argv[i], "--interp") == 0) {
+            run = interp = true;
+        } else if (strcmp(argv[i], "-fperf-map") == 0) {
+            assembler_perfmap(true);
+            perfmap = true;
+        } else if (strcmp(argv[i], "-fprofile-generate") == 0) {
+            generator_instrument("default.prof");
+            instrument = true;
+        } else if (strncmp(argv[i], "-fprofile-generate=", 19) == 0) {
+            generator_instrument(argv[i] + 19);
+            instrument = true;
+        } else if (strcmp(argv[i], "-fprofile-use") == 0) {
+            prof = "default.prof";
+            profile_load(prof);
+        } else if (strncmp(argv[i], "-fprofile-use=", 14) == 0) {
+            prof = argv[i] + 14;
+            profile_load(prof);
+        } else if (strcmp(argv[i], "-g") == 0) {
+            debug = true;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            object = true;
+        } else if (strncmp(argv[i], "-mtune=", 7) == 0) {
+            bool known = scheduler_tune(argv[i] + 7);
+            assert(known);
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            char *num = argv[i][2] != '\0' ? argv[i] + 2 : argv[++i];
+            assert(num != NULL);
+            char *end;
+            nthread = strtoul(num, &end, 10);
+            assert(*end == '\0' && nthread > 0);
+            option = false;
+        } else if (strcmp(argv[i], "--cache-stats") == 0) {
+            cachestats = true;
+            option = false;
+        } else if (strcmp(argv[i], "--server") == 0) {
+            sock = argv[++i];
+            assert(sock != NULL);
+            option = false;
+        } else {
+            path[npath++] = argv[i];
+            option = false;
+        }
+        if (option) {
+            strcat(conf, argv[i]);
+            strcat(conf, "\n");
+        }
+    }
+    assert(!run || (!post && !object));
+    assert(!perfmap || (run && !interp));
+    assert(!instrument || (!run && !object));
+    bool dumps = dumptok || dumptree;
+    assert(!dumps || !run || interp);
+    bool reports = stats || schedstats || sizes || timing || memory;
+    char *dir = getenv("COMPILER_CACHE");
+    if (dir != NULL && dir[0] != '\0') {
+        char *size = getenv("COMPILER_CACHE_SIZE");
+        cache_open(dir, (size != NULL ? strtoull(size, NULL, 10) : CACHE_SIZE) << 20);
+        if (prof != NULL) {
+            cache_extra(prof);
+        }
+        cache = !run && !post && !reports;
+    }
+    if (cachestats) {
+        assert(dir != NULL && npath == 0);
+        cache_report(stdout);
+        free(path);
+        free(conf);
+        return 0;
+    }
+    if (sock != NULL) {
+        assert(npath == 0 && !run && !post && !reports);
+        server(sock, nthread, conf, cached);
+    }
+    if (nthread > 0) {
+        assert(!run && !post && !reports && !dumps);
+        driver(nthread, npath, build);
+        free(path);
+        free(conf);
+        return 0;
+    }
+    assert(npath == (run ? 1 : 2));
+    FILE *ifp = fopen(path[0], "r");
+    FILE *ofp = run ? NULL : fopen(path[1], object ? "wb" : "w");
     assert(ifp != NULL);
-    assert(ofp != NULL);
-    tklist_t *tkl = lexer(ifp);
-    astree_t *ast = parser(tkl);
-    generator(ofp, ast);
-    tklist_show(tkl);
-    astree_show(ast);
-    tklist_free(tkl);
-    astree_free(ast);
+    assert(run || ofp != NULL);
+    if (timing || memory) {
+        reporting = true;
+        report_begin();
+    }
+    status = cached(path[0], ifp, ofp, dumps ? stdout : NULL);
+    if (stats) {
+        peephole_report(stderr);
+    }
+    if (sizes) {
+        sizer_report(stderr);
+    }
+    if (timing || memory) {
+        report_show(stderr, timing, memory, json);
+    }
+    assert(fclose(ifp) == 0);
+    assert(run || fclose(ofp) == 0);
+    free(path);
+    free(conf);
+    return status;
+}
+
+/* Everything one compilation touches is reset on entry and lives in
+   thread-local storage, so compilations on different workers never share
+   state and each produces what a serial run would. The token list and tree
+   go to dfp as -fdump-tokens and -fdump-tree ask. */
+int compile(char *name, FILE *ifp, FILE *ofp, FILE *dfp) {
+    int status = 0;
+    generator_debug(debug ? name : NULL);
+    if (post) {
+        peephole(ofp, ifp);
+        report_phase("peephole");
+    } else {
+        tklist_t *tkl = lexer(ifp);
+        report_phase("lex");
+        astree_t *ast = parser(tkl);
+        report_phase("parse");
+        if (reporting) {
+            report_count("tokens", tklist_count(tkl));
+            report_count("nodes", astree_count(ast));
+        }
+        if (dumptok) {
+            tklist_show(dfp, tkl);
+        }
+        if (dumptree) {
+            astree_show(dfp, ast);
+        }
+        if (interp) {
+            status = interpreter(ast);
+            report_phase("interpret");
+        } else {
+            if (ranges) {
+                ranger(ast);
+                report_phase("range");
+            }
+            allocator(ast);
+            report_phase("allocate");
+            FILE *asmfp = tmpfile();
+            assert(asmfp != NULL);
+            emitter_t *emt = emitter_file(asmfp);
+            generator(emt, ast);
+            report_count("asm_bytes", emitter_close(emt));
+            report_phase("generate");
+            rewind(asmfp);
+            if (optimize) {
+                asmfp = pass(peephole, asmfp);
+                report_phase("peephole");
+            }
+            if (schedule) {
+                asmfp = pass(scheduler, asmfp);
+                report_phase("schedule");
+            }
+            if (sizes) {
+                asmfp = pass(sizer, asmfp);
+                report_phase("size");
+            }
+            if (run) {
+                status = assembler_run(asmfp);
+                report_phase("run");
+            } else if (object) {
+                assembler(ofp, asmfp);
+                report_phase("assemble");
+            } else {
+                copy(ofp, asmfp);
+                report_phase("output");
+            }
+            assert(fclose(asmfp) == 0);
+        }
+        tklist_free(tkl);
+        astree_free(ast);
+    }
+    if (ofp != NULL) {
+        report_count("output_bytes", ftell(ofp));
+    }
+    return status;
+}
+
+/* A hit is served without lexing; a miss compiles into temporaries, which
+   are stored before being copied out. Only -g puts the name in the output,
+   so otherwise the same source under another name still hits. */
+int cached(char *name, FILE *ifp, FILE *ofp, FILE *dfp) {
+    if (!cache) {
+        return compile(name, ifp, ofp, dfp);
+    }
+    char key[CACHE_KEY];
+    if (cache_lookup(key, conf, debug ? name : "", ifp, ofp, dfp)) {
+        return 0;
+    }
+    rewind(ifp);
+    FILE *tofp = tmpfile();
+    FILE *tdfp = dfp != NULL ? tmpfile() : NULL;
+    assert(tofp != NULL && (dfp == NULL || tdfp != NULL));
+    int status = compile(name, ifp, tofp, tdfp);
+    cache_store(key, tofp, tdfp);
+    rewind(tofp);
+    copy(ofp, tofp);
+    assert(fclose(tofp) == 0);
+    if (tdfp != NULL) {
+        rewind(tdfp);
+        copy(dfp, tdfp);
+        assert(fclose(tdfp) == 0);
+    }
+    return status;
+}
+
+void build(size_t i) {
+    char *opath = outpath(path[i]);
+    assert(strcmp(opath, path[i]) != 0);
+    FILE *ifp = fopen(path[i], "r");
+    FILE *ofp = fopen(opath, object ? "wb" : "w");
+    assert(ifp != NULL && ofp != NULL);
+    cached(path[i], ifp, ofp, NULL);
     assert(fclose(ifp) == 0);
     assert(fclose(ofp) == 0);
-    return 0;
+    free(opath);
+    return;
+}
+
+/* foo.c becomes foo.s, or foo.o under -c; a name without an extension
+   gets one appended. */
+char *outpath(char *ipath) {
+    char *slash = strrchr(ipath, '/');
+    char *dot = strrchr(ipath, '.');
+    size_t len = dot != NULL && (slash == NULL || dot > slash) ? (size_t)(dot - ipath) : strlen(ipath);
+    char *opath = malloc(len + 3);
+    assert(opath != NULL);
+    memcpy(opath, ipath, len);
+    strcpy(opath + len, object ? ".o" : ".s");
+    return opath;
+}
+
+FILE *pass(void (*run)(FILE *, FILE *), FILE *ifp) {
+    FILE *ofp = tmpfile();
+    assert(ofp != NULL);
+    run(ofp, ifp);
+    assert(fclose(ifp) == 0);
+    rewind(ofp);
+    return ofp;
+}
+
+void copy(FILE *ofp, FILE *ifp) {
+    char buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), ifp)) > 0) {
+        assert(fwrite(buf, 1, len, ofp) == len);
+    }
+    return;
 }
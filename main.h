@@ -2,11 +2,14 @@
 #define MAIN_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 typedef struct tklist_t tklist_t;
 typedef struct astree_t astree_t;
 typedef struct idlist_t idlist_t;
+typedef struct insn_t insn_t;
+typedef struct emitter_t emitter_t;
 
 typedef enum {
     TK_ADD,
@@ -32,11 +35,16 @@ typedef enum {
     TK_WHILE,
     TK_FOR,
     TK_RET,
+    TK_CHAR,
+    TK_SHORT,
+    TK_INT,
+    TK_LONG,
     TK_ID,
     TK_NUM,
 } tkkind_t;
 
 typedef enum {
+    AS_DEF,
     AS_BLK,
     AS_IF,
     AS_WHILE,
@@ -54,14 +62,45 @@ typedef enum {
     AS_GT,
     AS_GE,
     AS_ASG,
+    AS_CAST,
     AS_FNC,
     AS_ARG,
     AS_VAR,
     AS_NUM,
 } askind_t;
 
+typedef enum {
+    NT_NONE,
+    NT_REG,
+    NT_IMM,
+    NT_MEM,
+    NT_RVAR,
+    NT_INDEX,
+    NT_SUM,
+    NT_ADDR,
+    NT_PROD,
+    NT_FLAGS,
+} ntkind_t;
+
+#define NNT (NT_FLAGS + 1)
+
+typedef enum {
+    IN_TEXT,
+    IN_LABEL,
+    IN_OP,
+} inkind_t;
+
+typedef enum {
+    TY_CHAR,
+    TY_SHORT,
+    TY_INT,
+    TY_LONG,
+} tykind_t;
+
 struct tklist_t {
     tkkind_t kind;
+    size_t line;
+    size_t col;
     union {
         char *id;
         long long num;
@@ -71,7 +110,25 @@ struct tklist_t {
 
 struct astree_t {
     askind_t kind;
+    tykind_t type;
+    size_t line;
+    size_t col;
+    long long lo;
+    long long hi;
+    size_t cost[NNT];
+    size_t rule[NNT];
     union {
+        struct {
+            char *def_id;
+            astree_t *def_param;
+            astree_t *def_body;
+            idlist_t *def_local;
+            size_t def_size;
+            size_t def_nreg;
+            bool def_leaf;
+            bool def_proto;
+            astree_t *def_next;
+        };
         struct {
             astree_t *blk_body;
             astree_t *blk_next;
@@ -101,17 +158,20 @@ struct astree_t {
             astree_t *bin_left;
             astree_t *bin_right;
         };
+        struct {
+            astree_t *cast_val;
+        };
         struct {
             char *fnc_id;
             astree_t *fnc_arg;
+            astree_t *fnc_def;
         };
         struct {
             astree_t *arg_val;
             astree_t *arg_next;
         };
         struct {
-            char *var_id;
-            size_t var_ofs;
+            idlist_t *var_idl;
         };
         struct {
             long long num_val;
@@ -121,23 +181,105 @@ struct astree_t {
 
 struct idlist_t {
     char *id;
+    tykind_t type;
+    size_t idx;
     size_t ofs;
+    size_t reg;
+    bool hide;
     idlist_t *next;
 };
 
+#define INSN_LINE 4096
+#define INSN_OP 16
+#define INSN_ARG 64
+#define INSN_NARG 4
+#define INSN_NOTE 128
+
+struct insn_t {
+    inkind_t kind;
+    char *text;
+    char op[INSN_OP];
+    char arg[INSN_NARG][INSN_ARG];
+    size_t narg;
+};
+
 tklist_t *lexer(FILE *);
 bool tklist_read(tklist_t **, tkkind_t);
 bool tklist_match(tklist_t *, tkkind_t);
 bool tklist_kind(tklist_t *, tkkind_t);
 bool tklist_exist(tklist_t *);
 void tklist_next(tklist_t **);
-void tklist_show(tklist_t *);
+void tklist_show(FILE *, tklist_t *);
+size_t tklist_count(tklist_t *);
 void tklist_free(tklist_t *);
 
 astree_t *parser(tklist_t *);
-void astree_show(astree_t *);
+size_t tykind_size(tykind_t);
+void astree_show(FILE *, astree_t *);
+size_t astree_count(astree_t *);
 void astree_free(astree_t *);
 
-void generator(FILE *, astree_t *);
+void ranger(astree_t *);
+bool ranger_known(astree_t *, long long *);
+
+void allocator(astree_t *);
+
+void generator(emitter_t *, astree_t *);
+void generator_size(bool);
+void generator_omit(bool);
+void generator_instrument(char *);
+void generator_debug(char *);
+
+void peephole(FILE *, FILE *);
+void peephole_report(FILE *);
+void insn_read(insn_t *, char *);
+void insn_write(FILE *, insn_t *);
+bool insn_isloc(char *);
+bool insn_iscfi(char *);
+void insn_note(char *, char *);
+
+void scheduler(FILE *, FILE *);
+bool scheduler_tune(char *);
+void scheduler_report(FILE *);
+
+void sizer(FILE *, FILE *);
+void sizer_report(FILE *);
+
+void assembler(FILE *, FILE *);
+int assembler_run(FILE *);
+void assembler_perfmap(bool);
+
+int interpreter(astree_t *);
+
+void profile_load(char *);
+void profile_func(char *);
+uint64_t profile_key(astree_t *);
+bool profile_count(uint64_t, uint64_t *);
+
+void driver(size_t, size_t, void (*)(size_t));
+
+void server(char *, size_t, char *, int (*)(char *, FILE *, FILE *, FILE *));
+bool server_client(char *, char *, char *, FILE *, FILE *, FILE *);
+
+void report_begin(void);
+void report_phase(char *);
+void report_count(char *, size_t);
+void report_show(FILE *, bool, bool, bool);
+
+#define CACHE_KEY 65
+#define CACHE_SIZE 256
+
+void cache_open(char *, size_t);
+void cache_extra(char *);
+bool cache_lookup(char *, char *, char *, FILE *, FILE *, FILE *);
+void cache_store(char *, FILE *, FILE *);
+void cache_report(FILE *);
+
+emitter_t *emitter_file(FILE *);
+emitter_t *emitter_memory(char *, size_t);
+size_t emitter_close(emitter_t *);
+void emitter_puts(emitter_t *, const char *);
+void emitter_putc(emitter_t *, char);
+void emitter_format(emitter_t *, const char *, ...);
 
 #endif
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,8 +8,11 @@
 
 astree_t *parser(tklist_t *);
 static astree_t *parse_prog(tklist_t **);
+static void parse_def(tklist_t **);
+static astree_t *parse_param(tklist_t **);
 static astree_t *parse_block(tklist_t **);
 static astree_t *parse_stmt(tklist_t **);
+static astree_t *parse_decl(tklist_t **, tykind_t);
 static astree_t *parse_expr(tklist_t **);
 static astree_t *parse_asg(tklist_t **);
 static astree_t *parse_eq(tklist_t **);
@@ -18,40 +22,133 @@ static astree_t *parse_mul(tklist_t **);
 static astree_t *parse_unary(tklist_t **);
 static astree_t *parse_prim(tklist_t **);
 static astree_t *parse_arg(tklist_t **);
+static bool parse_isdef(tklist_t *);
+static bool parse_istype(tklist_t *);
+static tykind_t parse_type(tklist_t **);
+static void scope_begin(idlist_t **);
+static void scope_end(idlist_t *);
+static astree_t *astree_at(astree_t *, tklist_t *);
+static astree_t *astree_newdef(char *, tykind_t);
+static astree_t *astree_finddef(char *, astree_t *);
+static void astree_linkdef(astree_t *, astree_t **);
+static bool astree_sameparam(astree_t *, astree_t *);
 static astree_t *astree_newif(astree_t *, astree_t *, astree_t *);
 static astree_t *astree_newwhile(astree_t *, astree_t *);
 static astree_t *astree_newfor(astree_t *, astree_t *, astree_t *, astree_t *);
 static astree_t *astree_newret(astree_t *);
 static astree_t *astree_newblk(astree_t *, astree_t *);
 static astree_t *astree_newbin(askind_t, astree_t *, astree_t *);
-static astree_t *astree_newfnc(char *);
+static astree_t *astree_newcast(tykind_t, astree_t *);
+static astree_t *astree_newfnc(char *, astree_t *);
 static astree_t *astree_newarg(astree_t *, astree_t *);
-static astree_t *astree_newvar(char *);
+static astree_t *astree_newvar(idlist_t *);
 static astree_t *astree_newnum(long long);
-static idlist_t *idlist_newvar(char *, idlist_t *);
+static idlist_t *idlist_newvar(char *, tykind_t, idlist_t *);
 static idlist_t *idlist_findvar(char *, idlist_t *);
+static idlist_t *idlist_findscope(char *, idlist_t *, idlist_t *);
 static void idlist_freevar(idlist_t *);
-void astree_show(astree_t *);
-static void astree_show_impl(astree_t *);
+size_t tykind_size(tykind_t);
+static tykind_t tykind_promote(tykind_t);
+static tykind_t tykind_common(tykind_t, tykind_t);
+void astree_show(FILE *, astree_t *);
+static void astree_show_impl(FILE *, astree_t *);
+static const char *tykind_name(tykind_t);
+size_t astree_count(astree_t *);
 void astree_free(astree_t *);
 
-idlist_t *local;
-size_t jmp = 0;
+static _Thread_local astree_t *global;
+static _Thread_local astree_t *func;
+static _Thread_local idlist_t *local;
+static _Thread_local idlist_t *scope;
+static _Thread_local size_t jmp;
 
 astree_t *parser(tklist_t *tkl) {
-    local = malloc(sizeof(idlist_t));
-    local->id = NULL;
-    local->ofs = 0;
-    local->next = NULL;
+    global = NULL;
+    jmp = 0;
     astree_t *ast = parse_prog(&tkl);
-    idlist_freevar(local);
     return ast;
 }
 
 astree_t *parse_prog(tklist_t **tkl) {
-    astree_t *ast = parse_block(tkl);
+    if (parse_isdef(*tkl)) {
+        while (tklist_exist(*tkl)) {
+            parse_def(tkl);
+        }
+        return global;
+    }
+    local = NULL;
+    scope = NULL;
+    func = astree_newdef("main", TY_INT);
+    func->line = func->col = 1;
+    func->def_proto = false;
+    func->def_body = parse_block(tkl);
     assert(!tklist_exist(*tkl));
-    return ast;
+    func->def_local = local;
+    return func;
+}
+
+void parse_def(tklist_t **tkl) {
+    tykind_t type = parse_type(tkl);
+    assert(tklist_match(*tkl, TK_ID));
+    tklist_t *at = *tkl;
+    char *id = at->id;
+    tklist_next(tkl);
+    local = NULL;
+    scope = NULL;
+    assert(tklist_read(tkl, TK_LPRN));
+    astree_t *def_param = parse_param(tkl);
+    assert(tklist_read(tkl, TK_RPRN));
+    astree_t *ast = astree_finddef(id, global);
+    if (ast == NULL) {
+        ast = astree_newdef(id, type);
+        ast->def_param = def_param;
+        ast->def_local = local;
+        astree_linkdef(ast, &global);
+    } else {
+        assert(ast->type == type);
+        assert(astree_sameparam(ast->def_param, def_param));
+        if (tklist_read(tkl, TK_SCLN)) {
+            astree_free(def_param);
+            idlist_freevar(local);
+            return;
+        }
+        assert(ast->def_proto);
+        astree_free(ast->def_param);
+        idlist_freevar(ast->def_local);
+        ast->def_param = def_param;
+        ast->def_local = local;
+    }
+    if (tklist_read(tkl, TK_SCLN)) {
+        return;
+    }
+    func = astree_at(ast, at);
+    ast->def_proto = false;
+    assert(tklist_read(tkl, TK_LBRC));
+    ast->def_body = parse_block(tkl);
+    assert(tklist_read(tkl, TK_RBRC));
+    ast->def_local = local;
+    return;
+}
+
+astree_t *parse_param(tklist_t **tkl) {
+    if (!parse_istype(*tkl)) {
+        return NULL;
+    }
+    tklist_t *at = *tkl;
+    tykind_t type = parse_type(tkl);
+    char *id = "";
+    if (tklist_match(*tkl, TK_ID)) {
+        id = (*tkl)->id;
+        tklist_next(tkl);
+        assert(idlist_findscope(id, local, scope) == NULL);
+    }
+    local = idlist_newvar(id, type, local);
+    astree_t *arg_val = astree_at(astree_newvar(local), at);
+    if (tklist_read(tkl, TK_CMA)) {
+        return astree_newarg(arg_val, parse_param(tkl));
+    } else {
+        return astree_newarg(arg_val, NULL);
+    }
 }
 
 astree_t *parse_block(tklist_t **tkl) {
@@ -65,6 +162,7 @@ astree_t *parse_block(tklist_t **tkl) {
 }
 
 astree_t *parse_stmt(tklist_t **tkl) {
+    tklist_t *at = *tkl;
     if (tklist_read(tkl, TK_IF)) {
         assert(tklist_read(tkl, TK_LPRN));
         astree_t *if_cond = parse_expr(tkl);
@@ -72,33 +170,48 @@ astree_t *parse_stmt(tklist_t **tkl) {
         astree_t *if_then = parse_stmt(tkl);
         if (tklist_read(tkl, TK_ELSE)) {
             astree_t *if_else = parse_stmt(tkl);
-            return astree_newif(if_cond, if_then, if_else);
+            return astree_at(astree_newif(if_cond, if_then, if_else), at);
         } else {
-            return astree_newif(if_cond, if_then, NULL);
+            return astree_at(astree_newif(if_cond, if_then, NULL), at);
         }
     } else if (tklist_read(tkl, TK_WHILE)) {
         assert(tklist_read(tkl, TK_LPRN));
         astree_t *while_cond = parse_expr(tkl);
         assert(tklist_read(tkl, TK_RPRN));
         astree_t *while_body = parse_stmt(tkl);
-        return astree_newwhile(while_cond, while_body);
+        return astree_at(astree_newwhile(while_cond, while_body), at);
     } else if (tklist_read(tkl, TK_FOR)) {
+        idlist_t *mark;
+        scope_begin(&mark);
         assert(tklist_read(tkl, TK_LPRN));
-        astree_t *for_init = parse_expr(tkl);
+        astree_t *for_init = NULL;
+        if (parse_istype(*tkl)) {
+            for_init = parse_decl(tkl, parse_type(tkl));
+        } else if (!tklist_match(*tkl, TK_SCLN)) {
+            for_init = parse_expr(tkl);
+        }
         assert(tklist_read(tkl, TK_SCLN));
-        astree_t *for_cond = parse_expr(tkl);
+        astree_t *for_cond = tklist_match(*tkl, TK_SCLN) ? NULL : parse_expr(tkl);
         assert(tklist_read(tkl, TK_SCLN));
-        astree_t *for_step = parse_expr(tkl);
+        astree_t *for_step = tklist_match(*tkl, TK_RPRN) ? NULL : parse_expr(tkl);
         assert(tklist_read(tkl, TK_RPRN));
         astree_t *for_body = parse_stmt(tkl);
-        return astree_newfor(for_init, for_cond, for_step, for_body);
+        scope_end(mark);
+        return astree_at(astree_newfor(for_init, for_cond, for_step, for_body), at);
     } else if (tklist_read(tkl, TK_RET)) {
-        astree_t *ast = astree_newret(parse_expr(tkl));
+        astree_t *ast = astree_at(astree_newret(astree_newcast(func->type, parse_expr(tkl))), at);
         assert(tklist_read(tkl, TK_SCLN));
         return ast;
     } else if (tklist_read(tkl, TK_LBRC)) {
+        idlist_t *mark;
+        scope_begin(&mark);
         astree_t *ast = parse_block(tkl);
         assert(tklist_read(tkl, TK_RBRC));
+        scope_end(mark);
+        return ast;
+    } else if (parse_istype(*tkl)) {
+        astree_t *ast = parse_decl(tkl, parse_type(tkl));
+        assert(tklist_read(tkl, TK_SCLN));
         return ast;
     } else {
         astree_t *ast = parse_expr(tkl);
@@ -107,14 +220,32 @@ astree_t *parse_stmt(tklist_t **tkl) {
     }
 }
 
+astree_t *parse_decl(tklist_t **tkl, tykind_t type) {
+    assert(tklist_match(*tkl, TK_ID));
+    tklist_t *at = *tkl;
+    char *id = at->id;
+    tklist_next(tkl);
+    assert(idlist_findscope(id, local, scope) == NULL);
+    local = idlist_newvar(id, type, local);
+    astree_t *ast = NULL;
+    if (tklist_read(tkl, TK_ASG)) {
+        ast = astree_at(astree_newbin(AS_ASG, astree_at(astree_newvar(local), at), parse_asg(tkl)), at);
+    }
+    if (tklist_read(tkl, TK_CMA)) {
+        ast = astree_newblk(ast, parse_decl(tkl, type));
+    }
+    return ast;
+}
+
 astree_t *parse_expr(tklist_t **tkl) {
     return parse_asg(tkl);
 }
 
 astree_t *parse_asg(tklist_t **tkl) {
     astree_t *ast = parse_eq(tkl);
+    tklist_t *at = *tkl;
     if (tklist_read(tkl, TK_ASG)) {
-        ast = astree_newbin(AS_ASG, ast, parse_expr(tkl));
+        ast = astree_at(astree_newbin(AS_ASG, ast, parse_expr(tkl)), at);
     }
     return ast;
 }
@@ -122,10 +253,11 @@ astree_t *parse_asg(tklist_t **tkl) {
 astree_t *parse_eq(tklist_t **tkl) {
     astree_t *ast = parse_rel(tkl);
     do {
+        tklist_t *at = *tkl;
         if (tklist_read(tkl, TK_EQ)) {
-            ast = astree_newbin(AS_EQ, ast, parse_rel(tkl));
+            ast = astree_at(astree_newbin(AS_EQ, ast, parse_rel(tkl)), at);
         } else if (tklist_read(tkl, TK_NE)) {
-            ast = astree_newbin(AS_NE, ast, parse_rel(tkl));
+            ast = astree_at(astree_newbin(AS_NE, ast, parse_rel(tkl)), at);
         } else {
             return ast;
         }
@@ -135,14 +267,15 @@ astree_t *parse_eq(tklist_t **tkl) {
 astree_t *parse_rel(tklist_t **tkl) {
     astree_t *ast = parse_add(tkl);
     do {
+        tklist_t *at = *tkl;
         if (tklist_read(tkl, TK_LT)) {
-            ast = astree_newbin(AS_LT, ast, parse_add(tkl));
+            ast = astree_at(astree_newbin(AS_LT, ast, parse_add(tkl)), at);
         } else if (tklist_read(tkl, TK_LE)) {
-            ast = astree_newbin(AS_LE, ast, parse_add(tkl));
+            ast = astree_at(astree_newbin(AS_LE, ast, parse_add(tkl)), at);
         } else if (tklist_read(tkl, TK_GT)) {
-            ast = astree_newbin(AS_GT, ast, parse_add(tkl));
+            ast = astree_at(astree_newbin(AS_GT, ast, parse_add(tkl)), at);
         } else if (tklist_read(tkl, TK_GE)) {
-            ast = astree_newbin(AS_GE, ast, parse_add(tkl));
+            ast = astree_at(astree_newbin(AS_GE, ast, parse_add(tkl)), at);
         } else {
             return ast;
         }
@@ -152,10 +285,11 @@ astree_t *parse_rel(tklist_t **tkl) {
 astree_t *parse_add(tklist_t **tkl) {
     astree_t *ast = parse_mul(tkl);
     do {
+        tklist_t *at = *tkl;
         if (tklist_read(tkl, TK_ADD)) {
-            ast = astree_newbin(AS_ADD, ast, parse_mul(tkl));
+            ast = astree_at(astree_newbin(AS_ADD, ast, parse_mul(tkl)), at);
         } else if (tklist_read(tkl, TK_SUB)) {
-            ast = astree_newbin(AS_SUB, ast, parse_mul(tkl));
+            ast = astree_at(astree_newbin(AS_SUB, ast, parse_mul(tkl)), at);
         } else {
             return ast;
         }
@@ -165,12 +299,13 @@ astree_t *parse_add(tklist_t **tkl) {
 astree_t *parse_mul(tklist_t **tkl) {
     astree_t *ast = parse_unary(tkl);
     do {
+        tklist_t *at = *tkl;
         if (tklist_read(tkl, TK_MUL)) {
-            ast = astree_newbin(AS_MUL, ast, parse_unary(tkl));
+            ast = astree_at(astree_newbin(AS_MUL, ast, parse_unary(tkl)), at);
         } else if (tklist_read(tkl, TK_DIV)) {
-            ast = astree_newbin(AS_DIV, ast, parse_unary(tkl));
+            ast = astree_at(astree_newbin(AS_DIV, ast, parse_unary(tkl)), at);
         } else if (tklist_read(tkl, TK_MOD)) {
-            ast = astree_newbin(AS_MOD, ast, parse_unary(tkl));
+            ast = astree_at(astree_newbin(AS_MOD, ast, parse_unary(tkl)), at);
         } else {
             return ast;
         }
@@ -178,10 +313,16 @@ astree_t *parse_mul(tklist_t **tkl) {
 }
 
 astree_t *parse_unary(tklist_t **tkl) {
+    tklist_t *at = *tkl;
     if (tklist_read(tkl, TK_ADD)) {
-        return astree_newbin(AS_ADD, astree_newnum(0), parse_unary(tkl));
+        return astree_at(astree_newbin(AS_ADD, astree_at(astree_newnum(0), at), parse_unary(tkl)), at);
     } else if (tklist_read(tkl, TK_SUB)) {
-        return astree_newbin(AS_SUB, astree_newnum(0), parse_unary(tkl));
+        return astree_at(astree_newbin(AS_SUB, astree_at(astree_newnum(0), at), parse_unary(tkl)), at);
+    } else if (tklist_match(*tkl, TK_LPRN) && parse_istype((*tkl)->next)) {
+        tklist_next(tkl);
+        tykind_t type = parse_type(tkl);
+        assert(tklist_read(tkl, TK_RPRN));
+        return astree_newcast(type, parse_unary(tkl));
     } else {
         return parse_prim(tkl);
     }
@@ -194,19 +335,21 @@ astree_t *parse_prim(tklist_t **tkl) {
         return ast;
     } else if (tklist_match(*tkl, TK_ID)) {
         if (tklist_match((*tkl)->next, TK_LPRN)) {
-            astree_t *ast = astree_newfnc((*tkl)->id);
+            tklist_t *at = *tkl;
             assert(tklist_read(tkl, TK_ID));
             assert(tklist_read(tkl, TK_LPRN));
-            ast->fnc_arg = parse_arg(tkl);
+            astree_t *ast = astree_at(astree_newfnc(at->id, parse_arg(tkl)), at);
             assert(tklist_read(tkl, TK_RPRN));
             return ast;
         } else {
-            astree_t *ast = astree_newvar((*tkl)->id);
+            tklist_t *at = *tkl;
+            idlist_t *idl = idlist_findvar(at->id, local);
+            assert(idl != NULL);
             assert(tklist_read(tkl, TK_ID));
-            return ast;
+            return astree_at(astree_newvar(idl), at);
         }
     } else if (tklist_match(*tkl, TK_NUM)) {
-        astree_t *ast = astree_newnum((*tkl)->num);
+        astree_t *ast = astree_at(astree_newnum((*tkl)->num), *tkl);
         tklist_next(tkl);
         return ast;
     } else {
@@ -228,9 +371,113 @@ astree_t *parse_arg(tklist_t **tkl) {
     }
 }
 
+bool parse_isdef(tklist_t *tkl) {
+    if (!parse_istype(tkl)) {
+        return false;
+    }
+    parse_type(&tkl);
+    return tklist_match(tkl, TK_ID) && tklist_match(tkl->next, TK_LPRN);
+}
+
+bool parse_istype(tklist_t *tkl) {
+    return tklist_match(tkl, TK_CHAR) || tklist_match(tkl, TK_SHORT) || tklist_match(tkl, TK_INT) || tklist_match(tkl, TK_LONG);
+}
+
+tykind_t parse_type(tklist_t **tkl) {
+    if (tklist_read(tkl, TK_CHAR)) {
+        return TY_CHAR;
+    } else if (tklist_read(tkl, TK_SHORT)) {
+        tklist_read(tkl, TK_INT);
+        return TY_SHORT;
+    } else if (tklist_read(tkl, TK_INT)) {
+        return TY_INT;
+    } else if (tklist_read(tkl, TK_LONG)) {
+        tklist_read(tkl, TK_LONG);
+        tklist_read(tkl, TK_INT);
+        return TY_LONG;
+    } else {
+        assert(false);
+    }
+}
+
+void scope_begin(idlist_t **mark) {
+    *mark = scope;
+    scope = local;
+    return;
+}
+
+void scope_end(idlist_t *mark) {
+    for (idlist_t *idl = local; idl != scope; idl = idl->next) {
+        idl->hide = true;
+    }
+    scope = mark;
+    return;
+}
+
+astree_t *astree_at(astree_t *ast, tklist_t *tkl) {
+#ifdef NO_POSITIONS
+    (void)tkl;
+#else
+    ast->line = tkl->line;
+    ast->col = tkl->col;
+#endif
+    return ast;
+}
+
+astree_t *astree_newdef(char *id, tykind_t type) {
+    astree_t *ast = malloc(sizeof(astree_t));
+    ast->kind = AS_DEF;
+    ast->line = 0;
+    ast->col = 0;
+    ast->lo = LLONG_MIN;
+    ast->hi = LLONG_MAX;
+    ast->type = type;
+    ast->def_id = id;
+    ast->def_param = NULL;
+    ast->def_body = NULL;
+    ast->def_local = NULL;
+    ast->def_size = 0;
+    ast->def_nreg = 0;
+    ast->def_leaf = true;
+    ast->def_proto = true;
+    ast->def_next = NULL;
+    return ast;
+}
+
+astree_t *astree_finddef(char *id, astree_t *ast) {
+    if (ast == NULL) {
+        return NULL;
+    }
+    if (strcmp(id, ast->def_id) == 0) {
+        return ast;
+    }
+    return astree_finddef(id, ast->def_next);
+}
+
+void astree_linkdef(astree_t *ast, astree_t **def) {
+    if (*def == NULL) {
+        *def = ast;
+        return;
+    }
+    astree_linkdef(ast, &(*def)->def_next);
+    return;
+}
+
+bool astree_sameparam(astree_t *left, astree_t *right) {
+    if (left == NULL || right == NULL) {
+        return left == right;
+    }
+    return left->arg_val->type == right->arg_val->type && astree_sameparam(left->arg_next, right->arg_next);
+}
+
 astree_t *astree_newblk(astree_t *blk_body, astree_t *blk_next) {
     astree_t *ast = malloc(sizeof(astree_t));
     ast->kind = AS_BLK;
+    ast->line = blk_body != NULL ? blk_body->line : 0;
+    ast->col = blk_body != NULL ? blk_body->col : 0;
+    ast->lo = LLONG_MIN;
+    ast->hi = LLONG_MAX;
+    ast->type = TY_INT;
     ast->blk_body = blk_body;
     ast->blk_next = blk_next;
     return ast;
@@ -239,6 +486,11 @@ astree_t *astree_newblk(astree_t *blk_body, astree_t *blk_next) {
 astree_t *astree_newif(astree_t *if_cond, astree_t *if_then, astree_t *if_else) {
     astree_t *ast = malloc(sizeof(astree_t));
     ast->kind = AS_IF;
+    ast->line = 0;
+    ast->col = 0;
+    ast->lo = LLONG_MIN;
+    ast->hi = LLONG_MAX;
+    ast->type = TY_INT;
     ast->if_cond = if_cond;
     ast->if_then = if_then;
     ast->if_else = if_else;
@@ -249,6 +501,11 @@ astree_t *astree_newif(astree_t *if_cond, astree_t *if_then, astree_t *if_else)
 astree_t *astree_newwhile(astree_t *while_cond, astree_t *while_body) {
     astree_t *ast = malloc(sizeof(astree_t));
     ast->kind = AS_WHILE;
+    ast->line = 0;
+    ast->col = 0;
+    ast->lo = LLONG_MIN;
+    ast->hi = LLONG_MAX;
+    ast->type = TY_INT;
     ast->while_cond = while_cond;
     ast->while_body = while_body;
     ast->while_jmp = jmp++;
@@ -258,6 +515,11 @@ astree_t *astree_newwhile(astree_t *while_cond, astree_t *while_body) {
 astree_t *astree_newfor(astree_t *for_init, astree_t *for_cond, astree_t *for_step, astree_t *for_body) {
     astree_t *ast = malloc(sizeof(astree_t));
     ast->kind = AS_FOR;
+    ast->line = 0;
+    ast->col = 0;
+    ast->lo = LLONG_MIN;
+    ast->hi = LLONG_MAX;
+    ast->type = TY_INT;
     ast->for_init = for_init;
     ast->for_cond = for_cond;
     ast->for_step = for_step;
@@ -269,6 +531,11 @@ astree_t *astree_newfor(astree_t *for_init, astree_t *for_cond, astree_t *for_st
 astree_t *astree_newret(astree_t *val) {
     astree_t *ast = malloc(sizeof(astree_t));
     ast->kind = AS_RET;
+    ast->line = 0;
+    ast->col = 0;
+    ast->lo = LLONG_MIN;
+    ast->hi = LLONG_MAX;
+    ast->type = TY_INT;
     ast->ret_val = val;
     return ast;
 }
@@ -276,41 +543,129 @@ astree_t *astree_newret(astree_t *val) {
 astree_t *astree_newbin(askind_t kind, astree_t *bin_left, astree_t *bin_right) {
     astree_t *ast = malloc(sizeof(astree_t));
     ast->kind = kind;
-    ast->bin_left = bin_left;
-    ast->bin_right = bin_right;
+    ast->line = 0;
+    ast->col = 0;
+    ast->lo = LLONG_MIN;
+    ast->hi = LLONG_MAX;
+    switch (kind) {
+    case AS_ADD:
+    case AS_SUB:
+    case AS_MUL:
+    case AS_DIV:
+    case AS_MOD:
+        ast->type = tykind_common(bin_left->type, bin_right->type);
+        ast->bin_left = astree_newcast(ast->type, bin_left);
+        ast->bin_right = astree_newcast(ast->type, bin_right);
+        break;
+    case AS_EQ:
+    case AS_NE:
+    case AS_LT:
+    case AS_LE:
+    case AS_GT:
+    case AS_GE:
+        ast->type = TY_INT;
+        ast->bin_left = astree_newcast(tykind_common(bin_left->type, bin_right->type), bin_left);
+        ast->bin_right = astree_newcast(tykind_common(bin_left->type, bin_right->type), bin_right);
+        break;
+    case AS_ASG:
+        assert(bin_left->kind == AS_VAR);
+        ast->type = bin_left->type;
+        ast->bin_left = bin_left;
+        ast->bin_right = astree_newcast(ast->type, bin_right);
+        break;
+    default:
+        assert(false);
+    }
     return ast;
 }
 
-astree_t *astree_newfnc(char *id) {
+astree_t *astree_newcast(tykind_t type, astree_t *cast_val) {
+    if (cast_val->type == type) {
+        return cast_val;
+    }
+    if (cast_val->kind == AS_NUM) {
+        if (type == TY_CHAR) {
+            cast_val->num_val = (signed char)cast_val->num_val;
+        } else if (type == TY_SHORT) {
+            cast_val->num_val = (short)cast_val->num_val;
+        } else if (type == TY_INT) {
+            cast_val->num_val = (int)cast_val->num_val;
+        }
+        cast_val->type = type;
+        return cast_val;
+    }
+    astree_t *ast = malloc(sizeof(astree_t));
+    ast->kind = AS_CAST;
+    ast->line = cast_val->line;
+    ast->col = cast_val->col;
+    ast->lo = LLONG_MIN;
+    ast->hi = LLONG_MAX;
+    ast->type = type;
+    ast->cast_val = cast_val;
+    return ast;
+}
+
+astree_t *astree_newfnc(char *id, astree_t *fnc_arg) {
     astree_t *ast = malloc(sizeof(astree_t));
     ast->kind = AS_FNC;
+    ast->line = 0;
+    ast->col = 0;
+    ast->lo = LLONG_MIN;
+    ast->hi = LLONG_MAX;
     ast->fnc_id = id;
+    ast->fnc_arg = fnc_arg;
+    astree_t *def = ast->fnc_def = astree_finddef(id, global);
+    if (def != NULL) {
+        ast->type = def->type;
+        astree_t *param = def->def_param;
+        for (astree_t *arg = fnc_arg; arg != NULL; arg = arg->arg_next) {
+            assert(param != NULL);
+            arg->arg_val = astree_newcast(param->arg_val->type, arg->arg_val);
+            param = param->arg_next;
+        }
+        assert(param == NULL);
+    } else {
+        ast->type = TY_INT;
+        for (astree_t *arg = fnc_arg; arg != NULL; arg = arg->arg_next) {
+            arg->arg_val = astree_newcast(tykind_promote(arg->arg_val->type), arg->arg_val);
+        }
+    }
     return ast;
 }
 
 astree_t *astree_newarg(astree_t *arg_val, astree_t *arg_next) {
     astree_t *ast = malloc(sizeof(astree_t));
     ast->kind = AS_ARG;
+    ast->line = 0;
+    ast->col = 0;
+    ast->lo = LLONG_MIN;
+    ast->hi = LLONG_MAX;
+    ast->type = TY_INT;
     ast->arg_val = arg_val;
     ast->arg_next = arg_next;
     return ast;
 }
 
-astree_t *astree_newvar(char *id) {
-    idlist_t *idl = idlist_findvar(id, local);
-    if (idl == NULL) {
-        idl = local = idlist_newvar(id, local);
-    }
+astree_t *astree_newvar(idlist_t *idl) {
     astree_t *ast = malloc(sizeof(astree_t));
     ast->kind = AS_VAR;
-    ast->var_id = idl->id;
-    ast->var_ofs = idl->ofs;
+    ast->line = 0;
+    ast->col = 0;
+    ast->lo = LLONG_MIN;
+    ast->hi = LLONG_MAX;
+    ast->type = idl->type;
+    ast->var_idl = idl;
     return ast;
 }
 
 astree_t *astree_newnum(long long num) {
     astree_t *ast = malloc(sizeof(astree_t));
     ast->kind = AS_NUM;
+    ast->line = 0;
+    ast->col = 0;
+    ast->lo = LLONG_MIN;
+    ast->hi = LLONG_MAX;
+    ast->type = num <= INT_MAX ? TY_INT : TY_LONG;
     ast->num_val = num;
     return ast;
 }
@@ -319,16 +674,30 @@ idlist_t *idlist_findvar(char *id, idlist_t *idl) {
     if (idl == NULL) {
         return NULL;
     }
-    if (idl->id != NULL && strcmp(id, idl->id) == 0) {
+    if (!idl->hide && strcmp(id, idl->id) == 0) {
         return idl;
     }
     return idlist_findvar(id, idl->next);
 }
 
-idlist_t *idlist_newvar(char *id, idlist_t *next) {
+idlist_t *idlist_findscope(char *id, idlist_t *idl, idlist_t *end) {
+    if (idl == end) {
+        return NULL;
+    }
+    if (strcmp(id, idl->id) == 0) {
+        return idl;
+    }
+    return idlist_findscope(id, idl->next, end);
+}
+
+idlist_t *idlist_newvar(char *id, tykind_t type, idlist_t *next) {
     idlist_t *idl = malloc(sizeof(idlist_t));
     idl->id = id;
-    idl->ofs = next->ofs + 1;
+    idl->type = type;
+    idl->idx = next != NULL ? next->idx + 1 : 0;
+    idl->ofs = 0;
+    idl->reg = 0;
+    idl->hide = false;
     idl->next = next;
     return idl;
 }
@@ -342,133 +711,256 @@ void idlist_freevar(idlist_t *idl) {
     return;
 }
 
-void astree_show(astree_t *ast) {
-    fputs("astree:", stdout);
-    astree_show_impl(ast);
-    putchar('\n');
+size_t tykind_size(tykind_t type) {
+    switch (type) {
+    case TY_CHAR:
+        return 1;
+    case TY_SHORT:
+        return 2;
+    case TY_INT:
+        return 4;
+    case TY_LONG:
+        return 8;
+    default:
+        assert(false);
+    }
+}
+
+tykind_t tykind_promote(tykind_t type) {
+    return type < TY_INT ? TY_INT : type;
+}
+
+tykind_t tykind_common(tykind_t left, tykind_t right) {
+    left = tykind_promote(left);
+    right = tykind_promote(right);
+    return left > right ? left : right;
+}
+
+void astree_show(FILE *ofp, astree_t *ast) {
+    fputs("astree:", ofp);
+    astree_show_impl(ofp, ast);
+    fputc('\n', ofp);
     return;
 }
 
-void astree_show_impl(astree_t *ast) {
+void astree_show_impl(FILE *ofp, astree_t *ast) {
     if (ast == NULL) {
         return;
     }
-    fputs(" (", stdout);
+    fputs(" (", ofp);
     switch (ast->kind) {
+    case AS_DEF:
+        fprintf(ofp, "AS_DEF: '%s' %s", ast->def_id, tykind_name(ast->type));
+        astree_show_impl(ofp, ast->def_param);
+        astree_show_impl(ofp, ast->def_body);
+        astree_show_impl(ofp, ast->def_next);
+        break;
     case AS_BLK:
-        fputs("AS_BLK:", stdout);
-        astree_show_impl(ast->blk_body);
-        astree_show_impl(ast->blk_next);
+        fputs("AS_BLK:", ofp);
+        astree_show_impl(ofp, ast->blk_body);
+        astree_show_impl(ofp, ast->blk_next);
         break;
     case AS_IF:
-        fputs("AS_IF:", stdout);
-        astree_show_impl(ast->if_cond);
-        astree_show_impl(ast->if_then);
-        astree_show_impl(ast->if_else);
+        fputs("AS_IF:", ofp);
+        astree_show_impl(ofp, ast->if_cond);
+        astree_show_impl(ofp, ast->if_then);
+        astree_show_impl(ofp, ast->if_else);
         break;
     case AS_WHILE:
-        fputs("AS_WHILE:", stdout);
-        astree_show_impl(ast->while_cond);
-        astree_show_impl(ast->while_body);
+        fputs("AS_WHILE:", ofp);
+        astree_show_impl(ofp, ast->while_cond);
+        astree_show_impl(ofp, ast->while_body);
         break;
     case AS_FOR:
-        fputs("AS_FOR:", stdout);
-        astree_show_impl(ast->for_init);
-        astree_show_impl(ast->for_cond);
-        astree_show_impl(ast->for_step);
-        astree_show_impl(ast->for_body);
+        fputs("AS_FOR:", ofp);
+        astree_show_impl(ofp, ast->for_init);
+        astree_show_impl(ofp, ast->for_cond);
+        astree_show_impl(ofp, ast->for_step);
+        astree_show_impl(ofp, ast->for_body);
         break;
     case AS_RET:
-        fputs("AS_RET:", stdout);
-        astree_show_impl(ast->ret_val);
+        fputs("AS_RET:", ofp);
+        astree_show_impl(ofp, ast->ret_val);
         break;
     case AS_ADD:
-        fputs("AS_ADD:", stdout);
-        astree_show_impl(ast->bin_left);
-        astree_show_impl(ast->bin_right);
+        fputs("AS_ADD:", ofp);
+        astree_show_impl(ofp, ast->bin_left);
+        astree_show_impl(ofp, ast->bin_right);
         break;
     case AS_SUB:
-        fputs("AS_SUB:", stdout);
-        astree_show_impl(ast->bin_left);
-        astree_show_impl(ast->bin_right);
+        fputs("AS_SUB:", ofp);
+        astree_show_impl(ofp, ast->bin_left);
+        astree_show_impl(ofp, ast->bin_right);
         break;
     case AS_MUL:
-        fputs("AS_MUL:", stdout);
-        astree_show_impl(ast->bin_left);
-        astree_show_impl(ast->bin_right);
+        fputs("AS_MUL:", ofp);
+        astree_show_impl(ofp, ast->bin_left);
+        astree_show_impl(ofp, ast->bin_right);
         break;
     case AS_DIV:
-        fputs("AS_DIV:", stdout);
-        astree_show_impl(ast->bin_left);
-        astree_show_impl(ast->bin_right);
+        fputs("AS_DIV:", ofp);
+        astree_show_impl(ofp, ast->bin_left);
+        astree_show_impl(ofp, ast->bin_right);
         break;
     case AS_MOD:
-        fputs("AS_MOD:", stdout);
-        astree_show_impl(ast->bin_left);
-        astree_show_impl(ast->bin_right);
+        fputs("AS_MOD:", ofp);
+        astree_show_impl(ofp, ast->bin_left);
+        astree_show_impl(ofp, ast->bin_right);
         break;
     case AS_EQ:
-        fputs("AS_EQ:", stdout);
-        astree_show_impl(ast->bin_left);
-        astree_show_impl(ast->bin_right);
+        fputs("AS_EQ:", ofp);
+        astree_show_impl(ofp, ast->bin_left);
+        astree_show_impl(ofp, ast->bin_right);
         break;
     case AS_NE:
-        fputs("AS_NE:", stdout);
-        astree_show_impl(ast->bin_left);
-        astree_show_impl(ast->bin_right);
+        fputs("AS_NE:", ofp);
+        astree_show_impl(ofp, ast->bin_left);
+        astree_show_impl(ofp, ast->bin_right);
         break;
     case AS_LT:
-        fputs("AS_LT:", stdout);
-        astree_show_impl(ast->bin_left);
-        astree_show_impl(ast->bin_right);
+        fputs("AS_LT:", ofp);
+        astree_show_impl(ofp, ast->bin_left);
+        astree_show_impl(ofp, ast->bin_right);
         break;
     case AS_LE:
-        fputs("AS_LE:", stdout);
-        astree_show_impl(ast->bin_left);
-        astree_show_impl(ast->bin_right);
+        fputs("AS_LE:", ofp);
+        astree_show_impl(ofp, ast->bin_left);
+        astree_show_impl(ofp, ast->bin_right);
         break;
     case AS_GT:
-        fputs("AS_GT:", stdout);
-        astree_show_impl(ast->bin_left);
-        astree_show_impl(ast->bin_right);
+        fputs("AS_GT:", ofp);
+        astree_show_impl(ofp, ast->bin_left);
+        astree_show_impl(ofp, ast->bin_right);
         break;
     case AS_GE:
-        fputs("AS_GE:", stdout);
-        astree_show_impl(ast->bin_left);
-        astree_show_impl(ast->bin_right);
+        fputs("AS_GE:", ofp);
+        astree_show_impl(ofp, ast->bin_left);
+        astree_show_impl(ofp, ast->bin_right);
         break;
     case AS_ASG:
-        fputs("AS_ASG:", stdout);
-        astree_show_impl(ast->bin_left);
-        astree_show_impl(ast->bin_right);
+        fputs("AS_ASG:", ofp);
+        astree_show_impl(ofp, ast->bin_left);
+        astree_show_impl(ofp, ast->bin_right);
+        break;
+    case AS_CAST:
+        fprintf(ofp, "AS_CAST: %s", tykind_name(ast->type));
+        astree_show_impl(ofp, ast->cast_val);
         break;
     case AS_FNC:
-        fprintf(stdout, "AS_FNC: '%s'", ast->fnc_id);
-        astree_show_impl(ast->fnc_arg);
+        fprintf(ofp, "AS_FNC: '%s'", ast->fnc_id);
+        astree_show_impl(ofp, ast->fnc_arg);
         break;
     case AS_ARG:
-        fputs("AS_ARG:", stdout);
-        astree_show_impl(ast->arg_val);
-        astree_show_impl(ast->arg_next);
+        fputs("AS_ARG:", ofp);
+        astree_show_impl(ofp, ast->arg_val);
+        astree_show_impl(ofp, ast->arg_next);
         break;
     case AS_VAR:
-        printf("AS_VAR: '%s'", ast->var_id);
+        fprintf(ofp, "AS_VAR: '%s' %s", ast->var_idl->id, tykind_name(ast->type));
         break;
     case AS_NUM:
-        printf("AS_NUM: '%lld'", ast->num_val);
+        fprintf(ofp, "AS_NUM: '%lld'", ast->num_val);
         break;
     default:
         assert(false);
     }
-    fputs(")", stdout);
+    fputs(")", ofp);
     return;
 }
 
+const char *tykind_name(tykind_t type) {
+    switch (type) {
+    case TY_CHAR:
+        return "char";
+    case TY_SHORT:
+        return "short";
+    case TY_INT:
+        return "int";
+    case TY_LONG:
+        return "long";
+    default:
+        assert(false);
+    }
+}
+
+size_t astree_count(astree_t *ast) {
+    if (ast == NULL) {
+        return 0;
+    }
+    size_t n = 1;
+    switch (ast->kind) {
+    case AS_DEF:
+        n += astree_count(ast->def_param);
+        n += astree_count(ast->def_body);
+        n += astree_count(ast->def_next);
+        break;
+    case AS_BLK:
+        n += astree_count(ast->blk_body);
+        n += astree_count(ast->blk_next);
+        break;
+    case AS_IF:
+        n += astree_count(ast->if_cond);
+        n += astree_count(ast->if_then);
+        n += astree_count(ast->if_else);
+        break;
+    case AS_WHILE:
+        n += astree_count(ast->while_cond);
+        n += astree_count(ast->while_body);
+        break;
+    case AS_FOR:
+        n += astree_count(ast->for_init);
+        n += astree_count(ast->for_cond);
+        n += astree_count(ast->for_step);
+        n += astree_count(ast->for_body);
+        break;
+    case AS_RET:
+        n += astree_count(ast->ret_val);
+        break;
+    case AS_ADD:
+    case AS_SUB:
+    case AS_MUL:
+    case AS_DIV:
+    case AS_MOD:
+    case AS_EQ:
+    case AS_NE:
+    case AS_LT:
+    case AS_LE:
+    case AS_GT:
+    case AS_GE:
+    case AS_ASG:
+        n += astree_count(ast->bin_left);
+        n += astree_count(ast->bin_right);
+        break;
+    case AS_CAST:
+        n += astree_count(ast->cast_val);
+        break;
+    case AS_FNC:
+        n += astree_count(ast->fnc_arg);
+        break;
+    case AS_ARG:
+        n += astree_count(ast->arg_val);
+        n += astree_count(ast->arg_next);
+        break;
+    case AS_VAR:
+    case AS_NUM:
+        break;
+    default:
+        assert(false);
+    }
+    return n;
+}
+
 void astree_free(astree_t *ast) {
     if (ast == NULL) {
         return;
     }
     switch (ast->kind) {
+    case AS_DEF:
+        astree_free(ast->def_param);
+        astree_free(ast->def_body);
+        idlist_freevar(ast->def_local);
+        astree_free(ast->def_next);
+        break;
     case AS_BLK:
         astree_free(ast->blk_body);
         astree_free(ast->blk_next);
@@ -506,6 +998,9 @@ void astree_free(astree_t *ast) {
         astree_free(ast->bin_left);
         astree_free(ast->bin_right);
         break;
+    case AS_CAST:
+        astree_free(ast->cast_val);
+        break;
     case AS_FNC:
         astree_free(ast->fnc_arg);
         break;
@@ -0,0 +1,499 @@
+#include <assert.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+
+#define NWINDOW 8
+
+typedef struct {
+    char *name;
+    bool (*apply)(size_t);
+    size_t hit;
+} phrule_t;
+
+/* Debug directives around a window slot: .loc lines before it, .cfi_ lines
+   after it. */
+typedef struct {
+    char pre[INSN_NOTE];
+    char post[INSN_NOTE];
+} phnote_t;
+
+void peephole(FILE *, FILE *);
+void peephole_report(FILE *);
+void insn_read(insn_t *, char *);
+void insn_write(FILE *, insn_t *);
+bool insn_isloc(char *);
+bool insn_iscfi(char *);
+void insn_note(char *, char *);
+static bool peephole_apply(size_t);
+static size_t peephole_start(void);
+static insn_t *window_at(size_t);
+static phnote_t *note_at(size_t);
+static void window_push(char *, char *);
+static void window_write(FILE *, size_t);
+static void window_drop(size_t);
+static void window_move(size_t, size_t);
+static void window_keep(size_t);
+static void note_copy(char *, char *);
+static bool insn_is(size_t, char *, size_t);
+static bool arg_isreg(char *);
+static bool arg_ismem(char *);
+static bool rule_pushpop(size_t);
+static bool rule_strldr(size_t);
+static bool rule_reload(size_t);
+static bool rule_jumpnext(size_t);
+static bool rule_dead(size_t);
+static bool rule_selfmov(size_t);
+
+static _Thread_local insn_t window[NWINDOW];
+static _Thread_local char text[NWINDOW][INSN_LINE];
+static _Thread_local phnote_t note[NWINDOW];
+static _Thread_local size_t head;
+static _Thread_local size_t nwindow;
+static _Thread_local char orphan[INSN_NOTE];
+static _Thread_local bool noted;
+
+static _Thread_local phrule_t rule[] = {
+    {"push-pop", rule_pushpop, 0},
+    {"str-ldr-sp", rule_strldr, 0},
+    {"store-reload", rule_reload, 0},
+    {"jump-to-next", rule_jumpnext, 0},
+    {"dead-after-jump", rule_dead, 0},
+    {"self-move", rule_selfmov, 0},
+};
+
+static size_t nrule = sizeof(rule) / sizeof(*rule);
+
+/* Debug directives never occupy a window slot, so they cannot split a
+   pattern; they ride on the neighbouring instruction instead. */
+void peephole(FILE *ofp, FILE *ifp) {
+    char line[INSN_LINE];
+    char pre[INSN_NOTE] = "";
+    while (fgets(line, sizeof(line), ifp) != NULL) {
+        size_t len = strlen(line);
+        assert(len > 0 && (line[len - 1] == '\n' || feof(ifp)));
+        if (line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        if (insn_isloc(line)) {
+            noted = true;
+            insn_note(pre, line);
+            continue;
+        }
+        if (insn_iscfi(line)) {
+            noted = true;
+            if (nwindow > 0) {
+                insn_note(note_at(nwindow - 1)->post, line);
+            } else {
+                fprintf(ofp, "%s\n", line);
+            }
+            continue;
+        }
+        if (nwindow == NWINDOW) {
+            window_write(ofp, 0);
+            window_drop(0);
+        }
+        window_push(line, pre);
+        for (size_t from = peephole_start(); peephole_apply(from); from = 0) {
+        }
+        if (nwindow == 0 && orphan[0] != '\0') {
+            fputs(orphan, ofp);
+            orphan[0] = '\0';
+        }
+    }
+    for (size_t i = 0; i < nwindow; i++) {
+        window_write(ofp, i);
+    }
+    fputs(pre, ofp);
+    head = nwindow = 0;
+    noted = false;
+    return;
+}
+
+void peephole_report(FILE *ofp) {
+    for (size_t i = 0; i < nrule; i++) {
+        fprintf(ofp, "peephole: %-16s %zu\n", rule[i].name, rule[i].hit);
+    }
+    return;
+}
+
+/* text points into line rather than copying it, so the caller keeps line
+   for as long as it uses the instruction. */
+void insn_read(insn_t *insn, char *line) {
+    insn->text = line;
+    insn->kind = IN_TEXT;
+    insn->narg = 0;
+    size_t len = strlen(line);
+    if (len > 1 && !isspace((unsigned char)line[0]) && line[len - 1] == ':') {
+        insn->kind = IN_LABEL;
+        line[len - 1] = '\0';
+        return;
+    }
+    if (!isspace((unsigned char)line[0])) {
+        return;
+    }
+    char *p = line;
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    if (!isalpha((unsigned char)*p)) {
+        return;
+    }
+    size_t n = 0;
+    while (*p != '\0' && !isspace((unsigned char)*p)) {
+        if (n + 1 == INSN_OP) {
+            return;
+        }
+        insn->op[n++] = *p++;
+    }
+    insn->op[n] = '\0';
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    while (*p != '\0') {
+        if (insn->narg == INSN_NARG) {
+            return;
+        }
+        size_t depth = 0;
+        n = 0;
+        for (; *p != '\0' && (*p != ',' || depth > 0); p++) {
+            depth += *p == '(' || *p == '[';
+            depth -= *p == ')' || *p == ']';
+            if (n + 1 == INSN_ARG) {
+                return;
+            }
+            insn->arg[insn->narg][n++] = *p;
+        }
+        while (n > 0 && isspace((unsigned char)insn->arg[insn->narg][n - 1])) {
+            n--;
+        }
+        insn->arg[insn->narg++][n] = '\0';
+        if (*p == ',') {
+            p++;
+        }
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+    }
+    insn->kind = IN_OP;
+    return;
+}
+
+void insn_write(FILE *ofp, insn_t *insn) {
+    switch (insn->kind) {
+    case IN_TEXT:
+        fprintf(ofp, "%s\n", insn->text);
+        break;
+    case IN_LABEL:
+        fprintf(ofp, "%s:\n", insn->text);
+        break;
+    case IN_OP:
+        fputs("    ", ofp);
+        fputs(insn->op, ofp);
+        for (size_t i = 0; i < insn->narg; i++) {
+            fputs(i == 0 ? " " : ", ", ofp);
+            fputs(insn->arg[i], ofp);
+        }
+        fputc('\n', ofp);
+        break;
+    default:
+        assert(false);
+    }
+    return;
+}
+
+bool insn_isloc(char *line) {
+    while (isspace((unsigned char)*line)) {
+        line++;
+    }
+    return strncmp(line, ".loc ", 5) == 0;
+}
+
+bool insn_iscfi(char *line) {
+    while (isspace((unsigned char)*line)) {
+        line++;
+    }
+    return strncmp(line, ".cfi_", 5) == 0;
+}
+
+/* Appends line to a note. Only the last .loc before an instruction takes
+   effect, so an earlier one is dropped rather than kept. */
+void insn_note(char *note, char *line) {
+    if (insn_isloc(line)) {
+        char *loc = strstr(note, ".loc ");
+        if (loc != NULL) {
+            while (loc > note && loc[-1] != '\n') {
+                loc--;
+            }
+            char *end = strchr(loc, '\n');
+            memmove(loc, end + 1, strlen(end + 1) + 1);
+        }
+    }
+    size_t len = strlen(note);
+    assert(len + strlen(line) + 1 < INSN_NOTE);
+    sprintf(note + len, "%s\n", line);
+    return;
+}
+
+bool peephole_apply(size_t from) {
+    for (size_t i = from; i < nwindow; i++) {
+        for (size_t r = 0; r < nrule; r++) {
+            if (rule[r].apply(i)) {
+                rule[r].hit++;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* Rules only look forward from where they start, and the window held no
+   match before the last slot came in, so a new match takes in that slot:
+   it starts at most one instruction before it, or at a jump ahead of the
+   labels that end the window. Any rewrite sends the scan back to 0. */
+size_t peephole_start(void) {
+    size_t from = nwindow - 1;
+    while (from > 0 && window_at(from)->kind == IN_LABEL) {
+        from--;
+    }
+    return from > 0 ? from - 1 : 0;
+}
+
+/* The window is a ring starting at head, and each slot reads its line into
+   a buffer of its own. */
+insn_t *window_at(size_t idx) {
+    return &window[(head + idx) % NWINDOW];
+}
+
+phnote_t *note_at(size_t idx) {
+    return &note[(head + idx) % NWINDOW];
+}
+
+/* The pending .loc lines in pre become the new slot's notes. */
+void window_push(char *line, char *pre) {
+    assert(nwindow < NWINDOW);
+    size_t slot = (head + nwindow++) % NWINDOW;
+    note[slot].pre[0] = note[slot].post[0] = '\0';
+    if (noted) {
+        strcpy(note[slot].pre, pre);
+        pre[0] = '\0';
+    }
+    strcpy(text[slot], line);
+    insn_read(&window[slot], text[slot]);
+    return;
+}
+
+void window_write(FILE *ofp, size_t idx) {
+    if (noted) {
+        fputs(note_at(idx)->pre, ofp);
+    }
+    insn_write(ofp, window_at(idx));
+    if (noted) {
+        fputs(note_at(idx)->post, ofp);
+        note_at(idx)->pre[0] = note_at(idx)->post[0] = '\0';
+    }
+    return;
+}
+
+/* Retiring the oldest slot only advances head; a drop further in moves the
+   few slots after it down by one. */
+void window_drop(size_t idx) {
+    assert(idx < nwindow);
+    if (noted) {
+        window_keep(idx);
+    }
+    if (idx == 0) {
+        head = (head + 1) % NWINDOW;
+    } else {
+        for (size_t i = idx; i + 1 < nwindow; i++) {
+            window_move(i, i + 1);
+        }
+    }
+    nwindow--;
+    return;
+}
+
+void window_move(size_t dst, size_t src) {
+    size_t to = (head + dst) % NWINDOW, from = (head + src) % NWINDOW;
+    window[to] = window[from];
+    window[to].text = strcpy(text[to], window[from].text);
+    note[to] = note[from];
+    return;
+}
+
+/* The notes of a dropped instruction stay where they were: in front of the
+   next one, after the previous one, or held until the window has either. */
+void window_keep(size_t idx) {
+    char merged[INSN_NOTE] = "";
+    note_copy(merged, note_at(idx)->pre);
+    note_copy(merged, note_at(idx)->post);
+    if (idx + 1 < nwindow) {
+        note_copy(merged, note_at(idx + 1)->pre);
+        strcpy(note_at(idx + 1)->pre, merged);
+    } else if (idx > 0) {
+        note_copy(note_at(idx - 1)->post, merged);
+    } else {
+        note_copy(orphan, merged);
+    }
+    return;
+}
+
+void note_copy(char *dst, char *src) {
+    char line[INSN_NOTE];
+    while (*src != '\0') {
+        size_t len = strcspn(src, "\n");
+        memcpy(line, src, len);
+        line[len] = '\0';
+        insn_note(dst, line);
+        src += len + (src[len] == '\n');
+    }
+    return;
+}
+
+bool insn_is(size_t idx, char *op, size_t narg) {
+    if (idx >= nwindow) {
+        return false;
+    }
+    insn_t *insn = window_at(idx);
+    return insn->kind == IN_OP && strcmp(insn->op, op) == 0 && insn->narg == narg;
+}
+
+bool arg_isreg(char *arg) {
+    if (arg[0] == '%') {
+        return true;
+    }
+    if ((arg[0] == 'x' || arg[0] == 'w') && isdigit((unsigned char)arg[1])) {
+        return true;
+    }
+    return strcmp(arg, "xzr") == 0 || strcmp(arg, "wzr") == 0;
+}
+
+bool arg_ismem(char *arg) {
+    return strchr(arg, '(') != NULL || (arg[0] == '[' && arg[strlen(arg) - 1] == ']');
+}
+
+/* pushq A; popq B  =>  movq A, B */
+bool rule_pushpop(size_t idx) {
+    if (!insn_is(idx, "pushq", 1) || !insn_is(idx + 1, "popq", 1)) {
+        return false;
+    }
+    insn_t *push = window_at(idx), *pop = window_at(idx + 1);
+    if (arg_ismem(push->arg[0]) && arg_ismem(pop->arg[0])) {
+        return false;
+    }
+    if (strcmp(push->arg[0], pop->arg[0]) == 0) {
+        window_drop(idx + 1);
+        window_drop(idx);
+        return true;
+    }
+    strcpy(pop->op, "movq");
+    strcpy(pop->arg[1], pop->arg[0]);
+    strcpy(pop->arg[0], push->arg[0]);
+    pop->narg = 2;
+    window_drop(idx);
+    return true;
+}
+
+/* str A, [sp, #-16]!; ldr B, [sp], #16  =>  mov B, A */
+bool rule_strldr(size_t idx) {
+    if (!insn_is(idx, "str", 2) || !insn_is(idx + 1, "ldr", 3)) {
+        return false;
+    }
+    insn_t *str = window_at(idx), *ldr = window_at(idx + 1);
+    if (strcmp(str->arg[1], "[sp, #-16]!") != 0 || strcmp(ldr->arg[1], "[sp]") != 0 || strcmp(ldr->arg[2], "#16") != 0) {
+        return false;
+    }
+    if (str->arg[0][0] != 'x' || ldr->arg[0][0] != 'x') {
+        return false;
+    }
+    if (strcmp(str->arg[0], ldr->arg[0]) == 0) {
+        window_drop(idx + 1);
+        window_drop(idx);
+        return true;
+    }
+    strcpy(ldr->op, "mov");
+    strcpy(ldr->arg[1], str->arg[0]);
+    ldr->narg = 2;
+    window_drop(idx);
+    return true;
+}
+
+/* mov A, M; mov M, B  =>  mov A, M; mov A, B  (x86-64 and aarch64 forms) */
+bool rule_reload(size_t idx) {
+    if (idx + 1 >= nwindow || window_at(idx)->kind != IN_OP || window_at(idx + 1)->kind != IN_OP) {
+        return false;
+    }
+    insn_t *st = window_at(idx), *ld = window_at(idx + 1);
+    if (st->narg != 2 || ld->narg != 2) {
+        return false;
+    }
+    char *src, *dst, *mov;
+    if (st->op[0] == 'm' && strcmp(st->op, ld->op) == 0 && (strcmp(st->op, "movq") == 0 || strcmp(st->op, "movl") == 0)) {
+        if (!arg_isreg(st->arg[0]) || !arg_ismem(st->arg[1]) || strcmp(st->arg[1], ld->arg[0]) != 0 || !arg_isreg(ld->arg[1])) {
+            return false;
+        }
+        src = st->arg[0];
+        dst = ld->arg[1];
+        mov = st->op;
+    } else if (strcmp(st->op, "str") == 0 && strcmp(ld->op, "ldr") == 0) {
+        if (!arg_isreg(st->arg[0]) || !arg_ismem(st->arg[1]) || strcmp(st->arg[1], ld->arg[1]) != 0 || st->arg[0][0] != ld->arg[0][0]) {
+            return false;
+        }
+        src = st->arg[0];
+        dst = ld->arg[0];
+        mov = "mov";
+    } else {
+        return false;
+    }
+    if (strcmp(src, dst) == 0 && (strcmp(mov, "movq") == 0 || src[0] == 'x')) {
+        window_drop(idx + 1);
+        return true;
+    }
+    char tmp[INSN_ARG];
+    strcpy(tmp, dst);
+    strcpy(ld->op, mov);
+    strcpy(ld->arg[0], src);
+    strcpy(ld->arg[1], tmp);
+    return true;
+}
+
+/* jmp L; [labels...] L:  =>  [labels...] L: */
+bool rule_jumpnext(size_t idx) {
+    if (!insn_is(idx, "jmp", 1) && !insn_is(idx, "b", 1)) {
+        return false;
+    }
+    for (size_t i = idx + 1; i < nwindow && window_at(i)->kind == IN_LABEL; i++) {
+        if (strcmp(window_at(i)->text, window_at(idx)->arg[0]) == 0) {
+            window_drop(idx);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* jmp L; insn  =>  jmp L  (likewise after ret) */
+bool rule_dead(size_t idx) {
+    if (!insn_is(idx, "jmp", 1) && !insn_is(idx, "b", 1) && !insn_is(idx, "ret", 0)) {
+        return false;
+    }
+    if (idx + 1 >= nwindow || window_at(idx + 1)->kind != IN_OP) {
+        return false;
+    }
+    window_drop(idx + 1);
+    return true;
+}
+
+/* movq A, A / mov xA, xA  =>  (nothing) */
+bool rule_selfmov(size_t idx) {
+    if (!insn_is(idx, "movq", 2) && !insn_is(idx, "mov", 2)) {
+        return false;
+    }
+    insn_t *mov = window_at(idx);
+    if (strcmp(mov->arg[0], mov->arg[1]) != 0 || !arg_isreg(mov->arg[0]) || mov->arg[0][0] == 'w') {
+        return false;
+    }
+    window_drop(idx);
+    return true;
+}
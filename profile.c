@@ -0,0 +1,178 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "main.h"
+
+#define FNV_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/* One record per branch site, as the instrumented program appends it: the
+   site key, then how often the then-side (loop body) and the else-side (loop
+   exit) ran. */
+typedef struct {
+    uint64_t key;
+    uint64_t count[2];
+} prrec_t;
+
+void profile_load(char *);
+void profile_func(char *);
+uint64_t profile_key(astree_t *);
+bool profile_count(uint64_t, uint64_t *);
+static uint64_t profile_mix(uint64_t, uint64_t);
+static uint64_t profile_str(uint64_t, char *);
+static uint64_t profile_hash(uint64_t, astree_t *);
+static int profile_cmp(const void *, const void *);
+
+static prrec_t *rec;
+static size_t nrec;
+static _Thread_local uint64_t site;
+static _Thread_local uint64_t *seen;
+static _Thread_local size_t nseen;
+static _Thread_local size_t capseen;
+
+/* Every run of an instrumented program appends its records, so the same key
+   can appear many times; they are summed into one sorted table. */
+void profile_load(char *path) {
+    FILE *fp = fopen(path, "rb");
+    assert(fp != NULL);
+    size_t cap = 0;
+    prrec_t buf;
+    while (fread(&buf, sizeof(buf), 1, fp) == 1) {
+        if (buf.key == 0) {
+            continue;
+        }
+        if (nrec == cap) {
+            cap = cap == 0 ? 256 : cap * 2;
+            rec = realloc(rec, cap * sizeof(prrec_t));
+            assert(rec != NULL);
+        }
+        rec[nrec++] = buf;
+    }
+    assert(fclose(fp) == 0);
+    qsort(rec, nrec, sizeof(prrec_t), profile_cmp);
+    size_t n = 0;
+    for (size_t i = 0; i < nrec; i++) {
+        if (n > 0 && rec[n - 1].key == rec[i].key) {
+            rec[n - 1].count[0] += rec[i].count[0];
+            rec[n - 1].count[1] += rec[i].count[1];
+        } else {
+            rec[n++] = rec[i];
+        }
+    }
+    nrec = n;
+    return;
+}
+
+void profile_func(char *id) {
+    site = profile_str(FNV_BASIS, id);
+    nseen = 0;
+    return;
+}
+
+/* A key names a site by its function, its kind and the shape of its
+   condition, plus how many identical sites precede it in the function, so
+   edits elsewhere in the file or to unrelated branches keep it stable. */
+uint64_t profile_key(astree_t *ast) {
+    uint64_t key = profile_mix(site, ast->kind);
+    switch (ast->kind) {
+    case AS_IF:
+        key = profile_hash(key, ast->if_cond);
+        break;
+    case AS_WHILE:
+        key = profile_hash(key, ast->while_cond);
+        break;
+    case AS_FOR:
+        key = profile_hash(key, ast->for_cond);
+        break;
+    default:
+        assert(false);
+    }
+    uint64_t nth = 0;
+    for (size_t i = 0; i < nseen; i++) {
+        nth += seen[i] == key;
+    }
+    if (nseen == capseen) {
+        capseen = capseen == 0 ? 64 : capseen * 2;
+        seen = realloc(seen, capseen * sizeof(uint64_t));
+        assert(seen != NULL);
+    }
+    seen[nseen++] = key;
+    key = profile_mix(key, nth);
+    return key == 0 ? 1 : key;
+}
+
+bool profile_count(uint64_t key, uint64_t *count) {
+    prrec_t probe = {key, {0, 0}};
+    prrec_t *hit = nrec == 0 ? NULL : bsearch(&probe, rec, nrec, sizeof(prrec_t), profile_cmp);
+    if (hit == NULL) {
+        return false;
+    }
+    count[0] = hit->count[0];
+    count[1] = hit->count[1];
+    return true;
+}
+
+uint64_t profile_mix(uint64_t h, uint64_t val) {
+    for (size_t i = 0; i < 8; i++) {
+        h = (h ^ (val >> (8 * i) & 0xff)) * FNV_PRIME;
+    }
+    return h;
+}
+
+uint64_t profile_str(uint64_t h, char *s) {
+    for (; *s != '\0'; s++) {
+        h = (h ^ (unsigned char)*s) * FNV_PRIME;
+    }
+    return profile_mix(h, 0);
+}
+
+uint64_t profile_hash(uint64_t h, astree_t *ast) {
+    if (ast == NULL) {
+        return profile_mix(h, UINT64_MAX);
+    }
+    h = profile_mix(h, ast->kind);
+    switch (ast->kind) {
+    case AS_ADD:
+    case AS_SUB:
+    case AS_MUL:
+    case AS_DIV:
+    case AS_MOD:
+    case AS_EQ:
+    case AS_NE:
+    case AS_LT:
+    case AS_LE:
+    case AS_GT:
+    case AS_GE:
+    case AS_ASG:
+        h = profile_hash(h, ast->bin_left);
+        h = profile_hash(h, ast->bin_right);
+        break;
+    case AS_CAST:
+        h = profile_mix(h, ast->type);
+        h = profile_hash(h, ast->cast_val);
+        break;
+    case AS_FNC:
+        h = profile_str(h, ast->fnc_id);
+        for (astree_t *arg = ast->fnc_arg; arg != NULL; arg = arg->arg_next) {
+            h = profile_hash(h, arg->arg_val);
+        }
+        break;
+    case AS_VAR:
+        h = profile_str(h, ast->var_idl->id);
+        break;
+    case AS_NUM:
+        h = profile_mix(h, ast->num_val);
+        break;
+    default:
+        assert(false);
+    }
+    return h;
+}
+
+int profile_cmp(const void *a, const void *b) {
+    uint64_t x = ((const prrec_t *)a)->key;
+    uint64_t y = ((const prrec_t *)b)->key;
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,705 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "main.h"
+
+#define NWIDEN 1
+#define NNEST 3
+
+/* A closed interval of values; lo > hi is the empty one, the range of a
+   node that no path reaches. */
+typedef struct {
+    long long lo;
+    long long hi;
+} rgspan_t;
+
+/* What is known at one point of a function: a span for each local, indexed
+   by idx, or nothing at all when no path reaches the point. */
+typedef struct {
+    rgspan_t *var;
+    bool dead;
+} rgstate_t;
+
+void ranger(astree_t *);
+bool ranger_known(astree_t *, long long *);
+static void range_def(astree_t *);
+static void range_reset(astree_t *);
+static void range_stmt(astree_t *, rgstate_t *);
+static void range_if(astree_t *, rgstate_t *);
+static void range_loop(astree_t *, rgstate_t *);
+static void range_havoc(astree_t *, rgstate_t *);
+static rgspan_t range_expr(astree_t *, rgstate_t *, bool);
+static void range_refine(astree_t *, rgstate_t *, bool);
+static void range_assume(astree_t *, rgspan_t, rgstate_t *);
+static bool range_pure(astree_t *);
+static rgspan_t span_type(tykind_t);
+static rgspan_t span_fit(rgspan_t, tykind_t);
+static rgspan_t span_arith(askind_t, rgspan_t, rgspan_t, tykind_t);
+static rgspan_t span_div(rgspan_t, rgspan_t, tykind_t);
+static rgspan_t span_mod(rgspan_t, rgspan_t, tykind_t);
+static rgspan_t span_compare(askind_t, rgspan_t, rgspan_t);
+static rgspan_t span_join(rgspan_t, rgspan_t);
+static rgspan_t span_meet(rgspan_t, rgspan_t);
+static rgspan_t span_trim(rgspan_t, rgspan_t);
+static bool span_empty(rgspan_t);
+static void state_copy(rgstate_t *, rgstate_t *);
+static bool state_join(rgstate_t *, rgstate_t *, bool);
+static void state_free(rgstate_t *);
+
+static const rgspan_t empty = {LLONG_MAX, LLONG_MIN};
+static _Thread_local tykind_t *vtype;
+static _Thread_local size_t nvtype;
+static _Thread_local size_t nvar;
+static _Thread_local size_t nest;
+
+/* Gives every expression node the range of values it takes on the paths
+   that reach it. The parser starts each node at its full range, which is
+   what the generator sees when this pass does not run. */
+void ranger(astree_t *ast) {
+    for (; ast != NULL; ast = ast->def_next) {
+        if (!ast->def_proto) {
+            range_def(ast);
+        }
+    }
+    return;
+}
+
+/* A condition with one possible value and no side effects can be dropped,
+   along with the branch it never takes. */
+bool ranger_known(astree_t *ast, long long *val) {
+    if (ast->lo != ast->hi || !range_pure(ast)) {
+        return false;
+    }
+    *val = ast->lo;
+    return true;
+}
+
+/* Parameters and locals start at their full range, which also covers a
+   local read before it is assigned. */
+void range_def(astree_t *ast) {
+    nvar = ast->def_local != NULL ? ast->def_local->idx + 1 : 0;
+    if (nvar > nvtype) {
+        nvtype = nvar;
+        vtype = realloc(vtype, nvtype * sizeof(tykind_t));
+        assert(vtype != NULL);
+    }
+    rgstate_t st = {malloc((nvar + 1) * sizeof(rgspan_t)), false};
+    assert(st.var != NULL);
+    for (idlist_t *idl = ast->def_local; idl != NULL; idl = idl->next) {
+        vtype[idl->idx] = idl->type;
+        st.var[idl->idx] = span_type(idl->type);
+    }
+    nest = 0;
+    range_reset(ast->def_body);
+    range_stmt(ast->def_body, &st);
+    state_free(&st);
+    return;
+}
+
+void range_reset(astree_t *ast) {
+    if (ast == NULL) {
+        return;
+    }
+    ast->lo = empty.lo;
+    ast->hi = empty.hi;
+    switch (ast->kind) {
+    case AS_BLK:
+        range_reset(ast->blk_body);
+        range_reset(ast->blk_next);
+        break;
+    case AS_IF:
+        range_reset(ast->if_cond);
+        range_reset(ast->if_then);
+        range_reset(ast->if_else);
+        break;
+    case AS_WHILE:
+        range_reset(ast->while_cond);
+        range_reset(ast->while_body);
+        break;
+    case AS_FOR:
+        range_reset(ast->for_init);
+        range_reset(ast->for_cond);
+        range_reset(ast->for_step);
+        range_reset(ast->for_body);
+        break;
+    case AS_RET:
+        range_reset(ast->ret_val);
+        break;
+    case AS_ADD:
+    case AS_SUB:
+    case AS_MUL:
+    case AS_DIV:
+    case AS_MOD:
+    case AS_EQ:
+    case AS_NE:
+    case AS_LT:
+    case AS_LE:
+    case AS_GT:
+    case AS_GE:
+    case AS_ASG:
+        range_reset(ast->bin_left);
+        range_reset(ast->bin_right);
+        break;
+    case AS_CAST:
+        range_reset(ast->cast_val);
+        break;
+    case AS_FNC:
+        range_reset(ast->fnc_arg);
+        break;
+    case AS_ARG:
+        range_reset(ast->arg_val);
+        range_reset(ast->arg_next);
+        break;
+    case AS_VAR:
+    case AS_NUM:
+        break;
+    default:
+        assert(false);
+    }
+    return;
+}
+
+void range_stmt(astree_t *ast, rgstate_t *st) {
+    if (ast == NULL || st->dead) {
+        return;
+    }
+    switch (ast->kind) {
+    case AS_BLK:
+        range_stmt(ast->blk_body, st);
+        range_stmt(ast->blk_next, st);
+        break;
+    case AS_IF:
+        range_if(ast, st);
+        break;
+    case AS_WHILE:
+    case AS_FOR:
+        range_loop(ast, st);
+        break;
+    case AS_RET:
+        range_expr(ast->ret_val, st, true);
+        st->dead = true;
+        break;
+    default:
+        range_expr(ast, st, true);
+        break;
+    }
+    return;
+}
+
+void range_if(astree_t *ast, rgstate_t *st) {
+    rgstate_t other;
+    range_expr(ast->if_cond, st, true);
+    state_copy(&other, st);
+    range_refine(ast->if_cond, st, true);
+    range_refine(ast->if_cond, &other, false);
+    range_stmt(ast->if_then, st);
+    range_stmt(ast->if_else, &other);
+    state_join(st, &other, false);
+    state_free(&other);
+    return;
+}
+
+/* The state at the loop head is iterated to a fixed point, widening any
+   bound still moving after NWIDEN passes to its type's limit. A loop
+   nested more than NNEST deep starts instead from the full range of
+   everything it assigns, so that deep nests stay linear. */
+void range_loop(astree_t *ast, rgstate_t *st) {
+    bool isfor = ast->kind == AS_FOR;
+    astree_t *cond = isfor ? ast->for_cond : ast->while_cond;
+    astree_t *body = isfor ? ast->for_body : ast->while_body;
+    if (isfor) {
+        range_stmt(ast->for_init, st);
+    }
+    if (st->dead) {
+        return;
+    }
+    if (nest >= NNEST) {
+        range_havoc(ast, st);
+    }
+    nest++;
+    for (size_t pass = 0;; pass++) {
+        rgstate_t cur;
+        state_copy(&cur, st);
+        if (cond != NULL) {
+            range_expr(cond, &cur, true);
+            range_refine(cond, &cur, true);
+        }
+        range_stmt(body, &cur);
+        if (isfor) {
+            range_stmt(ast->for_step, &cur);
+        }
+        bool change = state_join(st, &cur, pass >= NWIDEN);
+        state_free(&cur);
+        if (!change) {
+            break;
+        }
+    }
+    nest--;
+    if (cond != NULL) {
+        range_expr(cond, st, true);
+        range_refine(cond, st, false);
+    } else {
+        st->dead = true;
+    }
+    return;
+}
+
+void range_havoc(astree_t *ast, rgstate_t *st) {
+    if (ast == NULL) {
+        return;
+    }
+    switch (ast->kind) {
+    case AS_BLK:
+        range_havoc(ast->blk_body, st);
+        range_havoc(ast->blk_next, st);
+        break;
+    case AS_IF:
+        range_havoc(ast->if_cond, st);
+        range_havoc(ast->if_then, st);
+        range_havoc(ast->if_else, st);
+        break;
+    case AS_WHILE:
+        range_havoc(ast->while_cond, st);
+        range_havoc(ast->while_body, st);
+        break;
+    case AS_FOR:
+        range_havoc(ast->for_init, st);
+        range_havoc(ast->for_cond, st);
+        range_havoc(ast->for_step, st);
+        range_havoc(ast->for_body, st);
+        break;
+    case AS_RET:
+        range_havoc(ast->ret_val, st);
+        break;
+    case AS_ASG:
+        st->var[ast->bin_left->var_idl->idx] = span_type(ast->type);
+        range_havoc(ast->bin_right, st);
+        break;
+    case AS_ADD:
+    case AS_SUB:
+    case AS_MUL:
+    case AS_DIV:
+    case AS_MOD:
+    case AS_EQ:
+    case AS_NE:
+    case AS_LT:
+    case AS_LE:
+    case AS_GT:
+    case AS_GE:
+        range_havoc(ast->bin_left, st);
+        range_havoc(ast->bin_right, st);
+        break;
+    case AS_CAST:
+        range_havoc(ast->cast_val, st);
+        break;
+    case AS_FNC:
+        range_havoc(ast->fnc_arg, st);
+        break;
+    case AS_ARG:
+        range_havoc(ast->arg_val, st);
+        range_havoc(ast->arg_next, st);
+        break;
+    case AS_VAR:
+    case AS_NUM:
+        break;
+    default:
+        assert(false);
+    }
+    return;
+}
+
+/* With eval false nothing is assigned or recorded; the span is read off the
+   state as it stands, to refine on a condition already evaluated. Operands
+   are taken left to right, though the generator may not: a program that
+   assigns a variable in one operand and reads it in the other is undefined
+   either way. Calls cannot reach the locals, so they change no state. */
+rgspan_t range_expr(astree_t *ast, rgstate_t *st, bool eval) {
+    if (st->dead) {
+        return empty;
+    }
+    rgspan_t s;
+    switch (ast->kind) {
+    case AS_NUM:
+        s = (rgspan_t){ast->num_val, ast->num_val};
+        break;
+    case AS_VAR:
+        s = st->var[ast->var_idl->idx];
+        break;
+    case AS_ASG: {
+        size_t idx = ast->bin_left->var_idl->idx;
+        if (eval) {
+            st->var[idx] = span_fit(range_expr(ast->bin_right, st, true), ast->type);
+        }
+        s = st->var[idx];
+        break;
+    }
+    case AS_CAST:
+        s = span_fit(range_expr(ast->cast_val, st, eval), ast->type);
+        break;
+    case AS_FNC:
+        for (astree_t *arg = ast->fnc_arg; eval && arg != NULL; arg = arg->arg_next) {
+            range_expr(arg->arg_val, st, true);
+        }
+        s = span_type(ast->type);
+        break;
+    case AS_ADD:
+    case AS_SUB:
+    case AS_MUL:
+    case AS_DIV:
+    case AS_MOD: {
+        rgspan_t left = range_expr(ast->bin_left, st, eval);
+        rgspan_t right = range_expr(ast->bin_right, st, eval);
+        s = span_arith(ast->kind, left, right, ast->type);
+        break;
+    }
+    case AS_EQ:
+    case AS_NE:
+    case AS_LT:
+    case AS_LE:
+    case AS_GT:
+    case AS_GE: {
+        rgspan_t left = range_expr(ast->bin_left, st, eval);
+        rgspan_t right = range_expr(ast->bin_right, st, eval);
+        s = span_compare(ast->kind, left, right);
+        break;
+    }
+    default:
+        assert(false);
+    }
+    if (eval) {
+        rgspan_t rec = span_join((rgspan_t){ast->lo, ast->hi}, s);
+        ast->lo = rec.lo;
+        ast->hi = rec.hi;
+    }
+    return s;
+}
+
+/* Narrows st to the paths on which ast evaluates to truth. A side that
+   cannot hold leaves the state dead. */
+void range_refine(astree_t *ast, rgstate_t *st, bool truth) {
+    static askind_t inverse[] = {AS_NE, AS_EQ, AS_GE, AS_GT, AS_LE, AS_LT};
+    static const rgspan_t zero = {0, 0};
+    if (st->dead) {
+        return;
+    }
+    if (ast->kind < AS_EQ || ast->kind > AS_GE) {
+        rgspan_t s = range_expr(ast, st, false);
+        range_assume(ast, truth ? span_trim(s, zero) : span_meet(s, zero), st);
+        return;
+    }
+    askind_t kind = truth ? ast->kind : inverse[ast->kind - AS_EQ];
+    rgspan_t l = range_expr(ast->bin_left, st, false);
+    rgspan_t r = range_expr(ast->bin_right, st, false);
+    rgspan_t nl, nr;
+    switch (kind) {
+    case AS_EQ:
+        nl = nr = span_meet(l, r);
+        break;
+    case AS_NE:
+        nl = span_trim(l, r);
+        nr = span_trim(r, l);
+        break;
+    case AS_LT:
+        nl = r.hi == LLONG_MIN ? empty : span_meet(l, (rgspan_t){LLONG_MIN, r.hi - 1});
+        nr = l.lo == LLONG_MAX ? empty : span_meet(r, (rgspan_t){l.lo + 1, LLONG_MAX});
+        break;
+    case AS_LE:
+        nl = span_meet(l, (rgspan_t){LLONG_MIN, r.hi});
+        nr = span_meet(r, (rgspan_t){l.lo, LLONG_MAX});
+        break;
+    case AS_GT:
+        nl = r.lo == LLONG_MAX ? empty : span_meet(l, (rgspan_t){r.lo + 1, LLONG_MAX});
+        nr = l.hi == LLONG_MIN ? empty : span_meet(r, (rgspan_t){LLONG_MIN, l.hi - 1});
+        break;
+    case AS_GE:
+        nl = span_meet(l, (rgspan_t){r.lo, LLONG_MAX});
+        nr = span_meet(r, (rgspan_t){LLONG_MIN, l.hi});
+        break;
+    default:
+        assert(false);
+    }
+    range_assume(ast->bin_left, nl, st);
+    range_assume(ast->bin_right, nr, st);
+    return;
+}
+
+/* What a condition narrows is a variable, the variable an assignment
+   stored to, or either under a cast that kept the value unchanged. */
+void range_assume(astree_t *ast, rgspan_t s, rgstate_t *st) {
+    if (st->dead || span_empty(s)) {
+        st->dead = true;
+        return;
+    }
+    switch (ast->kind) {
+    case AS_CAST: {
+        rgspan_t in = range_expr(ast->cast_val, st, false);
+        rgspan_t fit = span_fit(in, ast->type);
+        if (fit.lo == in.lo && fit.hi == in.hi) {
+            range_assume(ast->cast_val, s, st);
+        }
+        break;
+    }
+    case AS_VAR:
+    case AS_ASG: {
+        idlist_t *idl = ast->kind == AS_VAR ? ast->var_idl : ast->bin_left->var_idl;
+        st->var[idl->idx] = span_meet(st->var[idl->idx], s);
+        if (span_empty(st->var[idl->idx])) {
+            st->dead = true;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return;
+}
+
+bool range_pure(astree_t *ast) {
+    switch (ast->kind) {
+    case AS_ADD:
+    case AS_SUB:
+    case AS_MUL:
+    case AS_DIV:
+    case AS_MOD:
+    case AS_EQ:
+    case AS_NE:
+    case AS_LT:
+    case AS_LE:
+    case AS_GT:
+    case AS_GE:
+        return range_pure(ast->bin_left) && range_pure(ast->bin_right);
+    case AS_CAST:
+        return range_pure(ast->cast_val);
+    case AS_VAR:
+    case AS_NUM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+rgspan_t span_type(tykind_t type) {
+    switch (type) {
+    case TY_CHAR:
+        return (rgspan_t){SCHAR_MIN, SCHAR_MAX};
+    case TY_SHORT:
+        return (rgspan_t){SHRT_MIN, SHRT_MAX};
+    case TY_INT:
+        return (rgspan_t){INT_MIN, INT_MAX};
+    case TY_LONG:
+        return (rgspan_t){LLONG_MIN, LLONG_MAX};
+    default:
+        assert(false);
+    }
+    return empty;
+}
+
+/* Arithmetic wraps, so a span that does not fit its type could be
+   anything in it. */
+rgspan_t span_fit(rgspan_t s, tykind_t type) {
+    rgspan_t t = span_type(type);
+    if (span_empty(s) || (s.lo >= t.lo && s.hi <= t.hi)) {
+        return s;
+    }
+    return t;
+}
+
+rgspan_t span_arith(askind_t kind, rgspan_t l, rgspan_t r, tykind_t type) {
+    if (span_empty(l) || span_empty(r)) {
+        return empty;
+    }
+    long long v[4];
+    bool over = false;
+    switch (kind) {
+    case AS_ADD:
+        over |= __builtin_add_overflow(l.lo, r.lo, &v[0]);
+        over |= __builtin_add_overflow(l.hi, r.hi, &v[1]);
+        v[2] = v[0];
+        v[3] = v[1];
+        break;
+    case AS_SUB:
+        over |= __builtin_sub_overflow(l.lo, r.hi, &v[0]);
+        over |= __builtin_sub_overflow(l.hi, r.lo, &v[1]);
+        v[2] = v[0];
+        v[3] = v[1];
+        break;
+    case AS_MUL:
+        over |= __builtin_mul_overflow(l.lo, r.lo, &v[0]);
+        over |= __builtin_mul_overflow(l.lo, r.hi, &v[1]);
+        over |= __builtin_mul_overflow(l.hi, r.lo, &v[2]);
+        over |= __builtin_mul_overflow(l.hi, r.hi, &v[3]);
+        break;
+    case AS_DIV:
+        return span_div(l, r, type);
+    case AS_MOD:
+        return span_mod(l, r, type);
+    default:
+        assert(false);
+    }
+    if (over) {
+        return span_type(type);
+    }
+    rgspan_t s = {v[0], v[0]};
+    for (size_t i = 1; i < 4; i++) {
+        s = span_join(s, (rgspan_t){v[i], v[i]});
+    }
+    return span_fit(s, type);
+}
+
+/* Truncating division is monotonic in each operand on either side of zero,
+   so the corners of each sign of divisor bound the quotient. A zero
+   divisor traps and contributes nothing. */
+rgspan_t span_div(rgspan_t l, rgspan_t r, tykind_t type) {
+    rgspan_t part[2] = {span_meet(r, (rgspan_t){LLONG_MIN, -1}), span_meet(r, (rgspan_t){1, LLONG_MAX})};
+    rgspan_t s = empty;
+    for (size_t i = 0; i < 2; i++) {
+        rgspan_t p = part[i];
+        if (span_empty(p)) {
+            continue;
+        }
+        if (l.lo == LLONG_MIN && p.lo <= -1 && p.hi >= -1) {
+            return span_type(type);
+        }
+        long long v[4] = {l.lo / p.lo, l.lo / p.hi, l.hi / p.lo, l.hi / p.hi};
+        for (size_t j = 0; j < 4; j++) {
+            s = span_join(s, (rgspan_t){v[j], v[j]});
+        }
+    }
+    return span_fit(s, type);
+}
+
+/* The remainder takes the dividend's sign and is smaller in magnitude than
+   both the divisor and the dividend. */
+rgspan_t span_mod(rgspan_t l, rgspan_t r, tykind_t type) {
+    if (r.lo == 0 && r.hi == 0) {
+        return empty;
+    }
+    long long most = r.lo == LLONG_MIN ? LLONG_MAX : (-r.lo > r.hi ? -r.lo : r.hi) - 1;
+    long long below = l.lo == LLONG_MIN ? LLONG_MAX : -l.lo;
+    rgspan_t s = {0, 0};
+    if (l.lo < 0) {
+        s.lo = -(below < most ? below : most);
+    }
+    if (l.hi > 0) {
+        s.hi = l.hi < most ? l.hi : most;
+    }
+    return span_fit(s, type);
+}
+
+/* One when the operands can only compare true, zero when only false. */
+rgspan_t span_compare(askind_t kind, rgspan_t l, rgspan_t r) {
+    if (span_empty(l) || span_empty(r)) {
+        return empty;
+    }
+    bool yes, no;
+    switch (kind) {
+    case AS_EQ:
+    case AS_NE:
+        yes = l.lo == l.hi && r.lo == r.hi && l.lo == r.lo;
+        no = span_empty(span_meet(l, r));
+        if (kind == AS_NE) {
+            bool tmp = yes;
+            yes = no;
+            no = tmp;
+        }
+        break;
+    case AS_LT:
+        yes = l.hi < r.lo;
+        no = l.lo >= r.hi;
+        break;
+    case AS_LE:
+        yes = l.hi <= r.lo;
+        no = l.lo > r.hi;
+        break;
+    case AS_GT:
+        yes = l.lo > r.hi;
+        no = l.hi <= r.lo;
+        break;
+    case AS_GE:
+        yes = l.lo >= r.hi;
+        no = l.hi < r.lo;
+        break;
+    default:
+        assert(false);
+    }
+    return (rgspan_t){yes, !no};
+}
+
+rgspan_t span_join(rgspan_t a, rgspan_t b) {
+    if (span_empty(a)) {
+        return b;
+    }
+    if (span_empty(b)) {
+        return a;
+    }
+    return (rgspan_t){a.lo < b.lo ? a.lo : b.lo, a.hi > b.hi ? a.hi : b.hi};
+}
+
+rgspan_t span_meet(rgspan_t a, rgspan_t b) {
+    return (rgspan_t){a.lo > b.lo ? a.lo : b.lo, a.hi < b.hi ? a.hi : b.hi};
+}
+
+/* Removes the single value of b from a, which an interval can only do at
+   an end. */
+rgspan_t span_trim(rgspan_t a, rgspan_t b) {
+    if (span_empty(a) || b.lo != b.hi) {
+        return a;
+    }
+    if (a.lo == b.lo) {
+        return a.lo == a.hi ? empty : (rgspan_t){a.lo + 1, a.hi};
+    }
+    if (a.hi == b.lo) {
+        return (rgspan_t){a.lo, a.hi - 1};
+    }
+    return a;
+}
+
+bool span_empty(rgspan_t s) {
+    return s.lo > s.hi;
+}
+
+void state_copy(rgstate_t *dst, rgstate_t *src) {
+    dst->var = malloc((nvar + 1) * sizeof(rgspan_t));
+    assert(dst->var != NULL);
+    for (size_t i = 0; i < nvar; i++) {
+        dst->var[i] = src->var[i];
+    }
+    dst->dead = src->dead;
+    return;
+}
+
+/* Joins src into dst and says whether dst grew. Widening sends a bound
+   that moved straight to the limit of the variable's type. */
+bool state_join(rgstate_t *dst, rgstate_t *src, bool widen) {
+    if (src->dead) {
+        return false;
+    }
+    if (dst->dead) {
+        for (size_t i = 0; i < nvar; i++) {
+            dst->var[i] = src->var[i];
+        }
+        dst->dead = false;
+        return true;
+    }
+    bool change = false;
+    for (size_t i = 0; i < nvar; i++) {
+        rgspan_t old = dst->var[i];
+        rgspan_t s = span_join(old, src->var[i]);
+        if (widen && s.lo < old.lo) {
+            s.lo = span_type(vtype[i]).lo;
+        }
+        if (widen && s.hi > old.hi) {
+            s.hi = span_type(vtype[i]).hi;
+        }
+        change |= s.lo != old.lo || s.hi != old.hi;
+        dst->var[i] = s;
+    }
+    return change;
+}
+
+void state_free(rgstate_t *st) {
+    free(st->var);
+    return;
+}
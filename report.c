@@ -0,0 +1,183 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "main.h"
+
+#define NPHASE 16
+#define NCOUNT 8
+
+/* One compiler phase: its wall and CPU time in seconds, the bytes the
+   compiler asked malloc, calloc and realloc for during it, and the net
+   change in heap bytes in use across it. */
+typedef struct {
+    char *name;
+    double wall;
+    double cpu;
+    size_t alloc;
+    long long heap;
+} rpphase_t;
+
+typedef struct {
+    char *name;
+    size_t val;
+} rpcount_t;
+
+void report_begin(void);
+void report_phase(char *);
+void report_count(char *, size_t);
+void report_show(FILE *, bool, bool, bool);
+static void report_text(FILE *, bool, bool);
+static void report_json(FILE *, bool, bool);
+static void report_mark(double *, double *, size_t *, long long *);
+void *__real_malloc(size_t);
+void *__real_calloc(size_t, size_t);
+void *__real_realloc(void *, size_t);
+void *__wrap_malloc(size_t);
+void *__wrap_calloc(size_t, size_t);
+void *__wrap_realloc(void *, size_t);
+
+static bool on;
+static rpphase_t phase[NPHASE];
+static size_t nphase;
+static rpcount_t count[NCOUNT];
+static size_t ncount;
+static double wall;
+static double cpu;
+static size_t alloc;
+static long long heap;
+static size_t allocated;
+
+void report_begin(void) {
+    on = true;
+    report_mark(&wall, &cpu, &alloc, &heap);
+    return;
+}
+
+/* Closes the phase that began at the previous mark. */
+void report_phase(char *name) {
+    if (!on) {
+        return;
+    }
+    assert(nphase < NPHASE);
+    double w, c;
+    size_t a;
+    long long h;
+    report_mark(&w, &c, &a, &h);
+    phase[nphase++] = (rpphase_t){name, w - wall, c - cpu, a - alloc, h - heap};
+    report_mark(&wall, &cpu, &alloc, &heap);
+    return;
+}
+
+void report_count(char *name, size_t val) {
+    if (!on) {
+        return;
+    }
+    assert(ncount < NCOUNT);
+    count[ncount++] = (rpcount_t){name, val};
+    return;
+}
+
+void report_show(FILE *ofp, bool time, bool mem, bool json) {
+    if (json) {
+        report_json(ofp, time, mem);
+    } else {
+        report_text(ofp, time, mem);
+    }
+    return;
+}
+
+void report_text(FILE *ofp, bool time, bool mem) {
+    rpphase_t total = {"total", 0, 0, 0, 0};
+    for (size_t i = 0; i < nphase; i++) {
+        total.wall += phase[i].wall;
+        total.cpu += phase[i].cpu;
+        total.alloc += phase[i].alloc;
+        total.heap += phase[i].heap;
+    }
+    for (size_t i = 0; time && i <= nphase; i++) {
+        rpphase_t *p = i < nphase ? &phase[i] : &total;
+        fprintf(ofp, "time: %-16s %10.3f ms wall %10.3f ms cpu\n", p->name, p->wall * 1e3, p->cpu * 1e3);
+    }
+    for (size_t i = 0; mem && i <= nphase; i++) {
+        rpphase_t *p = i < nphase ? &phase[i] : &total;
+        fprintf(ofp, "heap: %-16s %12zu bytes allocated %+12lld net\n", p->name, p->alloc, p->heap);
+    }
+    for (size_t i = 0; i < ncount; i++) {
+        fprintf(ofp, "size: %-16s %zu\n", count[i].name, count[i].val);
+    }
+    if (mem) {
+        struct rusage ru;
+        assert(getrusage(RUSAGE_SELF, &ru) == 0);
+        fprintf(ofp, "size: %-16s %ld KiB\n", "peak rss", ru.ru_maxrss);
+    }
+    return;
+}
+
+/* One object; phase names and count names are fixed identifiers, so
+   nothing needs escaping. */
+void report_json(FILE *ofp, bool time, bool mem) {
+    fputs("{\"phases\": [", ofp);
+    for (size_t i = 0; i < nphase; i++) {
+        fprintf(ofp, "%s{\"name\": \"%s\"", i > 0 ? ", " : "", phase[i].name);
+        if (time) {
+            fprintf(ofp, ", \"wall_ms\": %.3f, \"cpu_ms\": %.3f", phase[i].wall * 1e3, phase[i].cpu * 1e3);
+        }
+        if (mem) {
+            fprintf(ofp, ", \"alloc_bytes\": %zu, \"net_heap_bytes\": %lld", phase[i].alloc, phase[i].heap);
+        }
+        fputc('}', ofp);
+    }
+    fputs("], \"counts\": {", ofp);
+    for (size_t i = 0; i < ncount; i++) {
+        fprintf(ofp, "%s\"%s\": %zu", i > 0 ? ", " : "", count[i].name, count[i].val);
+    }
+    fputc('}', ofp);
+    if (mem) {
+        struct rusage ru;
+        assert(getrusage(RUSAGE_SELF, &ru) == 0);
+        fprintf(ofp, ", \"peak_rss_kib\": %ld", ru.ru_maxrss);
+    }
+    fputs("}\n", ofp);
+    return;
+}
+
+/* Heap in use counts both arena chunks and blocks malloc mapped directly. */
+void report_mark(double *w, double *c, size_t *a, long long *h) {
+    struct timespec ts;
+    assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+    *w = ts.tv_sec + ts.tv_nsec * 1e-9;
+    assert(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0);
+    *c = ts.tv_sec + ts.tv_nsec * 1e-9;
+    *a = allocated;
+    struct mallinfo2 mi = mallinfo2();
+    *h = (long long)(mi.uordblks + mi.hblkhd);
+    return;
+}
+
+/* The link wraps the compiler's own calls to these (ld --wrap), so
+   allocated grows by every size asked for. Reports describe a single
+   compile on one thread, and nothing is counted until one begins. */
+void *__wrap_malloc(size_t size) {
+    if (on) {
+        allocated += size;
+    }
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    if (on) {
+        allocated += n * size;
+    }
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    if (on) {
+        allocated += size;
+    }
+    return __real_realloc(ptr, size);
+}
@@ -0,0 +1,241 @@
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUN_NBUILD 3
+#define RUN_NCOUNT 5
+#define RUN_PATH 4096
+
+typedef struct {
+    char *name;
+    uint32_t type;
+    uint64_t config;
+} rbcount_t;
+
+/* One run of one build. A counter the machine does not provide, as hardware
+   counters often are not under virtualization, reads as -1. */
+typedef struct {
+    int status;
+    double wall;
+    int64_t count[RUN_NCOUNT];
+} rbrun_t;
+
+int main(int, char **);
+static void run_kernel(char *, size_t);
+static void run_build(size_t, char *, char *);
+static void run_measure(char *, rbrun_t *);
+static int run_open(const rbcount_t *, pid_t);
+static void run_cmd(char **);
+static void run_show(rbrun_t *);
+static double run_ratio(rbrun_t *, rbrun_t *, const char **);
+static double run_now(void);
+
+static const rbcount_t counter[RUN_NCOUNT] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"l1d_misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+    {"task_clock_ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+};
+static const char *build[RUN_NBUILD] = {"cc", "gcc-O0", "gcc-O2"};
+
+static char *compiler = "./main";
+static char dir[] = "/tmp/runbenchXXXXXX";
+static char runtime[RUN_PATH];
+
+/* Builds every kernel with this compiler and with gcc at -O0 and -O2, all
+   linked against the same runtime built at -O2, and runs each build -r
+   times. The fastest run of each build is reported as one JSON object on
+   stdout, along with its ratio to the two gcc builds. The exit statuses
+   of the three builds must agree, since a kernel returns its checksum. */
+int main(int argc, char **argv) {
+    size_t reps = 5;
+    char *rt = "kernels/runtime.c";
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i += 2) {
+        assert(i + 1 < argc);
+        if (strcmp(argv[i], "-r") == 0) {
+            reps = strtoull(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-c") == 0) {
+            compiler = argv[i + 1];
+        } else if (strcmp(argv[i], "-R") == 0) {
+            rt = argv[i + 1];
+        } else {
+            assert(false);
+        }
+    }
+    assert(reps > 0);
+    assert(mkdtemp(dir) != NULL);
+    snprintf(runtime, sizeof(runtime), "%s/runtime.o", dir);
+    run_cmd((char *[]){"gcc", "-O2", "-c", "-o", runtime, rt, NULL});
+    printf("{\"compiler\": \"%s\", \"reps\": %zu, \"kernels\": [", compiler, reps);
+    for (int k = i; k < argc; k++) {
+        printf("%s\n  ", k > i ? "," : "");
+        run_kernel(argv[k], reps);
+    }
+    printf("\n]}\n");
+    assert(unlink(runtime) == 0);
+    assert(rmdir(dir) == 0);
+    return 0;
+}
+
+void run_kernel(char *src, size_t reps) {
+    char *base = strrchr(src, '/');
+    base = base != NULL ? base + 1 : src;
+    size_t len = strcspn(base, ".");
+    rbrun_t best[RUN_NBUILD];
+    for (size_t b = 0; b < RUN_NBUILD; b++) {
+        char exe[RUN_PATH];
+        snprintf(exe, sizeof(exe), "%s/%.*s.%s", dir, (int)len, base, build[b]);
+        run_build(b, src, exe);
+        for (size_t r = 0; r < reps; r++) {
+            rbrun_t run;
+            run_measure(exe, &run);
+            if (r == 0 || run.wall < best[b].wall) {
+                best[b] = run;
+            }
+        }
+        assert(unlink(exe) == 0);
+    }
+    bool agree = best[0].status == best[1].status && best[0].status == best[2].status;
+    printf("{\"name\": \"%.*s\", \"status\": %d, \"agree\": %s, \"builds\": {", (int)len, base, best[0].status,
+           agree ? "true" : "false");
+    for (size_t b = 0; b < RUN_NBUILD; b++) {
+        printf("%s\"%s\": ", b > 0 ? ", " : "", build[b]);
+        run_show(&best[b]);
+    }
+    printf("}, \"ratio\": {");
+    for (size_t b = 1; b < RUN_NBUILD; b++) {
+        const char *by;
+        double ratio = run_ratio(&best[0], &best[b], &by);
+        printf("%s\"%s\": {\"by\": \"%s\", \"value\": %.3f}", b > 1 ? ", " : "", build[b], by, ratio);
+    }
+    printf("}}");
+    fflush(stdout);
+    return;
+}
+
+/* This compiler's assembly is linked by gcc, which is also the assembler;
+   the generated code needs no executable stack. */
+void run_build(size_t b, char *src, char *exe) {
+    if (b == 0) {
+        char asmpath[RUN_PATH];
+        snprintf(asmpath, sizeof(asmpath), "%s/kernel.s", dir);
+        run_cmd((char *[]){compiler, src, asmpath, NULL});
+        run_cmd((char *[]){"gcc", "-z", "noexecstack", "-o", exe, asmpath, runtime, NULL});
+        assert(unlink(asmpath) == 0);
+    } else {
+        run_cmd((char *[]){"gcc", b == 1 ? "-O0" : "-O2", "-o", exe, src, runtime, NULL});
+    }
+    return;
+}
+
+/* The child waits on a pipe until its counters are open; they are enabled
+   by the exec, so the harness's own fork is not counted. */
+void run_measure(char *exe, rbrun_t *run) {
+    int go[2];
+    assert(pipe(go) == 0);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        char c;
+        close(go[1]);
+        if (read(go[0], &c, 1) == 0) {
+            execl(exe, exe, (char *)NULL);
+        }
+        _exit(127);
+    }
+    assert(close(go[0]) == 0);
+    int fd[RUN_NCOUNT];
+    for (size_t i = 0; i < RUN_NCOUNT; i++) {
+        fd[i] = run_open(&counter[i], pid);
+    }
+    double start = run_now();
+    assert(close(go[1]) == 0);
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    run->wall = run_now() - start;
+    assert(WIFEXITED(status) && WEXITSTATUS(status) != 127);
+    run->status = WEXITSTATUS(status);
+    for (size_t i = 0; i < RUN_NCOUNT; i++) {
+        uint64_t val;
+        run->count[i] = -1;
+        if (fd[i] >= 0 && read(fd[i], &val, sizeof(val)) == sizeof(val)) {
+            run->count[i] = val;
+        }
+        if (fd[i] >= 0) {
+            assert(close(fd[i]) == 0);
+        }
+    }
+    return;
+}
+
+/* User space only, which is all perf_event_paranoid 2 allows. */
+int run_open(const rbcount_t *c, pid_t pid) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = c->type;
+    attr.config = c->config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+void run_cmd(char **argv) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    return;
+}
+
+void run_show(rbrun_t *run) {
+    printf("{\"wall_s\": %.6f", run->wall);
+    for (size_t i = 0; i < RUN_NCOUNT; i++) {
+        if (run->count[i] < 0) {
+            printf(", \"%s\": null", counter[i].name);
+        } else {
+            printf(", \"%s\": %lld", counter[i].name, (long long)run->count[i]);
+        }
+    }
+    printf("}");
+    return;
+}
+
+/* Cycles when both runs have them, then task clock, then wall time. */
+double run_ratio(rbrun_t *cc, rbrun_t *ref, const char **by) {
+    size_t pick[2] = {0, RUN_NCOUNT - 1};
+    for (size_t i = 0; i < 2; i++) {
+        size_t c = pick[i];
+        if (cc->count[c] > 0 && ref->count[c] > 0) {
+            *by = counter[c].name;
+            return (double)cc->count[c] / ref->count[c];
+        }
+    }
+    *by = "wall_s";
+    return cc->wall / ref->wall;
+}
+
+double run_now(void) {
+    struct timespec ts;
+    assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
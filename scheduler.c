@@ -0,0 +1,620 @@
+#include <assert.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+
+#define NBLOCK 256
+#define NRES 40
+#define NDEF 4
+#define NUSE 8
+#define RES_FLAGS 32
+#define RES_MEM 33
+
+typedef enum {
+    SC_ALU,
+    SC_MUL,
+    SC_DIV,
+    SC_LOAD,
+    SC_STORE,
+} scclass_t;
+
+#define NCLASS (SC_STORE + 1)
+
+typedef struct {
+    char *name;
+    bool x86;
+    size_t width;
+    size_t latency[NCLASS];
+    size_t unit[NCLASS];
+} model_t;
+
+typedef struct {
+    insn_t insn;
+    char pre[INSN_NOTE];
+    char post[INSN_NOTE];
+    scclass_t cls;
+    size_t latency;
+    size_t def[NDEF];
+    size_t ndef;
+    size_t use[NUSE];
+    size_t nuse;
+    size_t npred;
+    size_t height;
+    size_t ready;
+    size_t cycle;
+    bool done;
+} scnode_t;
+
+void scheduler(FILE *, FILE *);
+bool scheduler_tune(char *);
+void scheduler_report(FILE *);
+static void schedule_block(FILE *);
+static size_t schedule_inorder(void);
+static size_t schedule_list(size_t *);
+static bool decode_x86(scnode_t *);
+static bool decode_a64(scnode_t *);
+static void decode_def(scnode_t *, size_t);
+static void decode_use(scnode_t *, size_t);
+static bool decode_addr(scnode_t *, char *);
+static size_t reg_x86(char *);
+static size_t reg_a64(char *);
+static bool op_in(char *, char **);
+
+static model_t model[] = {
+    {"x86-64", true, 4, {1, 3, 26, 4, 1}, {4, 1, 1, 2, 1}},
+    {"neoverse-n1", false, 4, {1, 3, 12, 4, 1}, {3, 1, 1, 2, 2}},
+    {"cortex-a53", false, 2, {1, 3, 8, 3, 1}, {2, 1, 1, 1, 1}},
+};
+
+#ifdef __x86_64__
+static model_t *tune = &model[0];
+#elif __aarch64__
+static model_t *tune = &model[1];
+#else
+#error
+#endif
+
+static size_t nmodel = sizeof(model) / sizeof(*model);
+static _Thread_local scnode_t *block;
+static _Thread_local size_t nblock;
+static _Thread_local bool (*edge)[NBLOCK];
+static _Thread_local size_t (*delay)[NBLOCK];
+static _Thread_local size_t (*reader)[NBLOCK];
+static _Thread_local size_t order[NBLOCK];
+static _Thread_local size_t nreport;
+static _Thread_local size_t before;
+static _Thread_local size_t after;
+static FILE *report;
+
+/* A .loc line moves with the instruction after it and a .cfi_ line with the
+   one before it, so debug output never changes the schedule. The tables are
+   allocated on a thread's first call rather than declared as arrays, which
+   every process start would otherwise have to zero. */
+void scheduler(FILE *ofp, FILE *ifp) {
+    char line[INSN_LINE];
+    char pre[INSN_NOTE] = "";
+    if (block == NULL) {
+        block = malloc(NBLOCK * sizeof(*block));
+        edge = malloc(NBLOCK * sizeof(*edge));
+        delay = malloc(NBLOCK * sizeof(*delay));
+        reader = malloc(NRES * sizeof(*reader));
+        assert(block != NULL && edge != NULL && delay != NULL && reader != NULL);
+    }
+    while (fgets(line, sizeof(line), ifp) != NULL) {
+        size_t len = strlen(line);
+        if (len > 0 && line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        if (insn_isloc(line)) {
+            insn_note(pre, line);
+            continue;
+        }
+        if (insn_iscfi(line)) {
+            if (nblock > 0) {
+                insn_note(block[nblock - 1].post, line);
+            } else {
+                fprintf(ofp, "%s\n", line);
+            }
+            continue;
+        }
+        scnode_t *node = &block[nblock];
+        insn_read(&node->insn, line);
+        node->latency = 0;
+        if (node->insn.kind == IN_OP && (tune->x86 ? decode_x86(node) : decode_a64(node))) {
+            strcpy(node->pre, pre);
+            node->post[0] = '\0';
+            node->latency += tune->latency[node->cls];
+            if (++nblock == NBLOCK) {
+                schedule_block(ofp);
+            }
+        } else {
+            schedule_block(ofp);
+            fputs(pre, ofp);
+            insn_write(ofp, &node->insn);
+        }
+        pre[0] = '\0';
+    }
+    schedule_block(ofp);
+    fputs(pre, ofp);
+    if (report != NULL) {
+        fprintf(report, "sched: total (%s): %zu -> %zu cycles\n", tune->name, before, after);
+    }
+    return;
+}
+
+bool scheduler_tune(char *name) {
+    if (strcmp(name, "generic") == 0) {
+        return true;
+    }
+    for (size_t i = 0; i < nmodel; i++) {
+        if (strcmp(model[i].name, name) == 0) {
+            tune = &model[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+void scheduler_report(FILE *ofp) {
+    report = ofp;
+    return;
+}
+
+void schedule_block(FILE *ofp) {
+    if (nblock == 0) {
+        return;
+    }
+    size_t lastdef[NRES];
+    size_t nreader[NRES];
+    for (size_t r = 0; r < NRES; r++) {
+        lastdef[r] = SIZE_MAX;
+        nreader[r] = 0;
+    }
+    for (size_t i = 0; i < nblock; i++) {
+        for (size_t j = 0; j < nblock; j++) {
+            edge[i][j] = false;
+            delay[i][j] = 0;
+        }
+    }
+    for (size_t j = 0; j < nblock; j++) {
+        scnode_t *node = &block[j];
+        for (size_t k = 0; k < node->nuse; k++) {
+            size_t r = node->use[k], i = lastdef[r];
+            if (i != SIZE_MAX) {
+                edge[i][j] = true;
+                delay[i][j] = block[i].latency > delay[i][j] ? block[i].latency : delay[i][j];
+            }
+        }
+        for (size_t k = 0; k < node->ndef; k++) {
+            size_t r = node->def[k];
+            if (lastdef[r] != SIZE_MAX && lastdef[r] != j) {
+                edge[lastdef[r]][j] = true;
+            }
+            for (size_t m = 0; m < nreader[r]; m++) {
+                if (reader[r][m] != j) {
+                    edge[reader[r][m]][j] = true;
+                }
+            }
+        }
+        for (size_t k = 0; k < node->nuse; k++) {
+            size_t r = node->use[k];
+            if (nreader[r] == 0 || reader[r][nreader[r] - 1] != j) {
+                reader[r][nreader[r]++] = j;
+            }
+        }
+        for (size_t k = 0; k < node->ndef; k++) {
+            size_t r = node->def[k];
+            lastdef[r] = j;
+            nreader[r] = 0;
+        }
+    }
+    for (size_t i = nblock; i > 0; i--) {
+        scnode_t *node = &block[i - 1];
+        node->height = node->latency;
+        node->npred = 0;
+        for (size_t j = i; j < nblock; j++) {
+            if (edge[i - 1][j] && delay[i - 1][j] + block[j].height > node->height) {
+                node->height = delay[i - 1][j] + block[j].height;
+            }
+        }
+        for (size_t j = 0; j < i - 1; j++) {
+            node->npred += edge[j][i - 1];
+        }
+    }
+    size_t cycles = schedule_inorder();
+    size_t sched = schedule_list(order);
+    if (sched > cycles) {
+        for (size_t i = 0; i < nblock; i++) {
+            order[i] = i;
+        }
+        sched = cycles;
+    }
+    if (report != NULL) {
+        fprintf(report, "sched: block %zu: %zu insns, %zu -> %zu cycles\n", nreport, nblock, cycles, sched);
+    }
+    nreport++;
+    before += cycles;
+    after += sched;
+    for (size_t i = 0; i < nblock; i++) {
+        fputs(block[order[i]].pre, ofp);
+        insn_write(ofp, &block[order[i]].insn);
+        fputs(block[order[i]].post, ofp);
+    }
+    nblock = 0;
+    return;
+}
+
+size_t schedule_inorder(void) {
+    size_t cycle = 0, issued = 0, end = 0;
+    size_t busy[NCLASS] = {0};
+    for (size_t j = 0; j < nblock; j++) {
+        size_t ready = cycle;
+        for (size_t i = 0; i < j; i++) {
+            if (edge[i][j] && block[i].cycle + delay[i][j] > ready) {
+                ready = block[i].cycle + delay[i][j];
+            }
+        }
+        if (ready > cycle || issued == tune->width || busy[block[j].cls] == tune->unit[block[j].cls]) {
+            cycle = ready > cycle ? ready : cycle + 1;
+            issued = 0;
+            for (size_t c = 0; c < NCLASS; c++) {
+                busy[c] = 0;
+            }
+        }
+        block[j].cycle = cycle;
+        issued++;
+        busy[block[j].cls]++;
+        end = cycle + block[j].latency > end ? cycle + block[j].latency : end;
+    }
+    return end;
+}
+
+size_t schedule_list(size_t *out) {
+    size_t nout = 0, end = 0;
+    for (size_t i = 0; i < nblock; i++) {
+        block[i].done = false;
+        block[i].ready = 0;
+    }
+    size_t npred[NBLOCK];
+    for (size_t i = 0; i < nblock; i++) {
+        npred[i] = block[i].npred;
+    }
+    for (size_t cycle = 0; nout < nblock; cycle++) {
+        size_t issued = 0;
+        size_t busy[NCLASS] = {0};
+        for (bool progress = true; progress && issued < tune->width;) {
+            progress = false;
+            size_t best = SIZE_MAX;
+            for (size_t i = 0; i < nblock; i++) {
+                scnode_t *node = &block[i];
+                if (node->done || npred[i] > 0 || node->ready > cycle || busy[node->cls] == tune->unit[node->cls]) {
+                    continue;
+                }
+                if (best == SIZE_MAX || node->height > block[best].height) {
+                    best = i;
+                }
+            }
+            if (best == SIZE_MAX) {
+                break;
+            }
+            scnode_t *node = &block[best];
+            node->done = true;
+            node->cycle = cycle;
+            out[nout++] = best;
+            issued++;
+            busy[node->cls]++;
+            end = cycle + node->latency > end ? cycle + node->latency : end;
+            for (size_t j = 0; j < nblock; j++) {
+                if (edge[best][j]) {
+                    npred[j]--;
+                    block[j].ready = cycle + delay[best][j] > block[j].ready ? cycle + delay[best][j] : block[j].ready;
+                }
+            }
+            progress = true;
+        }
+    }
+    return end;
+}
+
+bool decode_x86(scnode_t *node) {
+    static char *mov[] = {"movb", "movw", "movl", "movq", "movabsq", "movsbl", "movswl", "movslq", "movzbl", "movzwl", NULL};
+    static char *alu[] = {"addl", "addq", "subl", "subq", "andl", "andq", "orl", "orq", "xorl", "xorq", NULL};
+    static char *cmp[] = {"cmpb", "cmpw", "cmpl", "cmpq", "testb", "testw", "testl", "testq", NULL};
+    static char *set[] = {"sete", "setne", "setl", "setle", "setg", "setge", NULL};
+    insn_t *insn = &node->insn;
+    node->ndef = node->nuse = 0;
+    node->cls = SC_ALU;
+    char *op = insn->op;
+    size_t n = insn->narg;
+    if (op_in(op, mov) && n == 2) {
+        if (!decode_addr(node, insn->arg[0])) {
+            return false;
+        }
+        node->cls = strchr(insn->arg[0], '(') != NULL ? SC_LOAD : SC_ALU;
+        if (strchr(insn->arg[1], '(') != NULL) {
+            node->cls = SC_STORE;
+            decode_def(node, RES_MEM);
+            return decode_addr(node, insn->arg[1]);
+        }
+        size_t reg = reg_x86(insn->arg[1]);
+        if (reg == SIZE_MAX) {
+            return false;
+        }
+        if (strcmp(op, "movb") == 0 || strcmp(op, "movw") == 0) {
+            decode_use(node, reg);
+        }
+        decode_def(node, reg);
+        return true;
+    }
+    if ((op_in(op, alu) || strcmp(op, "imull") == 0 || strcmp(op, "imulq") == 0) && n == 2) {
+        node->cls = op[0] == 'i' ? SC_MUL : SC_ALU;
+        if (!decode_addr(node, insn->arg[0])) {
+            return false;
+        }
+        if (strchr(insn->arg[0], '(') != NULL) {
+            node->latency += tune->latency[SC_LOAD];
+        }
+        decode_def(node, RES_FLAGS);
+        if (strchr(insn->arg[1], '(') != NULL) {
+            decode_def(node, RES_MEM);
+            return decode_addr(node, insn->arg[1]);
+        }
+        size_t reg = reg_x86(insn->arg[1]);
+        if (reg == SIZE_MAX) {
+            return false;
+        }
+        decode_use(node, reg);
+        decode_def(node, reg);
+        return true;
+    }
+    if ((strncmp(op, "inc", 3) == 0 || strncmp(op, "dec", 3) == 0) && n == 1) {
+        size_t reg = reg_x86(insn->arg[0]);
+        if (reg == SIZE_MAX) {
+            return false;
+        }
+        decode_use(node, reg);
+        decode_def(node, reg);
+        decode_def(node, RES_FLAGS);
+        return true;
+    }
+    if ((strcmp(op, "leal") == 0 || strcmp(op, "leaq") == 0) && n == 2) {
+        size_t reg = reg_x86(insn->arg[1]);
+        if (reg == SIZE_MAX || !decode_addr(node, insn->arg[0])) {
+            return false;
+        }
+        decode_def(node, reg);
+        return true;
+    }
+    if (op_in(op, cmp) && n == 2) {
+        decode_def(node, RES_FLAGS);
+        return decode_addr(node, insn->arg[0]) && decode_addr(node, insn->arg[1]);
+    }
+    if (op_in(op, set) && n == 1) {
+        size_t reg = reg_x86(insn->arg[0]);
+        if (reg == SIZE_MAX) {
+            return false;
+        }
+        decode_use(node, RES_FLAGS);
+        decode_use(node, reg);
+        decode_def(node, reg);
+        return true;
+    }
+    if ((strcmp(op, "cltd") == 0 || strcmp(op, "cqto") == 0) && n == 0) {
+        decode_use(node, reg_x86("%rax"));
+        decode_def(node, reg_x86("%rdx"));
+        return true;
+    }
+    if ((strcmp(op, "idivl") == 0 || strcmp(op, "idivq") == 0 || strcmp(op, "divl") == 0 || strcmp(op, "divq") == 0) && n == 1) {
+        node->cls = SC_DIV;
+        decode_use(node, reg_x86("%rax"));
+        decode_use(node, reg_x86("%rdx"));
+        decode_def(node, reg_x86("%rax"));
+        decode_def(node, reg_x86("%rdx"));
+        decode_def(node, RES_FLAGS);
+        return decode_addr(node, insn->arg[0]);
+    }
+    return false;
+}
+
+bool decode_a64(scnode_t *node) {
+    static char *alu[] = {"mov", "add", "sub", "and", "orr", "eor", "lsl", "asr", "sxtb", "sxth", "sxtw", "movz", "movn", NULL};
+    static char *mul[] = {"mul", "madd", "msub", NULL};
+    static char *div[] = {"sdiv", "udiv", NULL};
+    static char *load[] = {"ldr", "ldrb", "ldrh", "ldrsb", "ldrsh", "ldrsw", "ldur", NULL};
+    static char *store[] = {"str", "strb", "strh", "stur", NULL};
+    insn_t *insn = &node->insn;
+    node->ndef = node->nuse = 0;
+    node->cls = SC_ALU;
+    char *op = insn->op;
+    size_t n = insn->narg;
+    if (op_in(op, load) || op_in(op, store)) {
+        if (n != 2 || insn->arg[1][0] != '[' || strchr(insn->arg[1], '!') != NULL) {
+            return false;
+        }
+        size_t reg = reg_a64(insn->arg[0]);
+        if (reg == SIZE_MAX || !decode_addr(node, insn->arg[1])) {
+            return false;
+        }
+        if (op_in(op, load)) {
+            node->cls = SC_LOAD;
+            decode_use(node, RES_MEM);
+            decode_def(node, reg);
+        } else {
+            node->cls = SC_STORE;
+            decode_use(node, reg);
+            decode_def(node, RES_MEM);
+        }
+        return true;
+    }
+    if (strcmp(op, "ldp") == 0 || strcmp(op, "stp") == 0) {
+        if (n != 3 || insn->arg[2][0] != '[' || strchr(insn->arg[2], '!') != NULL) {
+            return false;
+        }
+        size_t reg[2] = {reg_a64(insn->arg[0]), reg_a64(insn->arg[1])};
+        if (reg[0] == SIZE_MAX || reg[1] == SIZE_MAX || !decode_addr(node, insn->arg[2])) {
+            return false;
+        }
+        if (op[0] == 'l') {
+            node->cls = SC_LOAD;
+            decode_use(node, RES_MEM);
+            decode_def(node, reg[0]);
+            decode_def(node, reg[1]);
+        } else {
+            node->cls = SC_STORE;
+            decode_use(node, reg[0]);
+            decode_use(node, reg[1]);
+            decode_def(node, RES_MEM);
+        }
+        return true;
+    }
+    if (strcmp(op, "cmp") == 0) {
+        for (size_t i = 0; i < n; i++) {
+            size_t reg = reg_a64(insn->arg[i]);
+            if (reg != SIZE_MAX) {
+                decode_use(node, reg);
+            } else if (insn->arg[i][0] != '#') {
+                return false;
+            }
+        }
+        decode_def(node, RES_FLAGS);
+        return true;
+    }
+    if (strcmp(op, "cset") == 0 && n == 2) {
+        size_t reg = reg_a64(insn->arg[0]);
+        if (reg == SIZE_MAX) {
+            return false;
+        }
+        decode_use(node, RES_FLAGS);
+        decode_def(node, reg);
+        return true;
+    }
+    if (op_in(op, alu) || op_in(op, mul) || op_in(op, div) || strcmp(op, "movk") == 0) {
+        node->cls = op_in(op, mul) ? SC_MUL : op_in(op, div) ? SC_DIV : SC_ALU;
+        size_t reg = n > 0 ? reg_a64(insn->arg[0]) : SIZE_MAX;
+        if (reg == SIZE_MAX) {
+            return false;
+        }
+        for (size_t i = 1; i < n; i++) {
+            size_t use = reg_a64(insn->arg[i]);
+            if (use != SIZE_MAX) {
+                decode_use(node, use);
+            } else if (insn->arg[i][0] != '#' && strncmp(insn->arg[i], "lsl", 3) != 0) {
+                return false;
+            }
+        }
+        if (strcmp(op, "movk") == 0) {
+            decode_use(node, reg);
+        }
+        decode_def(node, reg);
+        return true;
+    }
+    return false;
+}
+
+void decode_def(scnode_t *node, size_t res) {
+    assert(node->ndef < NDEF);
+    node->def[node->ndef++] = res;
+    return;
+}
+
+void decode_use(scnode_t *node, size_t res) {
+    assert(node->nuse < NUSE);
+    node->use[node->nuse++] = res;
+    return;
+}
+
+bool decode_addr(scnode_t *node, char *arg) {
+    if (arg[0] == '$' || arg[0] == '#') {
+        return true;
+    }
+    if (arg[0] == '%' || isalpha((unsigned char)arg[0])) {
+        size_t reg = tune->x86 ? reg_x86(arg) : reg_a64(arg);
+        if (reg == SIZE_MAX) {
+            return false;
+        }
+        decode_use(node, reg);
+        return true;
+    }
+    char *open = strchr(arg, tune->x86 ? '(' : '[');
+    if (open == NULL) {
+        return false;
+    }
+    decode_use(node, RES_MEM);
+    char name[INSN_ARG];
+    for (char *p = open + 1; *p != '\0' && *p != ')' && *p != ']';) {
+        size_t n = 0;
+        while (*p != '\0' && *p != ',' && *p != ')' && *p != ']') {
+            name[n++] = *p++;
+        }
+        name[n] = '\0';
+        if (*p == ',') {
+            p++;
+        }
+        while (*p == ' ') {
+            p++;
+        }
+        if (n == 0 || name[0] == '#' || isdigit((unsigned char)name[0])) {
+            continue;
+        }
+        size_t reg = tune->x86 ? reg_x86(name) : reg_a64(name);
+        if (reg == SIZE_MAX) {
+            return false;
+        }
+        decode_use(node, reg);
+    }
+    return true;
+}
+
+size_t reg_x86(char *name) {
+    static char *reg[][4] = {
+        {"%al", "%ax", "%eax", "%rax"},
+        {"%cl", "%cx", "%ecx", "%rcx"},
+        {"%dl", "%dx", "%edx", "%rdx"},
+        {"%bl", "%bx", "%ebx", "%rbx"},
+        {"%spl", "%sp", "%esp", "%rsp"},
+        {"%bpl", "%bp", "%ebp", "%rbp"},
+        {"%sil", "%si", "%esi", "%rsi"},
+        {"%dil", "%di", "%edi", "%rdi"},
+        {"%r8b", "%r8w", "%r8d", "%r8"},
+        {"%r9b", "%r9w", "%r9d", "%r9"},
+        {"%r10b", "%r10w", "%r10d", "%r10"},
+        {"%r11b", "%r11w", "%r11d", "%r11"},
+        {"%r12b", "%r12w", "%r12d", "%r12"},
+        {"%r13b", "%r13w", "%r13d", "%r13"},
+        {"%r14b", "%r14w", "%r14d", "%r14"},
+        {"%r15b", "%r15w", "%r15d", "%r15"},
+    };
+    for (size_t i = 0; i < 16; i++) {
+        for (size_t j = 0; j < 4; j++) {
+            if (strcmp(reg[i][j], name) == 0) {
+                return i;
+            }
+        }
+    }
+    return SIZE_MAX;
+}
+
+size_t reg_a64(char *name) {
+    if (strcmp(name, "sp") == 0) {
+        return 31;
+    }
+    if ((name[0] != 'w' && name[0] != 'x') || !isdigit((unsigned char)name[1])) {
+        return SIZE_MAX;
+    }
+    char *end;
+    long num = strtol(name + 1, &end, 10);
+    return *end == '\0' && num <= 30 ? (size_t)num : SIZE_MAX;
+}
+
+bool op_in(char *op, char **list) {
+    for (; *list != NULL; list++) {
+        if (strcmp(op, *list) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
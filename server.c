@@ -0,0 +1,270 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "main.h"
+
+#define SERVER_CONF 4096
+#define SERVER_NAME 4096
+#define SERVER_CHUNK 65536
+
+/* A request is the client's option lines, the input's name and the source,
+   each a uint64_t length and the bytes, then one byte asking for the token
+   and tree dumps. The reply is one byte, zero when the options differ from
+   the server's, then the output and the dumps in the same framing. A client
+   that reads no reply leaves the compile to main instead. */
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} svbuf_t;
+
+void server(char *, size_t, char *, int (*)(char *, FILE *, FILE *, FILE *));
+bool server_client(char *, char *, char *, FILE *, FILE *, FILE *);
+static void server_spawn(int);
+static void server_serve(int);
+static int server_connect(char *);
+static bool server_recv(int, void *, size_t);
+static bool server_send(int, const void *, size_t);
+static bool server_recvbuf(int, svbuf_t *, size_t);
+static bool server_sendbuf(int, svbuf_t *);
+static void buf_file(svbuf_t *, FILE *);
+static void buf_reserve(svbuf_t *, size_t);
+
+static int alive[2];
+static char *conf;
+static int (*work)(char *, FILE *, FILE *, FILE *);
+static svbuf_t name;
+static svbuf_t src;
+static svbuf_t out;
+static svbuf_t dump;
+
+/* Workers are forked up front and each accepts connections in a loop, so
+   their buffers and heap stay warm from one request to the next. A syntax
+   error aborts the worker that hit it; the master forks a replacement and
+   the client, left without a reply, has main report the error. Workers
+   watch a pipe only the master writes to, and leave when it closes. */
+void server(char *sock, size_t nworker, char *cf, int (*fn)(char *, FILE *, FILE *, FILE *)) {
+    struct sockaddr_un addr = {0};
+    assert(strlen(sock) < sizeof(addr.sun_path));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sock);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    unlink(sock);
+    assert(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    assert(listen(fd, SOMAXCONN) == 0);
+    assert(fcntl(fd, F_SETFL, O_NONBLOCK) == 0);
+    assert(pipe(alive) == 0);
+    signal(SIGPIPE, SIG_IGN);
+    conf = cf;
+    work = fn;
+    if (nworker == 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        nworker = n > 0 ? n : 1;
+    }
+    for (size_t i = 0; i < nworker; i++) {
+        server_spawn(fd);
+    }
+    for (;;) {
+        if (wait(NULL) > 0) {
+            server_spawn(fd);
+        }
+    }
+}
+
+/* Returns false when no server answers or it will not take the request;
+   nothing has been written to ofp or dfp then. */
+bool server_client(char *sock, char *cf, char *path, FILE *ifp, FILE *ofp, FILE *dfp) {
+    int fd = server_connect(sock);
+    if (fd < 0) {
+        return false;
+    }
+    svbuf_t buf = {NULL, 0, 0};
+    buf_file(&buf, ifp);
+    uint64_t len[3] = {strlen(cf), strlen(path), buf.len};
+    char want = dfp != NULL;
+    char ok = 0;
+    bool done = server_send(fd, &len[0], sizeof(uint64_t)) && server_send(fd, cf, len[0]) &&
+                server_send(fd, &len[1], sizeof(uint64_t)) && server_send(fd, path, len[1]) &&
+                server_send(fd, &len[2], sizeof(uint64_t)) && server_send(fd, buf.buf, len[2]) &&
+                server_send(fd, &want, 1) && server_recv(fd, &ok, 1) && ok;
+    svbuf_t res[2] = {{NULL, 0, 0}, {NULL, 0, 0}};
+    for (size_t i = 0; i < 2 && done; i++) {
+        done = server_recv(fd, &len[i], sizeof(uint64_t)) && server_recvbuf(fd, &res[i], len[i]);
+    }
+    assert(close(fd) == 0);
+    if (done) {
+        assert(fwrite(res[0].buf, 1, res[0].len, ofp) == res[0].len);
+        if (dfp != NULL) {
+            assert(fwrite(res[1].buf, 1, res[1].len, dfp) == res[1].len);
+        }
+    }
+    free(buf.buf);
+    free(res[0].buf);
+    free(res[1].buf);
+    return done;
+}
+
+/* The listening socket is non-blocking, so the workers a connection did
+   not go to return to poll and keep watching the pipe. */
+void server_spawn(int fd) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid > 0) {
+        return;
+    }
+    assert(close(alive[1]) == 0);
+    struct pollfd watch[2] = {{fd, POLLIN, 0}, {alive[0], POLLIN, 0}};
+    for (;;) {
+        if (poll(watch, 2, -1) < 0) {
+            continue;
+        }
+        if (watch[1].revents != 0) {
+            _exit(0);
+        }
+        int conn = accept(fd, NULL, NULL);
+        if (conn >= 0) {
+            assert(fcntl(conn, F_SETFL, 0) == 0);
+            server_serve(conn);
+            assert(close(conn) == 0);
+        }
+    }
+}
+
+/* A client that hangs up early just loses its reply. */
+void server_serve(int fd) {
+    uint64_t len;
+    char want;
+    if (!server_recv(fd, &len, sizeof(uint64_t)) || len >= SERVER_CONF) {
+        return;
+    }
+    char cf[SERVER_CONF];
+    if (!server_recv(fd, cf, len)) {
+        return;
+    }
+    cf[len] = '\0';
+    if (!server_recv(fd, &len, sizeof(uint64_t)) || len >= SERVER_NAME || !server_recvbuf(fd, &name, len)) {
+        return;
+    }
+    name.buf[len] = '\0';
+    if (!server_recv(fd, &len, sizeof(uint64_t)) || !server_recvbuf(fd, &src, len) || !server_recv(fd, &want, 1)) {
+        return;
+    }
+    char ok = strcmp(cf, conf) == 0;
+    if (!server_send(fd, &ok, 1) || !ok) {
+        return;
+    }
+    FILE *ifp = src.len == 0 ? fopen("/dev/null", "r") : fmemopen(src.buf, src.len, "r");
+    FILE *ofp = tmpfile();
+    FILE *dfp = want ? tmpfile() : NULL;
+    assert(ifp != NULL && ofp != NULL && (!want || dfp != NULL));
+    work(name.buf, ifp, ofp, dfp);
+    assert(fclose(ifp) == 0);
+    rewind(ofp);
+    buf_file(&out, ofp);
+    assert(fclose(ofp) == 0);
+    dump.len = 0;
+    if (dfp != NULL) {
+        rewind(dfp);
+        buf_file(&dump, dfp);
+        assert(fclose(dfp) == 0);
+    }
+    if (server_sendbuf(fd, &out)) {
+        server_sendbuf(fd, &dump);
+    }
+    return;
+}
+
+int server_connect(char *sock) {
+    struct sockaddr_un addr = {0};
+    if (strlen(sock) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sock);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        assert(close(fd) == 0);
+        return -1;
+    }
+    return fd;
+}
+
+bool server_recv(int fd, void *buf, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t n = read(fd, (char *)buf + done, len - done);
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+bool server_send(int fd, const void *buf, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t n = write(fd, (const char *)buf + done, len - done);
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+/* The length is only trusted as far as the bytes that actually arrive, so
+   the buffer grows a chunk at a time. */
+bool server_recvbuf(int fd, svbuf_t *b, size_t len) {
+    b->len = 0;
+    while (b->len < len) {
+        size_t n = len - b->len < SERVER_CHUNK ? len - b->len : SERVER_CHUNK;
+        buf_reserve(b, n);
+        if (!server_recv(fd, b->buf + b->len, n)) {
+            return false;
+        }
+        b->len += n;
+    }
+    buf_reserve(b, 1);
+    return true;
+}
+
+bool server_sendbuf(int fd, svbuf_t *b) {
+    uint64_t len = b->len;
+    return server_send(fd, &len, sizeof(uint64_t)) && server_send(fd, b->buf, b->len);
+}
+
+void buf_file(svbuf_t *b, FILE *fp) {
+    b->len = 0;
+    size_t n;
+    do {
+        buf_reserve(b, SERVER_CHUNK);
+        n = fread(b->buf + b->len, 1, SERVER_CHUNK, fp);
+        b->len += n;
+    } while (n > 0);
+    assert(!ferror(fp));
+    return;
+}
+
+void buf_reserve(svbuf_t *b, size_t n) {
+    if (b->len + n <= b->cap) {
+        return;
+    }
+    while (b->len + n > b->cap) {
+        b->cap = b->cap == 0 ? SERVER_CHUNK : b->cap * 2;
+    }
+    b->buf = realloc(b->buf, b->cap);
+    assert(b->buf != NULL);
+    return;
+}
@@ -0,0 +1,268 @@
+#include <assert.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+
+typedef struct {
+    bool label;
+    char name[INSN_ARG];
+    size_t ofs;
+    size_t size;
+    size_t grow;
+} szitem_t;
+
+typedef struct {
+    char name[INSN_ARG];
+    size_t size;
+} szfunc_t;
+
+void sizer(FILE *, FILE *);
+void sizer_report(FILE *);
+static void size_flush(void);
+static szitem_t *size_item(void);
+static size_t size_insn(insn_t *, size_t *);
+
+static _Thread_local szitem_t *item;
+static _Thread_local size_t nitem;
+static _Thread_local size_t citem;
+static _Thread_local szfunc_t *func;
+static _Thread_local size_t nfunc;
+static _Thread_local size_t cfunc;
+static _Thread_local size_t total;
+
+void sizer(FILE *ofp, FILE *ifp) {
+    char line[INSN_LINE];
+    insn_t insn;
+    while (fgets(line, sizeof(line), ifp) != NULL) {
+        fputs(line, ofp);
+        size_t len = strlen(line);
+        if (line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        insn_read(&insn, line);
+        if (insn.kind == IN_LABEL && strncmp(insn.text, ".L", 2) != 0) {
+            size_flush();
+            if (nfunc == cfunc) {
+                cfunc = cfunc == 0 ? 16 : cfunc * 2;
+                func = realloc(func, sizeof(szfunc_t) * cfunc);
+                assert(func != NULL);
+            }
+            strcpy(func[nfunc].name, insn.text);
+            func[nfunc++].size = 0;
+        } else if (insn.kind == IN_LABEL) {
+            szitem_t *it = size_item();
+            it->label = true;
+            strcpy(it->name, insn.text);
+        } else if (insn.kind == IN_OP) {
+            szitem_t *it = size_item();
+            it->size = size_insn(&insn, &it->grow);
+            if (it->grow != 0) {
+                strcpy(it->name, insn.arg[0]);
+            }
+        }
+    }
+    size_flush();
+    return;
+}
+
+void sizer_report(FILE *ofp) {
+    for (size_t i = 0; i < nfunc; i++) {
+        fprintf(ofp, "text: %-16s %zu\n", func[i].name, func[i].size);
+    }
+    fprintf(ofp, "text: %-16s %zu\n", "total", total);
+    return;
+}
+
+/* Starts from short branches and lengthens every branch whose target is out of
+   rel8 range until nothing changes, the same fixed point the assembler finds. */
+void size_flush(void) {
+    size_t ofs;
+    for (bool change = true; change;) {
+        change = false;
+        ofs = 0;
+        for (size_t i = 0; i < nitem; i++) {
+            item[i].ofs = ofs;
+            ofs += item[i].size;
+        }
+        for (size_t i = 0; i < nitem; i++) {
+            if (item[i].grow == 0) {
+                continue;
+            }
+            long long dist = LLONG_MAX;
+            for (size_t j = 0; j < nitem; j++) {
+                if (item[j].label && strcmp(item[j].name, item[i].name) == 0) {
+                    dist = (long long)item[j].ofs - (long long)(item[i].ofs + item[i].size);
+                    break;
+                }
+            }
+            if (dist < -128 || dist > 127) {
+                item[i].size += item[i].grow;
+                item[i].grow = 0;
+                change = true;
+            }
+        }
+    }
+    if (nfunc > 0) {
+        func[nfunc - 1].size += ofs;
+    }
+    total += ofs;
+    nitem = 0;
+    return;
+}
+
+szitem_t *size_item(void) {
+    if (nitem == citem) {
+        citem = citem == 0 ? 256 : citem * 2;
+        item = realloc(item, sizeof(szitem_t) * citem);
+        assert(item != NULL);
+    }
+    item[nitem] = (szitem_t){0};
+    return &item[nitem++];
+}
+
+#ifdef __x86_64__
+static size_t size_reg(char *, bool *);
+static size_t size_mem(char *, bool *);
+static size_t size_imm(char);
+
+size_t size_insn(insn_t *insn, size_t *grow) {
+    static char *alu[] = {"add", "sub", "and", "or", "xor", "cmp", "test", NULL};
+    char *op = insn->op;
+    size_t n = insn->narg;
+    char last = op[strlen(op) - 1];
+    *grow = 0;
+    if (strcmp(op, "ret") == 0 || strcmp(op, "leave") == 0 || strcmp(op, "cltd") == 0) {
+        return 1;
+    }
+    if (strcmp(op, "cqto") == 0) {
+        return 2;
+    }
+    if (strcmp(op, "call") == 0) {
+        return 5;
+    }
+    if (strcmp(op, "jmp") == 0) {
+        *grow = 3;
+        return 2;
+    }
+    if (op[0] == 'j') {
+        *grow = 4;
+        return 2;
+    }
+    bool rex = strcmp(op, "movslq") == 0 || (last == 'q' && strcmp(op, "pushq") != 0 && strcmp(op, "popq") != 0);
+    bool imm = false, acc = false, mem = false;
+    long long val = 0;
+    size_t modrm = 1;
+    for (size_t i = 0; i < n; i++) {
+        char *arg = insn->arg[i];
+        if (arg[0] == '$') {
+            imm = true;
+            val = strtoll(arg + 1, NULL, 10);
+        } else if (arg[0] == '%') {
+            acc = size_reg(arg, &rex) == 0 && i + 1 == n;
+        } else {
+            modrm = size_mem(arg, &rex);
+            mem = true;
+        }
+    }
+    bool imm8 = val >= -128 && val <= 127;
+    size_t body = 1 + modrm + (imm ? 4 : 0);
+    if (strcmp(op, "pushq") == 0 || strcmp(op, "popq") == 0) {
+        body = imm ? (imm8 ? 2 : 5) : mem ? 1 + modrm : 1;
+    } else if (strcmp(op, "movabsq") == 0) {
+        body = 1 + 8;
+    } else if (strncmp(op, "movs", 4) == 0 || strncmp(op, "movz", 4) == 0) {
+        body = (strcmp(op, "movslq") == 0 ? 1 : 2) + modrm;
+    } else if (strncmp(op, "mov", 3) == 0) {
+        body = !imm ? 1 + modrm : mem || last == 'q' ? 1 + modrm + size_imm(last) : 1 + size_imm(last);
+    } else if (strncmp(op, "imul", 4) == 0) {
+        body = imm ? 1 + modrm + (imm8 ? 1 : 4) : 2 + modrm;
+    } else if (strncmp(op, "set", 3) == 0) {
+        body = 2 + modrm;
+    } else if (strncmp(op, "lea", 3) == 0 || strncmp(op, "inc", 3) == 0 || strncmp(op, "dec", 3) == 0 || strncmp(op, "idiv", 4) == 0 || strncmp(op, "div", 3) == 0) {
+        body = 1 + modrm;
+    } else {
+        for (size_t i = 0; alu[i] != NULL; i++) {
+            if (strncmp(op, alu[i], strlen(alu[i])) != 0) {
+                continue;
+            }
+            if (!imm) {
+                body = 1 + modrm;
+            } else if (acc && (strcmp(alu[i], "test") == 0 || last == 'b' || !imm8)) {
+                body = 1 + size_imm(last);
+            } else if (strcmp(alu[i], "test") != 0 && imm8) {
+                body = 1 + modrm + 1;
+            } else {
+                body = 1 + modrm + size_imm(last);
+            }
+            break;
+        }
+    }
+    return (last == 'w') + rex + body;
+}
+
+size_t size_reg(char *arg, bool *rex) {
+    static char *name[][4] = {
+        {"%al", "%ax", "%eax", "%rax"},
+        {"%cl", "%cx", "%ecx", "%rcx"},
+        {"%dl", "%dx", "%edx", "%rdx"},
+        {"%bl", "%bx", "%ebx", "%rbx"},
+        {"%spl", "%sp", "%esp", "%rsp"},
+        {"%bpl", "%bp", "%ebp", "%rbp"},
+        {"%sil", "%si", "%esi", "%rsi"},
+        {"%dil", "%di", "%edi", "%rdi"},
+    };
+    if (arg[1] == 'r' && isdigit((unsigned char)arg[2])) {
+        *rex = true;
+        return strtoul(arg + 2, NULL, 10);
+    }
+    for (size_t r = 0; r < 8; r++) {
+        for (size_t w = 0; w < 4; w++) {
+            if (strcmp(arg, name[r][w]) == 0) {
+                *rex |= w == 0 && r >= 4;
+                return r;
+            }
+        }
+    }
+    assert(false);
+    return 0;
+}
+
+/* ModRM plus SIB plus displacement bytes of an AT&T memory operand. */
+size_t size_mem(char *arg, bool *rex) {
+    char *paren = strchr(arg, '(');
+    if (paren == NULL) {
+        return 1 + 4;
+    }
+    long long disp = strtoll(arg, NULL, 10);
+    char base[INSN_ARG] = "", index[INSN_ARG] = "";
+    sscanf(paren + 1, "%[^,)],%[^,)]", base, index);
+    if (base[0] == '\0') {
+        sscanf(paren + 1, ",%[^,)]", index);
+        size_reg(index, rex);
+        return 1 + 1 + 4;
+    }
+    size_t reg = size_reg(base, rex);
+    bool sib = index[0] != '\0' || reg % 8 == 4;
+    if (index[0] != '\0') {
+        size_reg(index, rex);
+    }
+    size_t ndisp = disp == 0 && reg % 8 != 5 ? 0 : disp >= -128 && disp <= 127 ? 1 : 4;
+    return 1 + sib + ndisp;
+}
+
+size_t size_imm(char sfx) {
+    return sfx == 'b' ? 1 : sfx == 'w' ? 2 : 4;
+}
+#elif __aarch64__
+size_t size_insn(insn_t *insn, size_t *grow) {
+    (void)insn;
+    *grow = 0;
+    return 4;
+}
+#else
+#error
+#endif